@@ -6,6 +6,8 @@
 // https://opensource.org/license/MIT
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <signal.h>
 #include "object.h"
@@ -19,6 +21,17 @@ char *imageFilename;
 int webSocketPortNumber = 5000;
 int debugWebSocketPort = 5100;
 
+// Headless runs evaluate the -e, -f, -b and -t actions in order instead of sending
+// the image its start selector, then exit.
+#define MAX_HEADLESS_ACTIONS 64
+char headlessModes[MAX_HEADLESS_ACTIONS];
+char *headlessTargets[MAX_HEADLESS_ACTIONS];
+int numberOfHeadlessActions = 0;
+int headlessIterations = -1;
+int headlessWarmup = -1;
+char *headlessOutputFilename = NULL;
+FILE *headlessOutput;
+
 uint64_t readFromFile(uint8_t *buffer, uint64_t size, void *data){
     FILE *memoryStream = (FILE *) data;
 
@@ -35,9 +48,12 @@ uint64_t readFromFile(uint8_t *buffer, uint64_t size, void *data){
 void loadImageFromFile(char *filename){
     FILE *fileStream = fopen(filename, "rb");
     if(!fileStream)
-		{LOGE("Could not open file %s!", filename);}
+		{LOGE("Could not open file %s!", filename); exit(2);}
     else {
-        loadImage(&readFromFile, (void *) fileStream, filename);
+        if (loadImage(&readFromFile, (void *) fileStream, filename) != 0) {
+            LOGE("Could not load image %s", filename);
+            exit(2);
+        }
         LOGI("Image loaded successfully");
     }
     fclose(fileStream);
@@ -121,6 +137,37 @@ void HookupHandler() {
     }
   }
 
+// Print the options and exit.  Running with no arguments at all just asks for them, so
+// that exits with 0.
+void usage(char *programName, int status)
+{
+	printf ("Usage: %s [options] <imageName>\n", programName);
+	printf ("  -p<port>         port for the image's web socket\n");
+	printf ("  -d<port>         port for the debugger web socket\n");
+	printf ("  -m <megabytes>   soft heap limit, past which the heap is collected before it grows (default 1024)\n");
+	printf ("  -M <megabytes>   hard heap limit, which the heap never grows past\n");
+	printf ("Headless options, which run without any web socket and then exit:\n");
+	printf ("  -e <expression>  evaluate an expression and print its result\n");
+	printf ("  -f <file>        file in a Smalltalk source file\n");
+	printf ("  -b <class>       run a benchmark by sending #run to a class\n");
+	printf ("  -t <class>       run the tests of a Testcase class and its subclasses (all for every test)\n");
+	printf ("  -n <count>       timed runs of each -b and -e action (default 5 for benchmarks, otherwise 1)\n");
+	printf ("  -w <count>       untimed warmup runs of each -b and -e action (default 1 for benchmarks, otherwise 0)\n");
+	printf ("  -o <file>        write the JSON results to a file, replacing it, instead of standard output\n");
+	printf ("The exit status is 0 when every action succeeds, 1 when one fails and 2 when the image can't be run\n");
+	exit(status);
+}
+
+// Options take their value either in the same argument (-p5000) or the next one (-e '3 + 4').
+char *optionValue(int argc, char **argv, int *i)
+{
+	if (argv[*i][2] != '\0')
+		return &(argv[*i][2]);
+	if (*i + 1 >= argc)
+		usage(argv[0], 2);
+	return argv[++(*i)];
+}
+
 void processCommandLineArguments(int argc, char **argv)
 {
 	int i;
@@ -135,10 +182,202 @@ void processCommandLineArguments(int argc, char **argv)
             debugWebSocketPort = strtol(&(argv[i][2]), &endPtr, 10);
 		continue;
 		}
+		if ((argv[i][0] == '-') && (argv[i][1] != '\0') && (strchr("efbt", argv[i][1]) != NULL)) {
+			if (numberOfHeadlessActions == MAX_HEADLESS_ACTIONS) {
+				LOGE ("Too many headless actions");
+				exit(2);
+			}
+			headlessModes[numberOfHeadlessActions] = argv[i][1];
+			headlessTargets[numberOfHeadlessActions++] = optionValue(argc, argv, &i);
+		continue;
+		}
+		if ((argv[i][0] == '-') && (argv[i][1] == 'n')) {
+			headlessIterations = strtol(optionValue(argc, argv, &i), &endPtr, 10);
+			if (headlessIterations < 1)
+				usage(argv[0], 2);
+		continue;
+		}
+		if ((argv[i][0] == '-') && (argv[i][1] == 'w')) {
+			headlessWarmup = strtol(optionValue(argc, argv, &i), &endPtr, 10);
+			if (headlessWarmup < 0)
+				usage(argv[0], 2);
+		continue;
+		}
+		if ((argv[i][0] == '-') && ((argv[i][1] == 'm') || (argv[i][1] == 'M'))) {
+			uint64_t *limit = (argv[i][1] == 'm') ? &heapSoftLimit : &heapHardLimit;
+
+			*limit = strtoull(optionValue(argc, argv, &i), &endPtr, 10) << 20;
+			if ((*endPtr != '\0') || (*limit == 0))
+				usage(argv[0], 2);
+		continue;
+		}
+		if ((argv[i][0] == '-') && (argv[i][1] == 'o')) {
+			headlessOutputFilename = optionValue(argc, argv, &i);
+		continue;
+		}
+		if (argv[i][0] == '-')
+			usage(argv[0], 2);
 		imageFilename = argv[i];
 	}
+
+	if (imageFilename == NULL)
+		usage(argv[0], 2);
 }
 
+#ifndef __EMSCRIPTEN__
+// Append a string to a Smalltalk string literal, doubling its quotes.
+char *appendQuoted(char *destination, char *source)
+{
+	while (*source != '\0') {
+		if (*source == '\'')
+			*destination++ = '\'';
+		*destination++ = *source++;
+	}
+	return destination;
+}
+
+void writeJsonString(char *string)
+{
+	fputc ('"', headlessOutput);
+	for (; *string != '\0'; string++) {
+		if ((*string == '"') || (*string == '\\'))
+			fprintf (headlessOutput, "\\%c", *string);
+		else if ((unsigned char) *string < ' ')
+			fprintf (headlessOutput, "\\u%04x", (unsigned char) *string);
+		else
+			fputc (*string, headlessOutput);
+	}
+	fputc ('"', headlessOutput);
+}
+
+int compareTimes(const void *a, const void *b)
+{
+	int64_t first = *((int64_t *) a), second = *((int64_t *) b);
+
+	return (first > second) - (first < second);
+}
+
+// Write the expression each kind of action evaluates into expression.
+void headlessExpression(char mode, char *target, char *expression)
+{
+	switch (mode) {
+		case 'e':
+			strcpy (expression, target);
+			break;
+		case 'f':
+			strcpy (expression, "'");
+			*appendQuoted(&expression[1], target) = '\0';
+			strcat (expression, "' asFilename fileIn");
+			break;
+		case 'b':
+			sprintf (expression, "%s run", target);
+			break;
+		case 't':
+			sprintf (expression, "%s performHeadless", strcmp(target, "all") == 0 ? "Testcase" : target);
+			break;
+	}
+}
+
+// Run one action through BeagleSystem class>>runHeadless:repeat:, which answers an Array
+// with a success flag, the printString of the result or the error and the microseconds
+// each run took.  Answer FALSE if the action failed.
+int runHeadlessAction(char mode, char *target)
+{
+	char *modeName = mode == 'b' ? "benchmark" : mode == 'e' ? "evaluate" : mode == 'f' ? "fileIn" : "test";
+	int repeats = mode == 'b' || mode == 'e';
+	int warmup = repeats && headlessWarmup != -1 ? headlessWarmup : (mode == 'b' ? 1 : 0);
+	int iterations = repeats && headlessIterations != -1 ? headlessIterations : (mode == 'b' ? 5 : 1);
+	size_t size = 4 * strlen(target) + 200;
+	char *expression = malloc(size), *command = malloc(2 * size + 100), *end, *resultString;
+	oop baseContext = currentContext, result, times;
+	int64_t *microseconds;
+	int succeeded, i;
+
+	headlessExpression(mode, target, expression);
+	strcpy (command, "BeagleSystem runHeadless: '");
+	end = appendQuoted(&command[strlen(command)], expression);
+	sprintf (end, "' repeat: %d", warmup + iterations);
+	free (expression);
+
+	evaluate(command);
+	free (command);
+
+	fprintf (headlessOutput, "{\"mode\":\"%s\",\"target\":", modeName);
+	writeJsonString(target);
+
+	if (currentContext != baseContext) {
+		fprintf (headlessOutput, ",\"status\":\"error\",\"error\":");
+		writeJsonString(errorString[0] == '\0' ? "The interpreter stopped" : errorString);
+		fprintf (headlessOutput, "}\n");
+		fflush (headlessOutput);
+		dumpWalkback(errorString);
+		exit(1);
+	}
+
+	result = pop ();
+	if ((classOf(result) != ST_ARRAY_CLASS) || (indexedObjectSize(result) != 3)) {
+		fprintf (headlessOutput, ",\"status\":\"error\",\"error\":\"The image doesn't support headless runs\"}\n");
+		fflush (headlessOutput);
+		exit(2);
+	}
+
+	succeeded = indexedVarAtInt(result, 1) == ST_TRUE;
+	resultString = malloc(basicByteSize(indexedVarAtInt(result, 2)) + 1);
+	STStringToC(indexedVarAtInt(result, 2), resultString);
+	fprintf (headlessOutput, ",\"status\":\"%s\",\"%s\":", succeeded ? "ok" : "error", succeeded ? "result" : "error");
+	writeJsonString(resultString);
+	free (resultString);
+
+	times = indexedVarAtInt(result, 3);
+	if (succeeded && (indexedObjectSize(times) == (uint64_t) (warmup + iterations))) {
+		microseconds = malloc(iterations * sizeof(int64_t));
+		fprintf (headlessOutput, ",\"warmup\":%d,\"iterations\":%d,\"times_us\":[", warmup, iterations);
+		for (i=0; i<iterations; i++) {
+			microseconds[i] = stIntToC(indexedVarAtInt(times, warmup + i + 1));
+			fprintf (headlessOutput, "%s%" PRId64, i == 0 ? "" : ",", microseconds[i]);
+		}
+		qsort (microseconds, iterations, sizeof(int64_t), compareTimes);
+		fprintf (headlessOutput, "],\"min_us\":%" PRId64 ",\"median_us\":%" PRId64 ",\"max_us\":%" PRId64,
+			microseconds[0],
+			iterations % 2 ? microseconds[iterations / 2] : (microseconds[iterations / 2 - 1] + microseconds[iterations / 2]) / 2,
+			microseconds[iterations - 1]);
+		free (microseconds);
+	}
+	fprintf (headlessOutput, "}\n");
+	fflush (headlessOutput);
+
+	return succeeded;
+}
+
+int runHeadless(void)
+{
+	int i, failures = 0;
+
+	headless = TRUE;
+	headlessOutput = stdout;
+	if (headlessOutputFilename != NULL) {
+		headlessOutput = fopen(headlessOutputFilename, "w");
+		if (headlessOutput == NULL) {
+			LOGE ("Could not open %s", headlessOutputFilename);
+			return 2;
+		}
+	}
+
+	prepareImage();
+	evaluate("BeagleSystem initializeRuntime");
+	pop ();
+
+	for (i=0; i<numberOfHeadlessActions; i++)
+		if (!runHeadlessAction(headlessModes[i], headlessTargets[i]))
+			failures++;
+
+	if (headlessOutput != stdout)
+		fclose (headlessOutput);
+
+	return failures == 0 ? 0 : 1;
+}
+#endif
+
 int beagleMain(int argc, char **argv)
 {
 #ifndef __EMSCRIPTEN__
@@ -148,10 +387,8 @@ int beagleMain(int argc, char **argv)
 		logString[0] = '\0';
 		logPtr = logString;
 
-		if (argc == 1) {
-			printf ("Usage: %s <imageName>", argv[0]);
-			exit(0);
-		}
+		if (argc == 1)
+			usage(argv[0], 0);
 	processCommandLineArguments(argc, argv);
 
 #else
@@ -160,6 +397,14 @@ int beagleMain(int argc, char **argv)
 		loadImageFromFile(imageFilename);
 //		Development = 1;
 
+#ifndef __EMSCRIPTEN__
+		if (numberOfHeadlessActions > 0) {
+			int status = runHeadless();
+			UnhookHandler();
+			exit(status);
+		}
+#endif
+
 #ifndef __EMSCRIPTEN__
 		if (Development) {
 			setupRemoteSocket();
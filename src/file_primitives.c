@@ -174,6 +174,11 @@ void primNextColon(){
     FILE* file = (FILE *) osHandleValue (asFileStream(fileStreamOop)->handle);
 
 	oop result = newInstanceOfClass (ST_BYTE_ARRAY_CLASS, length, EdenSpace);
+	if (result == ST_NIL) {
+		push (cIntToST(1));
+		push (getReceiver());
+		return;
+	}
 
     char* buff = malloc(length*sizeof(char));
     check = fread(buff, sizeof(char), length,  file);
@@ -287,6 +292,11 @@ void primUpToEnd(){
 
     long int length = endPosition - position;
     oop result = newInstanceOfClass (ST_BYTE_ARRAY_CLASS, length, EdenSpace);
+    if (result == ST_NIL) {
+        push (cIntToST(1));
+        push (getReceiver());
+        return;
+    }
 
     char* buff = malloc(length*sizeof(char));
     check = fread(buff, sizeof(char), length,  file);
@@ -30,7 +30,31 @@
 #define PRIM_FLOAT_ARCCOS 59
 #define PRIM_FLOAT_EXP 65
 
-doubleConverter dc;
+// Convert a double to a Smalltalk float.  Doubles with an exponent that fits in
+// the immediate encoding (see object.h) are rotated, rebased and tagged.  Anything
+// else is boxed.
+
+oop cFloatToST(double value)
+{
+	uint64_t bits = doubleToBits(value);
+	uint64_t rotated = (bits << 1) | (bits >> 63);
+
+	if (rotated <= 1)
+		return (oop) ((rotated << IMMEDIATE_SHIFT) | FLOAT_TAG);
+
+	uint64_t rebased = rotated - SMALL_FLOAT_EXPONENT_OFFSET;
+	if ((rebased - 2) < ((1ull << 61) - 2))
+		return (oop) ((rebased << IMMEDIATE_SHIFT) | FLOAT_TAG);
+
+	return allocateBoxedFloat(value);
+}
+
+oop allocateBoxedFloat(double value)
+{
+	oop result = newInstanceOfClass (hasBoxedFloatClass() ? ST_BOXED_FLOAT_CLASS : ST_FLOAT_CLASS, sizeof(double), EdenSpace);
+	boxedFloatToC(result) = value;
+	return result;
+}
 
 void primFloatPlus()
 {
@@ -40,7 +64,7 @@ void primFloatPlus()
 
 	if (!isFloat(arg1)) {
 		push (cIntToST(1));
-		push (asOop(receiver));
+		push (getReceiver());
 		return;
 	}
 
@@ -56,7 +80,7 @@ void primFloatLessThan()
 
 	if (!isFloat(arg1)) {
 		push (cIntToST(1));
-		push (asOop(receiver));
+		push (getReceiver());
 		return;
 	}
 
@@ -74,7 +98,7 @@ void primFloatGreaterThan()
 
 	if (!isFloat(arg1)) {
 		push (cIntToST(1));
-		push (asOop(receiver));
+		push (getReceiver());
 		return;
 	}
 
@@ -92,7 +116,7 @@ void primFloatEquals()
 
 	if (!isFloat(arg1)) {
 		push (cIntToST(1));
-		push (asOop(receiver));
+		push (getReceiver());
 		return;
 	}
 
@@ -110,7 +134,7 @@ void primFloatMinus()
 
 	if (!isFloat(arg1)) {
 		push (cIntToST(1));
-		push (asOop(receiver));
+		push (getReceiver());
 		return;
 	}
 
@@ -239,21 +263,21 @@ void primFloatExp()
 
 void initializeFloatPrimitives()
 {
-	primitiveTable[PRIM_FLOAT_PLUS] = primFloatPlus;
-	primitiveTable[PRIM_FLOAT_MINUS] = primFloatMinus;
-	primitiveTable[PRIM_FLOAT_TIMES] = primFloatTimes;
-	primitiveTable[PRIM_FLOAT_DIVIDE] = primFloatDivide;
-	primitiveTable[PRIM_FLOAT_LESS_THAN] = primFloatLessThan;
-	primitiveTable[PRIM_FLOAT_GREATER_THAN] = primFloatGreaterThan;
-	primitiveTable[PRIM_FLOAT_EQUALS] = primFloatEquals;
-	primitiveTable[PRIM_FLOAT_TRUNCATED] = primFloatTruncated;
-	primitiveTable[PRIM_FLOAT_SQRT] = primFloatSqrt;
-	primitiveTable[PRIM_FLOAT_SIN] = primFloatSin;
-	primitiveTable[PRIM_FLOAT_COS] = primFloatCos;
-	primitiveTable[PRIM_FLOAT_TAN] = primFloatTan;
-    primitiveTable[PRIM_FLOAT_ATAN2] = primFloatATan2;
-    primitiveTable[PRIM_FLOAT_LOG] = primFloatLog;
-    primitiveTable[PRIM_FLOAT_ARCSIN] = primFloatArcsin;
-    primitiveTable[PRIM_FLOAT_ARCCOS] = primFloatArccos;
-    primitiveTable[PRIM_FLOAT_EXP] = primFloatExp;
+	FRAMELESS_PRIMITIVE(PRIM_FLOAT_PLUS, primFloatPlus);
+	FRAMELESS_PRIMITIVE(PRIM_FLOAT_MINUS, primFloatMinus);
+	FRAMELESS_PRIMITIVE(PRIM_FLOAT_TIMES, primFloatTimes);
+	FRAMELESS_PRIMITIVE(PRIM_FLOAT_DIVIDE, primFloatDivide);
+	FRAMELESS_PRIMITIVE(PRIM_FLOAT_LESS_THAN, primFloatLessThan);
+	FRAMELESS_PRIMITIVE(PRIM_FLOAT_GREATER_THAN, primFloatGreaterThan);
+	FRAMELESS_PRIMITIVE(PRIM_FLOAT_EQUALS, primFloatEquals);
+	FRAMELESS_PRIMITIVE(PRIM_FLOAT_TRUNCATED, primFloatTruncated);
+	FRAMELESS_PRIMITIVE(PRIM_FLOAT_SQRT, primFloatSqrt);
+	FRAMELESS_PRIMITIVE(PRIM_FLOAT_SIN, primFloatSin);
+	FRAMELESS_PRIMITIVE(PRIM_FLOAT_COS, primFloatCos);
+	FRAMELESS_PRIMITIVE(PRIM_FLOAT_TAN, primFloatTan);
+    FRAMELESS_PRIMITIVE(PRIM_FLOAT_ATAN2, primFloatATan2);
+    FRAMELESS_PRIMITIVE(PRIM_FLOAT_LOG, primFloatLog);
+    FRAMELESS_PRIMITIVE(PRIM_FLOAT_ARCSIN, primFloatArcsin);
+    FRAMELESS_PRIMITIVE(PRIM_FLOAT_ARCCOS, primFloatArccos);
+    FRAMELESS_PRIMITIVE(PRIM_FLOAT_EXP, primFloatExp);
 }
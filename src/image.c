@@ -12,6 +12,25 @@
 
 unsigned long Development = 1;
 char ImageName[256];
+int convertImageFloats = 0;
+
+#define IMAGE_VERSION 0x0101
+#define FIRST_ROTATED_FLOAT_IMAGE_VERSION 0x0101
+
+// Images before version 0x0101 stored immediate floats as sign, 8 bit exponent,
+// mantissa and tag.  The current format (see object.h) holds the same values with
+// the sign moved below the mantissa, so the bits can be rearranged in place.
+
+oop convertImageFloat(oop x)
+{
+	if (!convertImageFloats || !isSmallFloat(x))
+		return x;
+
+	uint64_t sign = ((uint64_t) x) >> 63;
+	uint64_t exponentAndMantissa = (((uint64_t) x) & 0x7FFFFFFFFFFFFFF8ull) >> IMMEDIATE_SHIFT;
+
+	return (oop) ((((exponentAndMantissa << 1) | sign) << IMMEDIATE_SHIFT) | FLOAT_TAG);
+}
 
 void relocateObject (oop object, __attribute__((unused)) void *args)
 {
@@ -28,7 +47,7 @@ void relocateObject (oop object, __attribute__((unused)) void *args)
 	uint64_t i;
 
 	for (i=0; i<totalObjectSize(object); i++) {
-		oop relocatedObject = stPtrToC(instVarAtInt(object, i));
+		oop relocatedObject = convertImageFloat(stPtrToC(instVarAtInt(object, i)));
 		instVarAtIntPut(object, i, relocatedObject);
 	}
 }
@@ -43,6 +62,8 @@ void relocatePointer (oop *oopPointer, __attribute__((unused)) void *args)
 	if (*oopPointer != asOop(NULL)) {
         if (!isImmediate(*oopPointer))
 		    *oopPointer = stPtrToC(*oopPointer);
+        else
+            *oopPointer = convertImageFloat(*oopPointer);
 	}
 }
 
@@ -55,12 +76,36 @@ void relocateStackSpace (__attribute__((unused)) memorySpaceStruct *space)
 {
 }
 
-uint64_t readSpace(memorySpaceStruct **allocatedSpacePtr, readFunctionType *readFunction, void *data)
+// Read a space into memory, at heapOffset in the heap unless that's NOT_IN_HEAP.  Answer
+// its size, or SPACE_DOES_NOT_FIT if it's bigger than its slot of the heap.  That happens
+// when an image saved by the native VM, whose slots are much larger, is loaded by the
+// Emscripten build.
+
+#define SPACE_DOES_NOT_FIT (~0ull)
+
+uint64_t readSpace(memorySpaceStruct **allocatedSpacePtr, readFunctionType *readFunction, void *data, uint64_t heapOffset)
 {
 	memorySpaceStruct memorySpace, *allocatedSpace;
 	readFunction((unsigned char *) &memorySpace, sizeof(memorySpace), data);
 
-	allocatedSpace = allocateSpace (memorySpace.spaceSize);
+	// Extra old space segments go in the next free old space slot, anything else outside the heap
+	if (heapOffset == NEXT_OLD_SEGMENT)
+		heapOffset = (memorySpace.spaceType == OLD_SPACE && memorySpace.spaceSize > 0) ? oldSpaceSlotOffset() : NOT_IN_HEAP;
+
+	if ((heapOffset != NOT_IN_HEAP) && (sizeof(memorySpaceStruct) + memorySpace.spaceSize > heapSlotSize(heapOffset))) {
+		LOGE ("Space %d of the image is %" PRIu64 " bytes, but this VM's heap only has room for %" PRIu64 " bytes in its slot",
+			memorySpace.spaceNumber, memorySpace.spaceSize, heapSlotSize(heapOffset) - sizeof(memorySpaceStruct));
+		return SPACE_DOES_NOT_FIT;
+	}
+
+	if (heapOffset == NOT_IN_HEAP)
+		allocatedSpace = allocateSpace (memorySpace.spaceSize);
+	else
+		allocatedSpace = allocateSpaceInHeap (heapOffset, memorySpace.spaceSize);
+	if (allocatedSpace == NULL) {
+		LOGE ("Cannot allocate a space of %" PRIu64 " bytes", memorySpace.spaceSize);
+		ERROR_EXIT;
+	}
 	*allocatedSpacePtr = allocatedSpace;
 	allocatedSpace->lastFreeBlock = memorySpace.lastFreeBlock;
     allocatedSpace->firstFreeBlock = memorySpace.firstFreeBlock;
@@ -116,11 +161,15 @@ uint64_t loadImage(readFunctionType *readFunction, void *data, char *filename)
 	}
 
 	Development = header.development;
+	convertImageFloats = (header.version < FIRST_ROTATED_FLOAT_IMAGE_VERSION);
 
-	readSpace (&Spaces[0], readFunction, data);
+	reserveHeap();
+	if (readSpace (&Spaces[0], readFunction, data, EDEN_OFFSET) == SPACE_DOES_NOT_FIT)
+		return 3;
 	EdenSpace = Spaces[0];
 
-	readSpace (&Spaces[1], readFunction, data);
+	if (readSpace (&Spaces[1], readFunction, data, SURVIVOR_SPACE_1_OFFSET) == SPACE_DOES_NOT_FIT)
+		return 3;
 	SurvivorSpace1 = Spaces[1];
 	if (isCurrentSpace(SurvivorSpace1)) {
 		ActiveSurvivorSpace = SurvivorSpace1;
@@ -128,7 +177,8 @@ uint64_t loadImage(readFunctionType *readFunction, void *data, char *filename)
 		InactiveSurvivorSpace = SurvivorSpace1;
 	}
 
-	readSpace (&Spaces[2], readFunction, data);
+	if (readSpace (&Spaces[2], readFunction, data, SURVIVOR_SPACE_2_OFFSET) == SPACE_DOES_NOT_FIT)
+		return 3;
 	SurvivorSpace2 = Spaces[2];
 
 	if (isCurrentSpace(SurvivorSpace2)) {
@@ -137,29 +187,35 @@ uint64_t loadImage(readFunctionType *readFunction, void *data, char *filename)
 		InactiveSurvivorSpace = SurvivorSpace2;
 	}
 
-	readSpace (&Spaces[3], readFunction, data);
+	readSpace (&Spaces[3], readFunction, data, NOT_IN_HEAP);
 	RememberedSet = Spaces[3];
 
-	readSpace (&Spaces[4], readFunction, data);
+	readSpace (&Spaces[4], readFunction, data, NOT_IN_HEAP);
 	WellKnownObjects = Spaces[4];	
 
-	readSpace (&Spaces[5], readFunction, data);
+	readSpace (&Spaces[5], readFunction, data, NOT_IN_HEAP);
 	
-	readSpace (&Spaces[6], readFunction, data);
+	if (readSpace (&Spaces[6], readFunction, data, STACK_PAGES_OFFSET) == SPACE_DOES_NOT_FIT)
+		return 3;
 	StackSpace = Spaces[6];
 	
-	readSpace (&Spaces[7], readFunction, data);
+	if (readSpace (&Spaces[7], readFunction, data, OLD_SPACE_OFFSET) == SPACE_DOES_NOT_FIT)
+		return 3;
 	OldSpace = Spaces[7];
 	
 	{
-		uint64_t extraSpaceNumber = 8;
+		uint64_t extraSpaceNumber = 8, size;
 
-		while ((readSpace (&Spaces[extraSpaceNumber], readFunction, data)) > 0)
-		{}
+		while ((size = readSpace (&Spaces[extraSpaceNumber], readFunction, data, NEXT_OLD_SEGMENT)) > 0) {
+			if (size == SPACE_DOES_NOT_FIT)
+				return 3;
+			extraSpaceNumber++;
+		}
 	}
 
 	enumerateSpaces(relocateSpace, &spaceNumber);
-	currentStackSpace = StackSpace;
+	currentStackSpace = stackPages[0] = StackSpace;
+	currentStackPage = 0;
 
 	char sourcesFileName[256];
 	char changesFileName[256];
@@ -174,7 +230,10 @@ uint64_t loadImage(readFunctionType *readFunction, void *data, char *filename)
 
 	currentContext = ST_NIL;
 
-	registerRememberedSetObject(ST_SYSTEM_CLASS);
+	// Every card starts out marked, which also covers the stores into the system class below
+	findOldSegments();
+	markAllCards();
+	initializeHeapSizing();
 	asSystemClass(ST_SYSTEM_CLASS)->imageName = CStringToST(filename);
 	asSystemClass(ST_SYSTEM_CLASS)->sourceFileNames = newInstanceOfClass(ST_ARRAY_CLASS, 16, EdenSpace);
 	instVarAtIntPut (asSystemClass(ST_SYSTEM_CLASS)->sourceFileNames, 0, CStringToST(sourcesFileName));	
@@ -183,12 +242,21 @@ uint64_t loadImage(readFunctionType *readFunction, void *data, char *filename)
 	return 0;
 }
 
-void launchImage(void)
+// Get a loaded image ready to run code without sending it the start selector.
+void prepareImage(void)
 {
 	initializePrimitiveTable();
+#ifdef JIT
+	initializeJit();
+#endif
 
 	StackSpace->lastFreeBlock = (StackSpace->spaceSize / sizeof(oop)) - 1;
 	setupInterpreter(StackSpace);
+}
+
+void launchImage(void)
+{
+	prepareImage();
 	if (/* ST_START_CONTEXT != asOop(NULL) */ 0) {
 		currentContext = ST_START_CONTEXT;
 	}
@@ -367,8 +435,10 @@ void writeSpaceToFileStream(memorySpaceStruct *space, void *args)
 
 void saveImage(FILE *file)
 {
+	unquickenAll();
+
     write32 (0x4d495453, file);
-	write16 (0x0100, file);
+	write16 (IMAGE_VERSION, file);
 	write16 (Development, file);
 	write64 (imageSize(), file);
 
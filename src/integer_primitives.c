@@ -281,7 +281,13 @@ void primSmallIntegerIntDivide()
         return;
 	}
   
-    result = cIntToST(stIntToC(receiver) / stIntToC(arg));
+	// SmallInteger minVal quo: -1 is the only quotient that doesn't fit
+	int64_t intResult = stIntToC(receiver) / stIntToC(arg);
+	int64_t carry = intResult & (int64_t)0xF000000000000000L;
+	if ((carry == 0) || (carry == (int64_t)0xF000000000000000L))
+		result = cIntToST(intResult);
+	else
+		result = asSumLargeInteger(intResult);
 
 	push (cIntToST(0));
 	push (result);
@@ -300,18 +306,6 @@ void primSmallIntegerAsFloat()
 	push (oopResult);
 }
 
-void primBitShift()
-{
-	int64_t receiver = stIntToC(getReceiver());
-	int64_t shift = stIntToC(getLocal( 0));
-
-	push (cIntToST(0));
-	if (shift > 0)
-		push (cIntToST(receiver << shift));
-	else
-		push (cIntToST(receiver >> (0 - shift)));
-}
-
 uint64_t largeComponentAt(oop x, uint64_t index)
 {
 	oop largeIntegerArray = asLargeInteger(x)->bytes;
@@ -573,6 +567,63 @@ void primAsLargeInteger()
 	push (result);
 }
 
+// Shift a SmallInteger value left (or right for a negative shift).  A left shift
+// that no longer fits in a SmallInteger answers a LargeInteger.  Shifts are limited
+// to MAX_BIT_SHIFT by the callers.
+
+oop smallIntegerBitShift(int64_t x, int64_t shift)
+{
+	uint64_t magnitude;
+	uint32_t words, bits;
+	oop result, array;
+
+	if (x == 0)
+		return cIntToST(0);
+
+	if (shift <= 0) {
+		if (shift <= -63)
+			return cIntToST((x < 0) ? -1 : 0);
+		return cIntToST(x >> (0 - shift));
+	}
+
+	// -1 bitShift: 60 is SmallInteger minVal, so a shift of 60 can still fit
+	if (shift <= 60) {
+		int64_t shifted = (int64_t) ((uint64_t) x << shift);
+		int64_t carry = shifted & (int64_t)0xF000000000000000L;
+		if (((shifted >> shift) == x) && ((carry == 0) || (carry == (int64_t)0xF000000000000000L)))
+			return cIntToST(shifted);
+	}
+
+	magnitude = (x < 0) ? (uint64_t) (0 - x) : (uint64_t) x;
+	words = (uint32_t) (shift / 64);
+	bits = (uint32_t) (shift % 64);
+
+	result = allocateLargeInteger(words + 2, (x < 0) ? -1 : 1);
+	array = asLargeInteger(result)->bytes;
+	basicInstVarAtIntPut(array, words, magnitude << bits);
+	if (bits != 0)
+		basicInstVarAtIntPut(array, words + 1, magnitude >> (64 - bits));
+	asLargeInteger(result)->componentSize = cIntToST(computeLargeComponentSize(result));
+
+	return largeIntegerReduce(result);
+}
+
+void primBitShift()
+{
+	oop receiver = getReceiver();
+	oop arg = getLocal(0);
+
+	if (!isSmallInteger(arg) || (stIntToC(arg) > MAX_BIT_SHIFT)) {
+		push (cIntToST(1));
+		push (receiver);
+		return;
+	}
+
+	oop result = smallIntegerBitShift(stIntToC(receiver), stIntToC(arg));
+	push (cIntToST(0));
+	push (result);
+}
+
 oop basicLargeIntegerPlus (oop x, oop y, int sign)
 {
 	uint64_t xComponentSize = largeComponentSize(x);
@@ -1451,41 +1502,41 @@ void primBitInvert(){
 
 void initializeIntegerPrimitives()
 {
-	primitiveTable[PRIM_SMALLINTEGER_PLUS] = primSmallIntegerPlus;
-	primitiveTable[PRIM_SMALLINTEGER_MINUS] = primSmallIntegerMinus;
-	primitiveTable[PRIM_SMALLINTEGER_LESS_THAN] = primSmallIntegerLessThan;
-	primitiveTable[PRIM_SMALLINTEGER_GREATER_THAN] = primSmallIntegerGreaterThan;
-	primitiveTable[PRIM_SMALLINTEGER_LESS_THAN_OR_EQUAL] = primSmallIntegerLessThanOrEqual;
-	primitiveTable[PRIM_SMALLINTEGER_GREATER_THAN_OR_EQUAL] = primSmallIntegerGreaterThanOrEqual;
-	primitiveTable[PRIM_SMALLINTEGER_EQUAL] = primSmallIntegerEqual;
-	primitiveTable[PRIM_SMALLINTEGER_NOT_EQUAL] = primSmallIntegerNotEqual;
-	primitiveTable[PRIM_SMALLINTEGER_TIMES] = primSmallIntegerTimes;
-	primitiveTable[PRIM_SMALLINTEGER_DIVIDE] = primSmallIntegerDivide;
-	primitiveTable[PRIM_SMALLINTEGER_MODULO] = primSmallIntegerModulo;
-	primitiveTable[PRIM_SMALLINTEGER_INT_DIVIDE] = primSmallIntegerIntDivide;
-	primitiveTable[PRIM_SMALLINTEGER_AS_FLOAT] = primSmallIntegerAsFloat;
-	primitiveTable[PRIM_BITSHIFT] = primBitShift;
-
-	primitiveTable[PRIM_AS_LARGEINTEGER] = primAsLargeInteger;
-	primitiveTable[PRIM_LARGEINTEGER_PLUS] = primLargeIntegerPlus;
-	primitiveTable[PRIM_LARGEINTEGER_MINUS] = primLargeIntegerMinus;
-	primitiveTable[PRIM_LARGEINTEGER_LESS_THAN] = primLargeIntegerLessThan;
-	primitiveTable[PRIM_LARGEINTEGER_GREATER_THAN] = primLargeIntegerGreaterThan;
-	primitiveTable[PRIM_LARGEINTEGER_LESS_THAN_OR_EQUAL] = primLargeIntegerLessThanOrEqual;
-	primitiveTable[PRIM_LARGEINTEGER_GREATER_THAN_OR_EQUAL] = primLargeIntegerGreaterThanOrEqual;
-	primitiveTable[PRIM_LARGEINTEGER_EQUAL] = primLargeIntegerEqual;
-	primitiveTable[PRIM_LARGEINTEGER_NOT_EQUAL] = primLargeIntegerNotEqual;
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_PLUS, primSmallIntegerPlus);
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_MINUS, primSmallIntegerMinus);
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_LESS_THAN, primSmallIntegerLessThan);
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_GREATER_THAN, primSmallIntegerGreaterThan);
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_LESS_THAN_OR_EQUAL, primSmallIntegerLessThanOrEqual);
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_GREATER_THAN_OR_EQUAL, primSmallIntegerGreaterThanOrEqual);
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_EQUAL, primSmallIntegerEqual);
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_NOT_EQUAL, primSmallIntegerNotEqual);
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_TIMES, primSmallIntegerTimes);
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_DIVIDE, primSmallIntegerDivide);
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_MODULO, primSmallIntegerModulo);
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_INT_DIVIDE, primSmallIntegerIntDivide);
+	FRAMELESS_PRIMITIVE(PRIM_SMALLINTEGER_AS_FLOAT, primSmallIntegerAsFloat);
+	FRAMELESS_PRIMITIVE(PRIM_BITSHIFT, primBitShift);
+
+	FRAMELESS_PRIMITIVE(PRIM_AS_LARGEINTEGER, primAsLargeInteger);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_PLUS, primLargeIntegerPlus);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_MINUS, primLargeIntegerMinus);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_LESS_THAN, primLargeIntegerLessThan);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_GREATER_THAN, primLargeIntegerGreaterThan);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_LESS_THAN_OR_EQUAL, primLargeIntegerLessThanOrEqual);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_GREATER_THAN_OR_EQUAL, primLargeIntegerGreaterThanOrEqual);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_EQUAL, primLargeIntegerEqual);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_NOT_EQUAL, primLargeIntegerNotEqual);
 //	primitiveTable[PRIM_LARGEINTEGER_TIMES] = primLargeIntegerTimesFast;
-	primitiveTable[PRIM_LARGEINTEGER_TIMES] = primLargeIntegerTimes;
-	primitiveTable[PRIM_LARGEINTEGER_DIVIDE] = primLargeIntegerDivide;
-	primitiveTable[PRIM_LARGEINTEGER_MODULO] = primLargeIntegerModulo;
-	primitiveTable[PRIM_LARGEINTEGER_INT_DIVIDE] = primLargeIntegerIntDivide;
-	primitiveTable[PRIM_LARGEINTEGER_DIVIDE_WITH_REMAINDER] = primLargeIntegerDivideWithRemainder;
-	primitiveTable[PRIM_LARGEINTEGER_TIMES_FAST] = primLargeIntegerTimesFast;
-	primitiveTable[PRIM_LARGEINTEGER_AS_FLOAT] = primLargeIntegerAsFloat;
-
-	primitiveTable[PRIM_BIT_AND] = primBitAnd;
-	primitiveTable[PRIM_BIT_OR] = primBitOr;
-	primitiveTable[PRIM_BIT_XOR] = primBitXor;
-	primitiveTable[PRIM_BIT_INVERT] = primBitInvert;
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_TIMES, primLargeIntegerTimes);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_DIVIDE, primLargeIntegerDivide);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_MODULO, primLargeIntegerModulo);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_INT_DIVIDE, primLargeIntegerIntDivide);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_DIVIDE_WITH_REMAINDER, primLargeIntegerDivideWithRemainder);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_TIMES_FAST, primLargeIntegerTimesFast);
+	FRAMELESS_PRIMITIVE(PRIM_LARGEINTEGER_AS_FLOAT, primLargeIntegerAsFloat);
+
+	FRAMELESS_PRIMITIVE(PRIM_BIT_AND, primBitAnd);
+	FRAMELESS_PRIMITIVE(PRIM_BIT_OR, primBitOr);
+	FRAMELESS_PRIMITIVE(PRIM_BIT_XOR, primBitXor);
+	FRAMELESS_PRIMITIVE(PRIM_BIT_INVERT, primBitInvert);
 }
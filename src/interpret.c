@@ -31,6 +31,12 @@ int tracing = 0;
 // to the bytecodes and the stack.  We create a fastContext when we start a method
 // and use it to access bytecodes and the stack.  When we advance bytecodes and push or
 // pop the stack, we also update the currentContext.
+//
+// The frames are laid out like a CodeContext body in the stack pages but have no
+// object header, and only the stack offset is kept current as values are pushed and
+// popped.  A CodeContext object is made from them by contextCopy when Smalltalk
+// needs one (thisContext and the debugger).  The collector and the auditor reach
+// their slots through enumerateStackFrames.
 oop currentContext, stopFrame;
 fastContextStruct fastContext;
 memorySpaceStruct *currentStackSpace;
@@ -42,10 +48,12 @@ int breakpointHit = 0;
 
 int suspended = FALSE;
 char errorString[1024];
-int eventWaitingFlag = FALSE;
+volatile uint32_t interruptPending = 0;
 
 uint64_t stackThreshold = WARN_STACK_THRESHOLD;
 
+// Called at a safepoint when INTERRUPT_EVENT has been requested, if the host has
+// something to poll.
 int (*pollForEvents)(void);
 #define DUMP_SIZE 8192
 char walkbackDump[DUMP_SIZE];
@@ -71,7 +79,7 @@ void logMethodSignature()
 	uint32_t i;
 	char className[256];
 	char selectorString[256];
-	oop methodOop = asContext(currentContext)->method;
+	oop methodOop = asFrame(currentContext)->method;
 
 	if (isImmediate(methodOop))
 		LOGI("Immediate??");
@@ -92,7 +100,7 @@ void logMethodSignature()
 	STStringToC(key, selectorString);
 	classNameOf(mclassOop, className);
 
-	int offset = stIntToC(asContext(currentContext)->pcOffset);
+	int offset = stIntToC(asFrame(currentContext)->pcOffset);
 	LOGI("%s >> %s (%x)", className, selectorString, offset);
 }
 
@@ -195,7 +203,7 @@ void dumpWalkback(char *message)
 		return;
 	}
 
-	for (frame = currentContext; asContext(frame)->method != ST_NIL; frame = asContext(frame)->frame)
+	for (frame = currentContext; asFrame(frame)->method != ST_NIL; frame = asFrame(frame)->frame)
 	{
 		int j;
 		char receiverClassName[256];
@@ -213,10 +221,10 @@ void dumpWalkback(char *message)
 			STStringToC(asClass(receiverClassOop)->name, receiverClassName);
 		}
 
-		oop methodOop = asContext(frame)->method;
+		oop methodOop = asFrame(frame)->method;
 
 		if (classOf(methodOop) == ST_COMPILED_BLOCK_CLASS) {
-			int offset = stIntToC(asContext(frame)->pcOffset);
+			int offset = stIntToC(asFrame(frame)->pcOffset);
 			WALKBACK("\t%s (%x)", "Block", offset);
 			walkbackIndex += snprintf(&walkbackDump[walkbackIndex], DUMP_SIZE - walkbackIndex, "\t%s (%x)\r", "Block", offset);
 			lines++;
@@ -232,7 +240,7 @@ void dumpWalkback(char *message)
 				STStringToC(asClass(mclassOop)->name, className);
 			}
 
-			int offset = stIntToC(asContext(frame)->pcOffset);
+			int offset = stIntToC(asFrame(frame)->pcOffset);
 
 			oop identityDictionaryOop = asBehavior(mclassOop)->methodDictionary;
 			oop selectorOop = identityDictionaryKeyAtValue (identityDictionaryOop, methodOop);
@@ -263,14 +271,18 @@ void dumpWalkback(char *message)
 
 void captureFastContext(oop context)
 {
-	contextStruct *contextBody = asContext(context);
+	contextStruct *contextBody = asFrame(context);
 
-	fastContext.stackSpaceFirstFreeBlock = &currentStackSpace->firstFreeBlock;
 	fastContext.currentContextBody = contextBody;
 	fastContext.stackPointer = oopPtr(&contextBody->stackBody[stIntToC(contextBody->stackOffset)]);
 	fastContext.stackOffsetPointer = (oop *) &contextBody->stackOffset;
 	if (contextBody->frame != ST_NIL)
-		fastContext.localsPointer = oopPtr(&asContext(contextBody->frame)->stackBody[stIntToC(asContext(contextBody->frame)->stackOffset)]);
+		fastContext.localsPointer = oopPtr(&asFrame(contextBody->frame)->stackBody[stIntToC(asFrame(contextBody->frame)->stackOffset)]);
+
+	// A scavenge during a frameless primitive must leave the primitive's receiver
+	// and arguments in place.
+	if (framelessLocalsPointer != NULL)
+		fastContext.localsPointer = framelessLocalsPointer;
 	
 	if (contextBody->method != ST_NIL) {
 		fastContext.currentPCPointer = &((uint8_t *)asObjectHeader(getBytecodes(contextBody->method))->bodyPointer)[stIntToC(contextBody->pcOffset)];
@@ -278,22 +290,80 @@ void captureFastContext(oop context)
 	}
 }
 
+// Allocate a frame for an activation of method on top of the stack space.  A frame
+// is only the contextStruct fields followed by its stack, so this just bumps the
+// stack space's firstFreeBlock past the stack the caller has pushed so far.  Smalltalk
+// only ever sees copies made by contextCopy, so a frame needs no header, class or
+// identity hash.  When the current stack page is nearly full the frame starts the
+// next page.  Its receiver and arguments stay where the caller pushed them at the
+// end of the old page, which is still reached through the localsPointer.
+
+oop newStackFrame(oop method, oop methodContext)
+{
+	contextStruct *frame;
+
+	currentStackSpace->firstFreeBlock = (uint64_t) (fastContext.stackPointer - oopPtr(&currentStackSpace->space[0]));
+	if (currentStackSpace->firstFreeBlock + stackThreshold / sizeof(oop) >= currentStackSpace->lastFreeBlock)
+		currentStackSpace = pushStackPage();
+	frame = (contextStruct *) &currentStackSpace->space[currentStackSpace->firstFreeBlock];
+	currentStackSpace->firstFreeBlock += sizeof(contextStruct) / sizeof(oop);
+
+	frame->frame = currentContext;
+	frame->stackOffset = cIntToST(0);
+	frame->pcOffset = cIntToST(0);
+	frame->method = method;
+	frame->methodContext = methodContext;
+	frame->contextId = markAsContextPointer(frame);
+
+	return asOop(frame);
+}
+
+// Answer the end of a frame's slots.  A frame's slots run up to the frame it called,
+// and the current frame's (calledFrame is nil) up to its stack offset.  A frame
+// whose callee started a new page runs up to its own page's firstFreeBlock, which was
+// left there when the page was full.
+
+oop *frameSlotsEnd(oop frame, oop calledFrame)
+{
+	memorySpaceStruct *page;
+
+	if (calledFrame == ST_NIL)
+		return &asFrame(frame)->stackBody[stIntToC(asFrame(frame)->stackOffset)];
+
+	page = stackPageContaining(frame);
+	if (isPointerInStackPage(calledFrame, page))
+		return oopPtr(calledFrame);
+
+	return &page->space[page->firstFreeBlock];
+}
+
+// Call function with each frame from context down and the slots in it that can hold
+// objects, from its method to the end of its stack.  The frame slot points into the
+// stack pages and is left out.  contextId and a methodContext that isn't nil are
+// tagged as context pointers, which the collector passes over as immediates.
+
+void enumerateStackFrames(oop context, frameEnumerationFunction function, void *args)
+{
+	oop frame, calledFrame = ST_NIL;
+	oop *slots;
+
+	for (frame = context; frame != ST_NIL; calledFrame = frame, frame = asFrame(frame)->frame) {
+		slots = &asFrame(frame)->method;
+		function(frame, slots, (uint64_t) (frameSlotsEnd(frame, calledFrame) - slots), args);
+	}
+}
+
 void setupInterpreter(memorySpaceStruct *space)
 {
-	currentContext = newInstanceOfClass(ST_CODE_CONTEXT_CLASS, 0, currentStackSpace);
-	contextStruct *newContext = asContext(currentContext);
+	currentContext = ST_NIL;
+	fastContext.stackPointer = oopPtr(&currentStackSpace->space[currentStackSpace->firstFreeBlock]);
+	currentContext = newStackFrame(ST_NIL, ST_NIL);
 
 	stopFrame = ST_NIL;
-
-	newContext->frame = ST_NIL; // frame
-	newContext->stackOffset = cIntToST(0); // stack offset
-	newContext->pcOffset = cIntToST(0);  // pc
-	newContext->method = ST_NIL;  // method
-	newContext->methodContext = ST_NIL;  // method context
-	newContext->contextId = markAsContextPointer(currentContext);
 	errorString[0] = '\0';
 
 	captureFastContext(currentContext);
+	picClearAll();
 	scavenge();
 	auditImage();
 }
@@ -303,83 +373,100 @@ oop findCompiledMethod (oop selector, oop class)
 	return identityDictionaryAt (asBehavior(class)->methodDictionary, selector);
 }
 
-int checkForOutOfStack()
-{
-	if (asOop(fastContext.stackPointer) + stackThreshold > (((uint64_t) StackSpace) + StackSpace->spaceSize)) {
-		dumpWalkback("Out of stack space");
-		LOGE("Out of stack space");
-		exit(1);
-	}
-
-	return(0);
-}
-
 void invoke(oop method, uint64_t numArgs)
 {
 
 	int i;
-	oop previousFrameStackOffset = cIntToST(stIntToC(asContext(currentContext)->stackOffset) -1 - numArgs);
+	oop previousFrameStackOffset = cIntToST(stIntToC(asFrame(currentContext)->stackOffset) -1 - numArgs);
 	oop newContextOop;
 
-	if (checkForOutOfStack())
-		return;
-
 //	currentStackSpace->lastFreeBlock -= sizeof(objectHeaderStruct) / sizeof(oop);
 //	header = asOop(&currentStackSpace->space[space->lastFreeBlock]);
 
 //	newContext.stack = context->stack;
 //	context->stack = asOop(&oopPtr(context->stack)[-1 - numArgs]);
 
+	if (!isQuickened(getBytecodes(method)))
+		quickenBytecodes(getBytecodes(method));
+	countHotMethod(method, FALSE);
+#ifdef JIT
+	jitCountActivation(getBytecodes(method));
+#endif
+
 	for (i=0; i < stIntToC (asCompiledMethod(method)->numberOfTemporaries); i++)
 		push (ST_NIL);
 
-	newContextOop = newInstanceOfClass(ST_CODE_CONTEXT_CLASS, 0, currentStackSpace);
-	contextStruct *newContextStruct = asContext(newContextOop);
-
-	newContextStruct->frame = currentContext;  // frame
-	newContextStruct->stackOffset = cIntToST(0);  // stack
-	newContextStruct->pcOffset = cIntToST(0);  // pcOffset
-	newContextStruct->method = method; // method
-	newContextStruct->methodContext = ST_NIL; // method context
-	newContextStruct->contextId = markAsContextPointer(newContextOop);
+	newContextOop = newStackFrame(method, ST_NIL);
 
 	currentContext = newContextOop;
 	previousFrame(currentContext)->stackOffset = previousFrameStackOffset;
 	captureFastContext(currentContext);
 }
 
+// Pop the values copied into a new block closure off the stack.  A single copied
+// value is kept in copiedValues itself and the closure is flagged so invokeBlock
+// knows, and a closure with none leaves copiedValues nil, so neither allocates an
+// Array.  Answers the closure, which may have moved.
+
+oop popCopiedValues(oop blockClosureOop, uint8_t numberOfCopiedVariables)
+{
+	oop array;
+	int i;
+
+	if (numberOfCopiedVariables == 0)
+		return blockClosureOop;
+
+	if (numberOfCopiedVariables == 1) {
+		oop object = pop ();
+		asBlockClosure(blockClosureOop) -> copiedValues = object;
+		registerIfNeeded(blockClosureOop, object);
+		markInlineCopiedValue(blockClosureOop);
+		return blockClosureOop;
+	}
+
+	push (blockClosureOop);
+	array = newInstanceOfClass (ST_ARRAY_CLASS, numberOfCopiedVariables, EdenSpace);
+	blockClosureOop = pop ();
+
+	asBlockClosure(blockClosureOop) -> copiedValues = array;
+	registerIfNeeded(blockClosureOop, array);
+
+	for (i=numberOfCopiedVariables ; i > 0 ; i--) {
+		oop object = pop ();
+		indexedVarAtIntPut (array, i, object);
+	}
+
+	return blockClosureOop;
+}
+
 void invokeBlock(oop blockClosureOop, uint64_t numArgs)
 {
 	uint32_t i, numberOfCopiedValues, numberOfTemporaries;
-	oop previousFrameStackOffset = cIntToST(stIntToC(asContext(currentContext)->stackOffset) -1 - numArgs);
+	oop previousFrameStackOffset = cIntToST(stIntToC(asFrame(currentContext)->stackOffset) -1 - numArgs);
 	oop newContextOop;
 
-	if (checkForOutOfStack())
-		return;
-
-	if (asBlockClosure(blockClosureOop)->copiedValues != ST_NIL) {
+	COUNT_STATISTIC(vmStatistics.blockActivations);
+	if (isInlineCopiedValue(blockClosureOop))
+		push (asBlockClosure(blockClosureOop)->copiedValues);
+	else if (asBlockClosure(blockClosureOop)->copiedValues != ST_NIL) {
 		numberOfCopiedValues = indexedObjectSize(asBlockClosure(blockClosureOop)->copiedValues);
 		for (i=0; i < numberOfCopiedValues; i++) {
 			push (instVarAtInt(asBlockClosure(blockClosureOop)->copiedValues, i));
 		}
 	}
 
+	if (!isQuickened(getBytecodes(asBlockClosure(blockClosureOop) -> method)))
+		quickenBytecodes(getBytecodes(asBlockClosure(blockClosureOop) -> method));
+	countHotMethod(asBlockClosure(blockClosureOop) -> method, FALSE);
+#ifdef JIT
+	jitCountActivation(getBytecodes(asBlockClosure(blockClosureOop) -> method));
+#endif
+
 	numberOfTemporaries = stIntToC (asCompiledMethod(asBlockClosure(blockClosureOop) -> method)->numberOfTemporaries);
 	for (i=0; i < numberOfTemporaries; i++)
 		push (ST_NIL);
 
-	newContextOop = newInstanceOfClass(ST_CODE_CONTEXT_CLASS, 0, currentStackSpace);
-	contextStruct *newContextStruct = asContext(newContextOop);
-
-	newContextStruct->frame = currentContext;  // frame
-	newContextStruct->stackOffset = cIntToST(0);  // stack
-	newContextStruct->pcOffset = cIntToST(0);  // pcOffset
-	newContextStruct->method = asBlockClosure(blockClosureOop) -> method; // method
-	newContextStruct->contextId = markAsContextPointer(newContextOop);
-	if (asBlockClosure(blockClosureOop)->methodContext == ST_NIL)
-		newContextStruct->methodContext = ST_NIL;  // method context		
-	else
-		newContextStruct->methodContext = asBlockClosure(blockClosureOop)->methodContext;  // method context
+	newContextOop = newStackFrame(asBlockClosure(blockClosureOop) -> method, asBlockClosure(blockClosureOop)->methodContext);
 
 	currentContext = newContextOop;
 
@@ -392,47 +479,729 @@ int returnFromContext()
 	oop returnValue;
 
 	returnValue = pop ();
-	currentContext = asContext(currentContext)->frame;
-	currentStackSpace->lastFreeBlock = (currentContext - (uint64_t)&currentStackSpace->space[0])/ sizeof(oop) - 1;
-	currentStackSpace->firstFreeBlock = (((uint64_t)&asContext(currentContext)->stackBody[stIntToC(asContext(currentContext)->stackOffset)] - ((uint64_t)&currentStackSpace->space[0]))/ sizeof(oop));
-	asObjectHeader(currentContext)->size = sizeof(objectHeaderStruct) + sizeof(contextStruct) + (stIntToC(asContext(currentContext)->stackOffset) * sizeof(oop));
+	currentContext = asFrame(currentContext)->frame;
+	if (!isPointerInStackPage(currentContext, currentStackSpace))
+		currentStackSpace = popStackPagesTo(currentContext);
 	captureFastContext(currentContext);
 	push (returnValue);
 
 	if (tracing)
 		LOGI ("Return from context");
 
-	if (currentContext == stopFrame) {
-		eventWaitingFlag = TRUE;
+	if (currentContext == stopFrame)
 		return FALSE;
-		}
 	else
 		return TRUE;
 }
 
-// The Polymorphic Inline Cache (PIC) isn't currently implemented.  This is a
-// placeholder for that functionality once it's implemented.
+// Polymorphic Inline Cache (PIC)
+//
+// Each CompiledMethod and CompiledBlock may hold an Array in its polymorphicInlineCache
+// slot (see CodeGenerator >> writePICInto:).  The Array holds one picCacheStruct for each
+// send site in the method - the bytecode offset of the send followed by PIC_CACHE_SIZE
+// class/method pairs.  Sites are located by hashing the bytecode offset.
+//
+// A site is empty (no classes), monomorphic (one class), polymorphic (up to PIC_CACHE_SIZE
+// classes) or megamorphic.  A megamorphic site has true in its first class slot and always
+// does a full method lookup.
+//
+// The bytecode offset slot also holds the PIC epoch.  Changing a method dictionary
+// flushes every PIC in the image by incrementing picEpoch so that all existing sites are
+// treated as empty the next time they're used.
 //
 // picLookup locates a method in the PIC
 // picRegister registers a method call in the PIC
 
-oop picLookup(oop methodOop, oop pcOop, oop classOop)
+uint64_t picEpoch = 0;
+uint64_t picHits = 0;
+uint64_t picMisses = 0;
+uint64_t picMegamorphicSends = 0;
+uint64_t picFlushes = 0;
+
+#define PIC_SITE_SIZE (sizeof(picCacheStruct) / sizeof(oop))
+#define PIC_EPOCH_MASK 0x0FFFFFFF
+#define picSiteKey(offset) cIntToST(((picEpoch & PIC_EPOCH_MASK) << 32) | ((offset) & 0xFFFFFFFF))
+#define isPicSiteStale(key) ((((uint64_t) stIntToC(key)) >> 32) != (picEpoch & PIC_EPOCH_MASK))
+#define isMegamorphicSite(site) ((site)->entry[0].picClass == ST_TRUE)
+
+picCacheStruct *picSiteFor(oop methodOop, uint64_t bytecodeOffset, int allocate)
+{
+	oop picOop;
+	uint64_t numberOfSites, i, siteIndex;
+	picCacheStruct *sites, *staleSite = NULL;
+	oop key = picSiteKey(bytecodeOffset);
+
+	if ((methodOop == ST_NIL) || isImmediate(methodOop))
+		return NULL;
+
+	picOop = asCompiledMethod(methodOop)->polymorphicInlineCache;
+	if (!isArray(picOop))
+		return NULL;
+
+	numberOfSites = indexedObjectSize(picOop) / PIC_SITE_SIZE;
+	if (numberOfSites == 0)
+		return NULL;
+
+	sites = (picCacheStruct *) objectBody(picOop);
+	siteIndex = bytecodeOffset % numberOfSites;
+
+	for (i=0; i < numberOfSites; i++) {
+		picCacheStruct *site = &sites[siteIndex];
+
+		if (site->bytecodeOffset == key)
+			return site;
+
+		if (site->bytecodeOffset == ST_NIL) {
+			if (staleSite == NULL)
+				staleSite = site;
+			break;
+		}
+
+		if ((staleSite == NULL) && isPicSiteStale(site->bytecodeOffset))
+			staleSite = site;
+
+		if (++siteIndex == numberOfSites)
+			siteIndex = 0;
+	}
+
+	if (!allocate || (staleSite == NULL))
+		return NULL;
+
+	staleSite->bytecodeOffset = key;
+	for (i=0; i < PIC_CACHE_SIZE; i++) {
+		staleSite->entry[i].picClass = ST_NIL;
+		staleSite->entry[i].picMethod = ST_NIL;
+	}
+
+	return staleSite;
+}
+
+oop picLookup(oop methodOop, uint64_t bytecodeOffset, oop classOop)
 {
+	picCacheStruct *site = picSiteFor(methodOop, bytecodeOffset, FALSE);
+	int i;
+
+	if (site == NULL) {
+		picMisses++;
+		return ST_NIL;
+	}
+
+	if (isMegamorphicSite(site)) {
+		picMegamorphicSends++;
+		return ST_TRUE;
+	}
+
+	for (i=0; (i < PIC_CACHE_SIZE) && (site->entry[i].picClass != ST_NIL); i++) {
+		if (site->entry[i].picClass == classOop) {
+			picHits++;
+			return site->entry[i].picMethod;
+		}
+	}
+
+	picMisses++;
 	return ST_NIL;
 }
 
-void picRegister(oop methodOop, oop pcOop, oop classOop, oop locatedMethodOop)
+void picRegister(oop methodOop, uint64_t bytecodeOffset, oop classOop, oop locatedMethodOop)
+{
+	picCacheStruct *site = picSiteFor(methodOop, bytecodeOffset, TRUE);
+	oop picOop;
+	int i;
+
+	if ((site == NULL) || isMegamorphicSite(site))
+		return;
+
+	picOop = asCompiledMethod(methodOop)->polymorphicInlineCache;
+
+	for (i=0; i < PIC_CACHE_SIZE; i++) {
+		if (site->entry[i].picClass == ST_NIL) {
+			site->entry[i].picClass = classOop;
+			site->entry[i].picMethod = locatedMethodOop;
+			registerIfNeeded(picOop, classOop);
+			registerIfNeeded(picOop, locatedMethodOop);
+			return;
+		}
+	}
+
+	// All the entries are in use so the site becomes megamorphic
+	site->entry[0].picClass = ST_TRUE;
+	site->entry[0].picMethod = ST_NIL;
+}
+
+// picFlush invalidates every PIC in the image.  It's called whenever a method dictionary
+// changes.
+void picFlush()
 {
+	picEpoch++;
+	picFlushes++;
 }
 
-void dispatch (oop selector, uint64_t numArgs)
+// The PICs in a saved image may have been filled in with a different epoch, so when we
+// start up we clear every PIC in the image.
+void picClearObject(oop object, __attribute__((unused)) void *args)
+{
+	oop classOop, picOop;
+	uint64_t i;
+
+	if (isFree(object) || isBytes(object))
+		return;
+
+	classOop = asObjectHeader(object)->stClass;
+	if (asBehavior(classOop)->superclass != asBehavior(ST_COMPILED_BLOCK_CLASS)->superclass)
+		return;
+
+	picOop = asCompiledMethod(object)->polymorphicInlineCache;
+	if (!isArray(picOop))
+		return;
+
+	for (i=0; i < totalObjectSize(picOop); i++)
+		instVarAtInt(picOop, i) = ST_NIL;
+}
+
+void picClearAll()
+{
+	enumerateObjectsInSpace(EdenSpace, picClearObject, NULL);
+	enumerateObjectsInSpace(ActiveSurvivorSpace, picClearObject, NULL);
+	enumerateObjectsInOldSpace(picClearObject, NULL);
+}
+
+// picFeedback answers the number of oops needed to describe the live send sites in the
+// method's PIC.  If feedback isn't NULL it's filled in with, for each site, the bytecode
+// offset, the number of classes seen there (-1 if the site is megamorphic) and then
+// those classes.
+uint64_t picFeedback(oop methodOop, oop *feedback)
+{
+	oop picOop = asCompiledMethod(methodOop)->polymorphicInlineCache;
+	picCacheStruct *sites;
+	uint64_t numberOfSites, size, i;
+	int j, numberOfClasses;
+
+	if (!isArray(picOop))
+		return 0;
+
+	numberOfSites = indexedObjectSize(picOop) / PIC_SITE_SIZE;
+	sites = (picCacheStruct *) objectBody(picOop);
+	size = 0;
+
+	for (i=0; i < numberOfSites; i++) {
+		picCacheStruct *site = &sites[i];
+
+		if ((site->bytecodeOffset == ST_NIL) || isPicSiteStale(site->bytecodeOffset))
+			continue;
+
+		numberOfClasses = 0;
+		if (!isMegamorphicSite(site)) {
+			for (j=0; j < PIC_CACHE_SIZE; j++) {
+				if (site->entry[j].picClass == ST_NIL)
+					continue;
+				if (feedback != NULL)
+					feedback[size + 2 + numberOfClasses] = site->entry[j].picClass;
+				numberOfClasses++;
+			}
+		}
+
+		if (feedback != NULL) {
+			feedback[size] = cIntToST(stIntToC(site->bytecodeOffset) & 0xFFFFFFFF);
+			feedback[size + 1] = cIntToST(isMegamorphicSite(site) ? -1 : numberOfClasses);
+		}
+		size += 2 + numberOfClasses;
+	}
+
+	return size;
+}
+
+// Global method cache
+//
+// The method cache maps a (selector, receiver class) pair to the method found by
+// walking the superclass chain.  It's consulted for every send that misses its PIC
+// or has no send site (special selectors, perform:withArguments: and sends from the
+// VM).
+//
+// The cache holds raw pointers that the garbage collector doesn't know about, so we
+// never cache objects in new space and we flush the whole cache after anything that
+// moves old objects (global GC, become: and reallocating a space).  Installing or
+// removing a method only flushes the entries for its selector.
+
+methodCacheEntryStruct methodCache[METHOD_CACHE_SIZE];
+uint64_t methodCacheHits = 0;
+uint64_t methodCacheMisses = 0;
+
+#define methodCacheIndex(selector, classOop) ((((selector) ^ (classOop)) >> IMMEDIATE_SHIFT) & (METHOD_CACHE_SIZE - 1))
+
+oop lookupMethod(oop selector, oop classOop)
+{
+	methodCacheEntryStruct *entry = &methodCache[methodCacheIndex(selector, classOop)];
+	oop class, method;
+
+	if ((entry->selector == selector) && (entry->methodClass == classOop)) {
+		methodCacheHits++;
+		return entry->method;
+	}
+
+	methodCacheMisses++;
+
+	for (class = classOop; class != ST_NIL; class = asBehavior(class)->superclass) {
+		if ((method = findCompiledMethod(selector, class)) != ST_NIL) {
+			if (!isObjectInAnyNewSpace(selector) && !isObjectInAnyNewSpace(classOop) && !isObjectInAnyNewSpace(method)) {
+				entry->selector = selector;
+				entry->methodClass = classOop;
+				entry->method = method;
+			}
+			return method;
+		}
+	}
+
+	return ST_NIL;
+}
+
+void methodCacheFlush()
+{
+	memset(methodCache, 0, sizeof(methodCache));
+	loadSpecialSelectors();
+	hotMethodFlush();
+#ifdef JIT
+	jitFlush();
+#endif
+}
+
+void methodCacheFlushSelector(oop selector)
+{
+	int i;
+
+	for (i=0; i < METHOD_CACHE_SIZE; i++) {
+		if (methodCache[i].selector == selector)
+			memset(&methodCache[i], 0, sizeof(methodCacheEntryStruct));
+	}
+}
+
+// Hot methods
+//
+// The VM counts the activations and backward jumps of each CompiledMethod and
+// CompiledBlock.  When a method's total reaches hotMethodThreshold it's queued and, at
+// the next safepoint, handed to the object in the O_HOT_METHOD_HANDLER well known slot
+// by sending it the selector in O_HOT_METHOD_SELECTOR with the method as the argument
+// (see HotMethodOptimizer in the Compiler kit).  The type feedback for the method is
+// whatever its PIC has recorded (see picFeedback).  Methods are only counted and
+// reported when a handler has been registered.
+//
+// The counters and the queue hold raw pointers so, like the method cache, we only
+// count methods in old space and we clear everything after old objects move.  A method
+// is reported at most once until then.
+
+hotMethodCounterStruct hotMethodCounters[HOT_METHOD_TABLE_SIZE];
+oop hotMethodQueue[HOT_METHOD_QUEUE_SIZE];
+uint64_t hotMethodQueueSize = 0;
+uint64_t hotMethodThreshold = 10000;
+uint64_t hotMethodsReported = 0;
+int reportingHotMethods = FALSE;
+
+#define hotMethodIndex(methodOop) (((methodOop) >> IMMEDIATE_SHIFT) & (HOT_METHOD_TABLE_SIZE - 1))
+#define hasHotMethodHandler() ((WellKnownObjects->firstFreeBlock > O_HOT_METHOD_SELECTOR) && (ST_HOT_METHOD_HANDLER != ST_NIL))
+
+hotMethodCounterStruct *hotMethodCounterFor(oop methodOop)
+{
+	hotMethodCounterStruct *counter = &hotMethodCounters[hotMethodIndex(methodOop)];
+
+	return (counter->method == methodOop) ? counter : NULL;
+}
+
+void hotMethodFlush()
+{
+	memset(hotMethodCounters, 0, sizeof(hotMethodCounters));
+	hotMethodQueueSize = 0;
+}
+
+void countHotMethod(oop methodOop, int backEdge)
+{
+	hotMethodCounterStruct *counter = &hotMethodCounters[hotMethodIndex(methodOop)];
+
+	if (counter->method != methodOop) {
+		if (!hasHotMethodHandler() || !isObjectInOldSpace(methodOop))
+			return;
+		counter->method = methodOop;
+		counter->activations = 0;
+		counter->backEdges = 0;
+	}
+
+	if (backEdge)
+		counter->backEdges++;
+	else
+		counter->activations++;
+
+	if ((uint64_t) counter->activations + counter->backEdges != hotMethodThreshold)
+		return;
+
+	if (hotMethodQueueSize < HOT_METHOD_QUEUE_SIZE) {
+		hotMethodQueue[hotMethodQueueSize++] = methodOop;
+		requestInterrupt(INTERRUPT_HOT_METHODS);
+	}
+}
+
+// Called at a safepoint.  Each hot method is passed to the handler with a nested
+// interpreter that stops when the handler returns to the current frame.
+void reportHotMethods()
+{
+	oop oldStopFrame, methodOop;
+
+	if (reportingHotMethods)
+		return;
+
+	reportingHotMethods = TRUE;
+	oldStopFrame = stopFrame;
+
+	while ((hotMethodQueueSize > 0) && hasHotMethodHandler()) {
+		methodOop = hotMethodQueue[--hotMethodQueueSize];
+		hotMethodsReported++;
+
+		stopFrame = currentContext;
+		push (ST_HOT_METHOD_HANDLER);
+		push (methodOop);
+		dispatch (ST_HOT_METHOD_SELECTOR, 1);
+		if (currentContext != stopFrame)
+			basicInterpret(0);
+		if (currentContext != stopFrame)
+			break;
+		pop ();
+	}
+
+	hotMethodQueueSize = 0;
+	stopFrame = oldStopFrame;
+	reportingHotMethods = FALSE;
+}
+
+// flushMethodCaches invalidates both the PICs and the global method cache
+void flushMethodCaches()
+{
+	picFlush();
+	methodCacheFlush();
+}
+
+// Quick methods and frameless primitives
+//
+// Most sends go to methods that either answer something trivial (self, nil, true,
+// false, a small integer, a literal or an instance variable), set an instance variable
+// and answer self, or start with a primitive call.  runMethodInline runs these directly
+// on the caller's stack without building a CodeContext.
+//
+// A frameless primitive runs with fastContext.localsPointer pointing at the receiver in
+// the caller's stack.  If the primitive fails the method is invoked normally and its
+// frame continues at the primitive return bytecode with the failure code.  Methods with
+// breakpoints use the "with break" bytecodes so they never match here.
+
+uint64_t quickMethodCalls = 0;
+uint64_t framelessPrimitiveCalls = 0;
+uint64_t framelessPrimitiveFailures = 0;
+oop *framelessLocalsPointer = NULL;
+
+void returnInline(uint64_t numArgs, oop result)
+{
+	uint64_t i;
+
+	for (i=0; i <= numArgs; i++)
+		pop ();
+	push (result);
+}
+
+int runQuickMethod(oop method, uint64_t numArgs)
 {
+	oop bytecodesOop = getBytecodes(method);
+	uint8_t *bytecodes = (uint8_t *) objectBody(bytecodesOop);
+	uint64_t size = basicByteSize(bytecodesOop);
+	oop receiver = fastContext.stackPointer[-1 - (int64_t) numArgs];
+	uint8_t bytecode = bytecodes[0];
+	oop result;
+
+	if ((size >= 2) && (bytecodes[1] == 0xdc)) {
+		if (bytecode == 0x93)
+			result = receiver;
+		else if (bytecode == 0x90)
+			result = ST_TRUE;
+		else if (bytecode == 0x91)
+			result = ST_FALSE;
+		else if (bytecode == 0x92)
+			result = ST_NIL;
+		else if ((bytecode <= 0x0f) && !isImmediate(receiver))
+			result = instVarAtInt(receiver, bytecode);
+		else if ((bytecode >= 0x60) && (bytecode <= 0x6f))
+			result = cIntToST((bytecode & 0x0f) + 1);
+		else if ((bytecode >= 0x70) && (bytecode <= 0x7f))
+			result = cIntToST(-(bytecode & 0x0f));
+		else if ((bytecode >= 0x80) && (bytecode <= 0x8f))
+			result = getLiteral(method, bytecode & 0x0f);
+		else
+			return FALSE;
+	}
+	else if ((size >= 2) && (bytecode == 0xbd) && !isImmediate(receiver))
+		result = instVarAtInt(receiver, bytecodes[1]);
+	else if ((numArgs == 1) && (size >= 5) && (bytecode == 0x20)
+			&& ((bytecodes[1] & 0xf0) == 0x10) && (bytecodes[2] == 0xac)
+			&& (bytecodes[3] == 0x93) && (bytecodes[4] == 0xdc)
+			&& !isImmediate(receiver)
+			&& ((bytecodes[1] & 0x0f) < totalObjectSize(receiver))) {
+		instVarAtIntPut(receiver, bytecodes[1] & 0x0f, top ());
+		result = receiver;
+	}
+	else
+		return FALSE;
+
+	quickMethodCalls++;
+	returnInline(numArgs, result);
+	return TRUE;
+}
+
+int runFramelessPrimitive(oop method, uint64_t numArgs)
+{
+	oop bytecodesOop = getBytecodes(method);
+	uint8_t *bytecodes = (uint8_t *) objectBody(bytecodesOop);
+	uint16_t primitiveNumber;
+	oop *savedLocalsPointer;
+	oop result, value;
+
+	if ((basicByteSize(bytecodesOop) < 4) || (bytecodes[0] != 0xdb) || (bytecodes[3] != 0xdf))
+		return FALSE;
+
+	primitiveNumber = ((uint16_t) bytecodes[1]) * 256 + bytecodes[2];
+	if (!framelessPrimitive[primitiveNumber])
+		return FALSE;
+
+	savedLocalsPointer = fastContext.localsPointer;
+	framelessLocalsPointer = fastContext.localsPointer = fastContext.stackPointer - 1 - numArgs;
+	invokePrimitive(primitiveNumber);
+	framelessLocalsPointer = NULL;
+	fastContext.localsPointer = savedLocalsPointer;
+
+	value = pop ();
+	result = pop ();
+
+	framelessPrimitiveCalls++;
+	if (result == cIntToST(0)) {
+		returnInline(numArgs, value);
+		return TRUE;
+	}
+
+	// The primitive failed - build the frame and continue at the primitive return
+	// bytecode as if the primitive had run inside it.
+
+	framelessPrimitiveFailures++;
+	invoke(method, numArgs);
+	push (result);
+	push (value);
+	jump (3);
+	return TRUE;
+}
+
+int runMethodInline(oop method, uint64_t numArgs)
+{
+	if (tracing)
+		return FALSE;
+
+	return runQuickMethod(method, numArgs) || runFramelessPrimitive(method, numArgs);
+}
+
+// Quickening
+//
+// The first time a method or block is activated its bytecodes are rewritten in place
+// so that common sequences run as a single superinstruction:
+//
+//   bb  push local; push literal; call well known	->  bb <push local> <push literal> <selector>
+//   bc  push local; push integer; call well known	->  bc <push local> <push integer> <selector>
+//   bd  push inst var; return						->  bd <push inst var>
+//   be  push local; push local; call well known		->  be <push local> <push local> <selector>
+//
+// A superinstruction keeps the bytecodes it replaced (only the implied call well known
+// or return is dropped) so unquickenBytecodes can always put the original bytecodes
+// back.  The bytecodes are unquickened before they're handed to Smalltalk (the
+// Decompiler and debugger go through CompiledCode>>bytecodes), before they're logged
+// and before the image is saved.  They're quickened again on the next activation.
+//
+// Sequences are only fused if no jump lands inside them, and every fused sequence
+// ends with the only bytecode in it that can leave the frame, so a context that was
+// suspended by a send, a return or a breakpoint is never left in the middle of a
+// superinstruction.  Single stepping is the exception: the debugger unquickens the
+// method and can stop a frame after any bytecode.  Quickening that method again would
+// shift the bytes under the stopped frame, so once anything has been single stepped
+// no more bytecodes are quickened for the rest of the run.
+
+uint64_t quickenedSequences = 0;
+int quickeningSuspended = FALSE;
+
+const uint8_t bytecodeLengths[256] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 00
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 10
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 20
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 30
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 40
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 50
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 60
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 70
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	// 80
+	1, 1, 1, 1, 2, 3, 2, 3, 3, 5, 2, 3, 2, 3, 2, 3,	// 90
+	5, 3, 3, 2, 3, 2, 3, 3, 5, 2, 3, 3, 1, 1, 1, 0,	// a0
+	2, 3, 2, 3, 2, 3, 1, 3, 5, 3, 5, 4, 4, 2, 4, 0,	// b0
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,	// c0
+	2, 2, 2, 2, 2, 2, 2, 3, 4, 3, 4, 3, 1, 1, 1, 1,	// d0
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,	// e0
+	2, 2, 2, 2, 2, 2, 2, 3, 4, 3, 4, 3, 1, 1, 1, 1,	// f0
+};
+
+#define isShortPushLocal(b) (((b) & 0xf0) == 0x20)
+#define isShortPushInstVar(b) ((b) <= 0x0f)
+#define isShortPushLiteral(b) (((b) & 0xf0) == 0x80)
+#define isShortPushInteger(b) (((b) >= 0x60) && ((b) <= 0x7f))
+#define isFusableWellKnown(s) (((s) == SPECIAL_PLUS) || ((s) == SPECIAL_MINUS) || ((s) == SPECIAL_TIMES) \
+		|| ((s) == SPECIAL_IDENTICAL) || ((s) == SPECIAL_NOT_IDENTICAL) || ((s) == SPECIAL_EQUALS) || ((s) == SPECIAL_NOT_EQUALS) \
+		|| (((s) >= SPECIAL_GREATER_THAN) && ((s) <= SPECIAL_LESS_THAN_OR_EQUAL)) || ((s) == SPECIAL_BIT_AND) \
+		|| ((s) == SPECIAL_BIT_OR) || ((s) == SPECIAL_BIT_XOR))
+
+void quickenBytecodes(oop bytecodesOop)
+{
+	uint8_t *bytecodes = (uint8_t *) objectBody(bytecodesOop);
+	uint64_t size = basicByteSize(bytecodesOop);
+	uint64_t offset, length;
+	uint8_t *jumpTarget;
+
+	if (quickeningSuspended)
+		return;
+
+	markQuickened(bytecodesOop);
+	if (size == 0)
+		return;
+
+	jumpTarget = calloc(size + 1, sizeof(uint8_t));
+	if (jumpTarget == NULL)
+		return;
+
+	for (offset = 0; offset < size; offset += length) {
+		uint8_t bytecode = bytecodes[offset];
+		int64_t target;
+
+		length = bytecodeLengths[bytecode];
+		if ((length == 0) || (offset + length > size)) {
+			free (jumpTarget);
+			return;
+		}
+
+		if ((bytecode < 0xb0) || (bytecode > 0xb5))
+			continue;
+
+		if (length == 2)
+			target = offset + length + (int8_t) bytecodes[offset + 1];
+		else
+			target = offset + length + (int16_t) (bytecodes[offset + 1] * 256 + bytecodes[offset + 2]);
+
+		if ((target >= 0) && (target <= (int64_t) size))
+			jumpTarget[target] = TRUE;
+	}
 
-	oop receiver = asContext(currentContext)->stackBody[stIntToC(asContext(currentContext)->stackOffset) - 1 - numArgs];
+	for (offset = 0; offset < size; offset += length) {
+		uint8_t bytecode = bytecodes[offset];
+
+		length = bytecodeLengths[bytecode];
+
+		if (isShortPushLocal(bytecode) && (offset + 3 < size)
+				&& (bytecodes[offset + 2] == 0xd6) && isFusableWellKnown(bytecodes[offset + 3])
+				&& !jumpTarget[offset + 1] && !jumpTarget[offset + 2]) {
+			uint8_t secondBytecode = bytecodes[offset + 1];
+			uint8_t superinstruction;
+
+			if (isShortPushLiteral(secondBytecode))
+				superinstruction = 0xbb;
+			else if (isShortPushInteger(secondBytecode))
+				superinstruction = 0xbc;
+			else if (isShortPushLocal(secondBytecode))
+				superinstruction = 0xbe;
+			else
+				continue;
+
+			bytecodes[offset + 2] = secondBytecode;
+			bytecodes[offset + 1] = bytecode;
+			bytecodes[offset] = superinstruction;
+			length = 4;
+			quickenedSequences++;
+		}
+		else if (isShortPushInstVar(bytecode) && (offset + 1 < size)
+				&& (bytecodes[offset + 1] == 0xdc) && !jumpTarget[offset + 1]) {
+			bytecodes[offset + 1] = bytecode;
+			bytecodes[offset] = 0xbd;
+			length = 2;
+			quickenedSequences++;
+		}
+	}
+
+	free (jumpTarget);
+}
+
+void unquickenBytecodes(oop bytecodesOop)
+{
+	uint8_t *bytecodes = (uint8_t *) objectBody(bytecodesOop);
+	uint64_t size = basicByteSize(bytecodesOop);
+	uint64_t offset, length;
+
+	if (!isQuickened(bytecodesOop))
+		return;
+
+	for (offset = 0; offset < size; offset += length) {
+		uint8_t bytecode = bytecodes[offset];
+
+		length = bytecodeLengths[bytecode];
+		if ((length == 0) || (offset + length > size))
+			break;
+
+		switch (bytecode) {
+			case 0xbb:
+			case 0xbc:
+			case 0xbe:
+				bytecodes[offset] = bytecodes[offset + 1];
+				bytecodes[offset + 1] = bytecodes[offset + 2];
+				bytecodes[offset + 2] = 0xd6;
+				break;
+
+			case 0xbd:
+				bytecodes[offset] = bytecodes[offset + 1];
+				bytecodes[offset + 1] = 0xdc;
+				break;
+		}
+	}
+
+	unmarkQuickened(bytecodesOop);
+}
+
+void unquickenObject(oop object, __attribute__((unused)) void *args)
+{
+	oop classOop, bytecodesOop;
+
+	if (isFree(object) || isBytes(object))
+		return;
+
+	classOop = asObjectHeader(object)->stClass;
+	if (asBehavior(classOop)->superclass != asBehavior(ST_COMPILED_BLOCK_CLASS)->superclass)
+		return;
+
+	bytecodesOop = getBytecodes(object);
+	if (!isImmediate(bytecodesOop) && isBytes(bytecodesOop))
+		unquickenBytecodes(bytecodesOop);
+}
+
+void unquickenAll()
+{
+	enumerateObjectsInSpace(EdenSpace, unquickenObject, NULL);
+	enumerateObjectsInSpace(ActiveSurvivorSpace, unquickenObject, NULL);
+	enumerateObjectsInOldSpace(unquickenObject, NULL);
+}
+
+// Sends from a send bytecode go through the PIC for their send site and may run the
+// method inline.  Other sends (special selectors, perform:withArguments: and sends
+// from the VM) have no stable send site so they always do a full method lookup and
+// build a frame.
+void basicDispatch (oop selector, uint64_t numArgs, int useInlineCache)
+{
+
+	oop receiver = asFrame(currentContext)->stackBody[stIntToC(asFrame(currentContext)->stackOffset) - 1 - numArgs];
 	oop class, receiverClassOop;
 	oop method;
 	oop picFound;
 	receiverClassOop = classOf(receiver);
+	COUNT_SEND(selector);
 
 //	classNameOf(receiverClassOop, className);
 //	STStringToC(selector, selectorString);
@@ -441,16 +1210,79 @@ void dispatch (oop selector, uint64_t numArgs)
 	class = receiverClassOop;
 	picFound = ST_NIL;
 	
-	if (((method = picFound = picLookup(asContext(currentContext)->method, stIntToC(asContext(currentContext)->pcOffset), class)) == ST_NIL)
+	if (!useInlineCache
+			|| ((method = picFound = picLookup(asFrame(currentContext)->method, stIntToC(asFrame(currentContext)->pcOffset), class)) == ST_NIL)
 			|| (picFound == ST_TRUE)) {
-		while ((method = findCompiledMethod(selector, class)) == ST_NIL) {
-			if (asBehavior(class)->superclass == ST_NIL) {
+		if ((method = lookupMethod(selector, class)) == ST_NIL) {
+			char selectorString[256], className[256];
+			oop classNameSymbol;
+			int i;
+
+			STStringToC(selector, selectorString);
+			LOGI("Message not understood: %s", selectorString);
+
+			receiverClassOop = classOf(receiver);
+			if (classOf(receiverClassOop) == ST_METACLASS_CLASS) {
+				STStringToC(asClass(asMetaclass(receiverClassOop)->thisClass)->name, className);
+				strcat(className, " class");
+			}
+			else
+				STStringToC(asClass(receiverClassOop)->name, className);
+
+			LOGW ("%s does not understand \"%s\"", className, selectorString);
+			snprintf(errorString, 1024, "%s does not understand \"%s\"", className,
+						selectorString);
+
+			COUNT_STATISTIC(vmStatistics.messagesNotUnderstood);
+			dumpWalkback(errorString);
+			raiseSTError (ST_MESSAGE_NOT_UNDERSTOOD_CLASS, walkbackDump);
+			errorString[0]='\0';
+			return;
+		}
+		if (useInlineCache && (picFound == ST_NIL))
+			picRegister(asFrame(currentContext)->method, stIntToC(asFrame(currentContext)->pcOffset), receiverClassOop, method);
+	}
+
+	if (tracing)
+	{
+	char selectorString[256];
+		STStringToC(selector, selectorString);
+		LOGI ("Dispatch %s", selectorString);
+		//dumpWalkback("dispatch");
+	}
+
+	if (!useInlineCache || !runMethodInline(method, numArgs))
+		invoke(method, numArgs);
+}
+
+void dispatch (oop selector, uint64_t numArgs)
+{
+	basicDispatch(selector, numArgs, FALSE);
+}
+
+void dispatchSend (oop selector, uint64_t numArgs)
+{
+	basicDispatch(selector, numArgs, TRUE);
+}
+
+void dispatchSuper (oop selector, uint64_t numArgs)
+{
+	oop receiver = asFrame(currentContext)->stackBody[stIntToC(asFrame(currentContext)->stackOffset) - 1 - numArgs];
+	oop class, receiverClassOop;
+	oop method;
+	oop picFound = ST_NIL;
+
+	receiverClassOop = class = asBehavior(pop ()) -> superclass;
+	COUNT_SEND(selector);
+
+	if (((method = picFound = picLookup(asFrame(currentContext)->method, stIntToC(asFrame(currentContext)->pcOffset), class)) == ST_NIL)
+		|| (picFound == ST_TRUE)) {
+		if ((method = lookupMethod(selector, class)) == ST_NIL) {
 				char selectorString[256], className[256];
 				oop classNameSymbol;
 				int i;
 
 				STStringToC(selector, selectorString);
-				LOGI("Message not understood: %s", selectorString);
 
 				receiverClassOop = classOf(receiver);
 				if (classOf(receiverClassOop) == ST_METACLASS_CLASS) {
@@ -462,81 +1294,170 @@ void dispatch (oop selector, uint64_t numArgs)
 
 				LOGW ("%s does not understand \"%s\"", className, selectorString);
 				snprintf(errorString, 1024, "%s does not understand \"%s\"", className,
-							selectorString);
+						selectorString);
 
+				COUNT_STATISTIC(vmStatistics.messagesNotUnderstood);
 				dumpWalkback(errorString);
 				raiseSTError (ST_MESSAGE_NOT_UNDERSTOOD_CLASS, walkbackDump);
 				errorString[0]='\0';
 				return;
-			}
-			class = asBehavior(class)->superclass;
 		}
 		if (picFound == ST_NIL)
-			picRegister(asContext(currentContext)->method, stIntToC(asContext(currentContext)->pcOffset), receiverClassOop, method);
+			picRegister(asFrame(currentContext)->method, stIntToC(asFrame(currentContext)->pcOffset), receiverClassOop, method);
 	}
 
 	if (tracing)
 	{
-	char selectorString[256];
+		char selectorString[256];
 		STStringToC(selector, selectorString);
-		LOGI ("Dispatch %s", selectorString);
-		//dumpWalkback("dispatch");
+		LOGI ("Dispatch super %s", selectorString);
+		dumpWalkback("dispatch super");
 	}
 
-	invoke(method, numArgs);
+	if (!runMethodInline(method, numArgs))
+		invoke(method, numArgs);
 }
 
-void dispatchSuper (oop selector, uint64_t numArgs)
+// Special selectors
+//
+// specialSelectorTable is a C copy of BeagleSystem's specialSelectors array so that
+// callWellKnown doesn't have to go through the system class on every fallback send.  It
+// holds raw oops, so it's reloaded after each scavenge and each method cache flush
+// (which covers old space compaction and BeagleSystem class>>initializeSpecialSelectors).
+
+specialSelectorStruct specialSelectorTable[MAX_SPECIAL_SELECTORS];
+
+void loadSpecialSelectors()
 {
-	oop receiver = asContext(currentContext)->stackBody[stIntToC(asContext(currentContext)->stackOffset) - 1 - numArgs];
-	oop class, receiverClassOop;
-	oop method;
-	oop picFound = ST_NIL;
+	oop selectorsOop = ST_NIL;
+	uint64_t i, numberOfSelectors = 0;
+
+	if (!isImmediate(ST_SYSTEM_CLASS) && (ST_SYSTEM_CLASS != ST_NIL))
+		selectorsOop = asSystemClass(ST_SYSTEM_CLASS)->specialSelectors;
+	if (isArray(selectorsOop))
+		numberOfSelectors = indexedObjectSize(selectorsOop) / 2;
+	if (numberOfSelectors > MAX_SPECIAL_SELECTORS)
+		numberOfSelectors = MAX_SPECIAL_SELECTORS;
+
+	for (i=0; i < MAX_SPECIAL_SELECTORS; i++) {
+		if (i < numberOfSelectors) {
+			specialSelectorTable[i].selector = instVarAtInt(selectorsOop, i*2);
+			specialSelectorTable[i].numArgs = stIntToC(instVarAtInt(selectorsOop, i*2 + 1));
+		}
+		else {
+			specialSelectorTable[i].selector = ST_NIL;
+			specialSelectorTable[i].numArgs = 0;
+		}
+	}
+}
 
-	receiverClassOop = class = asBehavior(pop ()) -> superclass;
+// Array, ByteArray and ByteString answer at:, at:put: and size with the basicAt:
+// primitives, so callWellKnown can do the same without a send.  These answer FALSE
+// for any other receiver or a bad index and the caller sends the message as usual.
 
-	if (((method = picFound = picLookup(asContext(currentContext)->method, stIntToC(asContext(currentContext)->pcOffset), class)) == ST_NIL)
-		|| (picFound == ST_TRUE)) {
-		while ((method = findCompiledMethod(selector, class)) == ST_NIL) {
-			if (asBehavior(class)->superclass == ST_NIL) {
-					char selectorString[256], className[256];
-					oop classNameSymbol;
-					int i;
-
-					STStringToC(selector, selectorString);
-
-					receiverClassOop = classOf(receiver);
-					if (classOf(receiverClassOop) == ST_METACLASS_CLASS) {
-						STStringToC(asClass(asMetaclass(receiverClassOop)->thisClass)->name, className);
-						strcat(className, " class");
-					}
-					else
-						STStringToC(asClass(receiverClassOop)->name, className);
+int specialAt(oop receiver, oop indexOop, oop *result)
+{
+	oop classOop;
+	int64_t index;
 
-					LOGW ("%s does not understand \"%s\"", className, selectorString);
-					snprintf(errorString, 1024, "%s does not understand \"%s\"", className,
-							selectorString);
+	if (isImmediate(receiver) || !isSmallInteger(indexOop))
+		return FALSE;
 
-					dumpWalkback(errorString);
-					raiseSTError (ST_MESSAGE_NOT_UNDERSTOOD_CLASS, walkbackDump);
-					errorString[0]='\0';
-					return;
-			}
-			class = asBehavior(class)->superclass;
-		}
-		if (picFound == ST_NIL)
-			picRegister(asContext(currentContext)->method, stIntToC(asContext(currentContext)->pcOffset), receiverClassOop, method);
+	classOop = asObjectHeader(receiver)->stClass;
+	index = stIntToC(indexOop);
+
+	if (classOop == ST_ARRAY_CLASS) {
+		if ((index < 1) || (index > indexedObjectSize(receiver)))
+			return FALSE;
+		*result = indexedVarAtInt(receiver, index);
+		return TRUE;
 	}
 
-	if (tracing)
-	{
-		char selectorString[256];
-		STStringToC(selector, selectorString);
-		LOGI ("Dispatch super %s", selectorString);
-		dumpWalkback("dispatch super");
+	if ((classOop == ST_BYTE_ARRAY_CLASS) || (classOop == ST_BYTE_STRING_CLASS)) {
+		if ((index < 1) || (index > basicByteSize(receiver)))
+			return FALSE;
+		if (classOop == ST_BYTE_ARRAY_CLASS)
+			*result = cIntToST(basicByteAtInt(receiver, index));
+		else
+			*result = cCharToST(basicByteAtInt(receiver, index));
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+int specialAtPut(oop receiver, oop indexOop, oop value)
+{
+	oop classOop;
+	int64_t index;
+
+	if (isImmediate(receiver) || !isSmallInteger(indexOop))
+		return FALSE;
+
+	classOop = asObjectHeader(receiver)->stClass;
+	index = stIntToC(indexOop);
+
+	if (classOop == ST_ARRAY_CLASS) {
+		if ((index < 1) || (index > indexedObjectSize(receiver)))
+			return FALSE;
+		indexedVarAtIntPut(receiver, index, value);
+		return TRUE;
+	}
+
+	if (classOop == ST_BYTE_ARRAY_CLASS) {
+		if ((index < 1) || (index > basicByteSize(receiver)) || !isSmallInteger(value)
+				|| (stIntToC(value) < 0) || (stIntToC(value) > 255))
+			return FALSE;
+#ifdef JIT
+		if (isJitted(receiver))
+			jitFlush();
+#endif
+		basicByteAtIntPut(receiver, index, stIntToC(value));
+		return TRUE;
+	}
+
+	if (classOop == ST_BYTE_STRING_CLASS) {
+		if ((index < 1) || (index > basicByteSize(receiver)) || !isCharacter(value)
+				|| (stIntToC(value) > 255))
+			return FALSE;
+		basicByteAtIntPut(receiver, index, stIntToC(value));
+		return TRUE;
 	}
 
-	invoke(method, numArgs);
+	return FALSE;
+}
+
+int specialSize(oop receiver, oop *result)
+{
+	oop classOop;
+
+	if (isImmediate(receiver))
+		return FALSE;
+
+	classOop = asObjectHeader(receiver)->stClass;
+	if (classOop == ST_ARRAY_CLASS)
+		*result = cIntToST(indexedObjectSize(receiver));
+	else if ((classOop == ST_BYTE_ARRAY_CLASS) || (classOop == ST_BYTE_STRING_CLASS))
+		*result = cIntToST(basicByteSize(receiver));
+	else
+		return FALSE;
+
+	return TRUE;
+}
+
+// Evaluate a block whose argument count matches the send.  The receiver and arguments
+// are still on the stack.
+int specialBlockValue(uint64_t numArgs)
+{
+	oop receiver = fastContext.stackPointer[-1 - (int64_t) numArgs];
+
+	if (isImmediate(receiver) || (asObjectHeader(receiver)->stClass != ST_BLOCK_CLOSURE_CLASS))
+		return FALSE;
+	if (stIntToC(asCompiledMethod(asBlockClosure(receiver)->method)->numberOfArguments) != (int64_t) numArgs)
+		return FALSE;
+
+	invokeBlock(receiver, numArgs);
+	return TRUE;
 }
 
 void dispatchSpecial0 (unsigned int selectorNumber, oop receiver)
@@ -563,6 +1484,7 @@ void dispatchSpecial2 (unsigned int selectorNumber, oop receiver, oop arg1, oop
 void callWellKnown(void)
 {
 	uint8_t selectorNumber = nextBytecode();
+	COUNT_STATISTIC(vmStatistics.specialSends[selectorNumber]);
 	switch (selectorNumber)
 	{
 		case SPECIAL_PLUS:	// +
@@ -578,8 +1500,8 @@ void callWellKnown(void)
 						push (asSumLargeInteger(result));
 				}
 				else
-					if (isFloat(receiver) && isFloat(arg)) {
-						double result = stFloatToC(receiver) + stFloatToC(arg);
+					if (isSmallFloat(receiver) && isSmallFloat(arg)) {
+						double result = smallFloatToC(receiver) + smallFloatToC(arg);
 						push (cFloatToST(result));
 						}
 					else
@@ -599,8 +1521,8 @@ void callWellKnown(void)
 						push (asSumLargeInteger(result));
 				}
 				else
-					if (isFloat(receiver) && isFloat(arg)) {
-						double result = stFloatToC(receiver) - stFloatToC(arg);
+					if (isSmallFloat(receiver) && isSmallFloat(arg)) {
+						double result = smallFloatToC(receiver) - smallFloatToC(arg);
 						push (cFloatToST(result));
 						}
 					else
@@ -623,8 +1545,8 @@ void callWellKnown(void)
 					}
 				}
 				else
-					if (isFloat(receiver) && isFloat(arg)) {
-						double result = stFloatToC(receiver) * stFloatToC(arg);
+					if (isSmallFloat(receiver) && isSmallFloat(arg)) {
+						double result = smallFloatToC(receiver) * smallFloatToC(arg);
 						push (cFloatToST(result));
 						}
 					else
@@ -674,8 +1596,8 @@ void callWellKnown(void)
 					else
 						push (ST_FALSE);
 				else
-					if (isFloat(receiver) && isFloat(arg))
-						if (stFloatToC(receiver) == stFloatToC(arg))
+					if (isSmallFloat(receiver) && isSmallFloat(arg))
+						if (smallFloatToC(receiver) == smallFloatToC(arg))
 							push (ST_TRUE);
 						else
 							push (ST_FALSE);
@@ -693,8 +1615,8 @@ void callWellKnown(void)
 					else
 						push (ST_TRUE);
 				else
-					if (isFloat(receiver) && isFloat(arg))
-						if (stFloatToC(receiver) == stFloatToC(arg))
+					if (isSmallFloat(receiver) && isSmallFloat(arg))
+						if (smallFloatToC(receiver) == smallFloatToC(arg))
 							push (ST_FALSE);
 						else
 							push (ST_TRUE);
@@ -730,8 +1652,8 @@ void callWellKnown(void)
 					else
 						push (ST_FALSE);
 				else
-					if (isFloat(receiver) && isFloat(arg))
-						if (stFloatToC(receiver) > stFloatToC(arg))
+					if (isSmallFloat(receiver) && isSmallFloat(arg))
+						if (smallFloatToC(receiver) > smallFloatToC(arg))
 							push (ST_TRUE);
 						else
 							push (ST_FALSE);
@@ -749,8 +1671,8 @@ void callWellKnown(void)
 					else
 						push (ST_FALSE);
 				else
-					if (isFloat(receiver) && isFloat(arg))
-						if (stFloatToC(receiver) < stFloatToC(arg))
+					if (isSmallFloat(receiver) && isSmallFloat(arg))
+						if (smallFloatToC(receiver) < smallFloatToC(arg))
 							push (ST_TRUE);
 						else
 							push (ST_FALSE);
@@ -768,8 +1690,8 @@ void callWellKnown(void)
 					else
 						push (ST_FALSE);
 				else
-					if (isFloat(receiver) && isFloat(arg))
-						if (stFloatToC(receiver) >= stFloatToC(arg))
+					if (isSmallFloat(receiver) && isSmallFloat(arg))
+						if (smallFloatToC(receiver) >= smallFloatToC(arg))
 							push (ST_TRUE);
 						else
 							push (ST_FALSE);
@@ -787,8 +1709,8 @@ void callWellKnown(void)
 					else
 						push (ST_FALSE);
 				else
-					if (isFloat(receiver) && isFloat(arg))
-						if (stFloatToC(receiver) <= stFloatToC(arg))
+					if (isSmallFloat(receiver) && isSmallFloat(arg))
+						if (smallFloatToC(receiver) <= smallFloatToC(arg))
 							push (ST_TRUE);
 						else
 							push (ST_FALSE);
@@ -850,7 +1772,7 @@ void callWellKnown(void)
 			{
 //				oop receiver = pop ();
 				breakpointHit = TRUE;
-				eventWaitingFlag = TRUE;
+				requestInterrupt(INTERRUPT_BREAKPOINT);
 			}
 			break;
 
@@ -870,12 +1792,273 @@ void callWellKnown(void)
 			}
 			break;
 
+		case SPECIAL_AT:	// at:
+			{
+				oop arg = pop ();
+				oop receiver = pop ();
+				oop result;
+				if (specialAt(receiver, arg, &result))
+					push (result);
+				else
+					dispatchSpecial1 (SPECIAL_AT, receiver, arg);
+			}
+			break;
+
+		case SPECIAL_AT_PUT:	// at:put:
+			{
+				oop value = pop ();
+				oop arg = pop ();
+				oop receiver = pop ();
+				if (specialAtPut(receiver, arg, value))
+					push (value);
+				else
+					dispatchSpecial2 (SPECIAL_AT_PUT, receiver, arg, value);
+			}
+			break;
+
+		case SPECIAL_SIZE:	// size
+			{
+				oop receiver = pop ();
+				oop result;
+				if (specialSize(receiver, &result))
+					push (result);
+				else
+					dispatchSpecial0 (SPECIAL_SIZE, receiver);
+			}
+			break;
+
+		case SPECIAL_CLASS:	// class
+			{
+				oop receiver = pop ();
+				push (classOf(receiver));
+			}
+			break;
+
+		case SPECIAL_VALUE:	// value
+			if (!specialBlockValue(0))
+				dispatchSpecial0 (SPECIAL_VALUE, pop ());
+			break;
+
+		case SPECIAL_VALUE_COLON:	// value:
+			if (!specialBlockValue(1)) {
+				oop arg = pop ();
+				oop receiver = pop ();
+				dispatchSpecial1 (SPECIAL_VALUE_COLON, receiver, arg);
+			}
+			break;
+
+		case SPECIAL_INT_DIVIDE:	// //
+			{
+				oop arg = pop ();
+				oop receiver = pop ();
+				if (isSmallInteger(receiver) && isSmallInteger(arg) && (stIntToC(arg) != 0)) {
+					int64_t dividend = stIntToC(receiver);
+					int64_t divisor = stIntToC(arg);
+					int64_t result = dividend / divisor;
+					int64_t carry;
+					if (((dividend % divisor) != 0) && ((dividend < 0) != (divisor < 0)))
+						result--;
+					carry = result & (int64_t)0xF000000000000000L;
+					if ((carry == 0) || (carry == (int64_t)0xF000000000000000L))
+						push (cIntToST(result));
+					else
+						dispatchSpecial1 (SPECIAL_INT_DIVIDE, receiver, arg);
+				}
+				else
+					dispatchSpecial1 (SPECIAL_INT_DIVIDE, receiver, arg);
+			}
+			break;
+
+		case SPECIAL_MODULO:	// \\ (modulo)
+			{
+				oop arg = pop ();
+				oop receiver = pop ();
+				if (isSmallInteger(receiver) && isSmallInteger(arg) && (stIntToC(arg) != 0)) {
+					int64_t divisor = stIntToC(arg);
+					int64_t result = stIntToC(receiver) % divisor;
+					if ((result != 0) && ((result < 0) != (divisor < 0)))
+						result += divisor;
+					push (cIntToST(result));
+				}
+				else
+					dispatchSpecial1 (SPECIAL_MODULO, receiver, arg);
+			}
+			break;
+
+		case SPECIAL_BIT_AND:	// bitAnd:
+			{
+				oop arg = pop ();
+				oop receiver = pop ();
+				if (isSmallInteger(receiver) && isSmallInteger(arg))
+					push (cIntToST(stIntToC(receiver) & stIntToC(arg)));
+				else
+					dispatchSpecial1 (SPECIAL_BIT_AND, receiver, arg);
+			}
+			break;
+
+		case SPECIAL_DIVIDE:	// /
+			{
+				// Only exact SmallInteger quotients are answered here, so the result doesn't depend
+				// on how Number>>/ treats a remainder.
+				oop arg = pop ();
+				oop receiver = pop ();
+				if (isSmallInteger(receiver) && isSmallInteger(arg) && (stIntToC(arg) != 0) && (stIntToC(arg) != -1)
+						&& ((stIntToC(receiver) % stIntToC(arg)) == 0))
+					push (cIntToST(stIntToC(receiver) / stIntToC(arg)));
+				else
+					if (isSmallFloat(receiver) && isSmallFloat(arg)) {
+						double result = smallFloatToC(receiver) / smallFloatToC(arg);
+						push (cFloatToST(result));
+						}
+					else
+						dispatchSpecial1 (SPECIAL_DIVIDE, receiver, arg);
+			}
+			break;
+
+		case SPECIAL_BIT_OR:	// bitOr:
+			{
+				oop arg = pop ();
+				oop receiver = pop ();
+				if (isSmallInteger(receiver) && isSmallInteger(arg))
+					push (cIntToST(stIntToC(receiver) | stIntToC(arg)));
+				else
+					dispatchSpecial1 (SPECIAL_BIT_OR, receiver, arg);
+			}
+			break;
+
+		case SPECIAL_BIT_XOR:	// bitXor:
+			{
+				oop arg = pop ();
+				oop receiver = pop ();
+				if (isSmallInteger(receiver) && isSmallInteger(arg))
+					push (cIntToST(stIntToC(receiver) ^ stIntToC(arg)));
+				else
+					dispatchSpecial1 (SPECIAL_BIT_XOR, receiver, arg);
+			}
+			break;
+
+		case SPECIAL_BIT_SHIFT:	// bitShift:
+			{
+				// A left shift that overflows answers a LargeInteger
+				oop arg = pop ();
+				oop receiver = pop ();
+				if (isSmallInteger(receiver) && isSmallInteger(arg) && (stIntToC(arg) <= MAX_BIT_SHIFT))
+					push (smallIntegerBitShift(stIntToC(receiver), stIntToC(arg)));
+				else
+					dispatchSpecial1 (SPECIAL_BIT_SHIFT, receiver, arg);
+			}
+			break;
+
 		default:
 			break;
 	}
 }
 
 
+// The interpreter can dispatch bytecodes either with a switch statement or with
+// GCC's labels-as-values (threaded dispatch).  Either way, interruptPending and the
+// stop frame are only checked at the bottom of the loop after sends, returns and
+// backward jumps, unless we're single stepping or tracing.  Threaded dispatch jumps
+// straight from the end of one bytecode to the next one, while the switch version
+// goes back to the top of the loop.  Build with -DSWITCH_INTERPRETER to use the
+// portable switch version.  Emscripten always uses the switch version.
+//
+// The threaded interpreter also keeps the stack pointer, pc, locals, literals and
+// receiver body in C locals instead of updating the context on every push, pop and
+// fetch.  The context's stack and pc offsets are only brought up to
+// date at a SAFEPOINT(), which every bytecode that sends, returns, calls a primitive,
+// allocates or looks at thisContext does before anything else.  Stores into the heap
+// can't allocate or move anything so they don't need one.  The simple bytecodes use
+// the upper case accessors (PUSH, POP, LOCAL, ...) which map back to the
+// write-through macros in object.h for the switch interpreter.
+//
+// Each bytecode ends with NEXT, with NEXT_CHECKED if it is a backward jump, with
+// NEXT_SAFEPOINT if it sends, returns or calls a primitive, or with NEXT_RELOADED if it
+// only took a safepoint to allocate.  NEXT_SAFEPOINT reloads the state at the top of the
+// loop after polling interruptPending, NEXT_RELOADED reloads it in place.
+
+#if defined(__GNUC__) && !defined(__EMSCRIPTEN__) && !defined(SWITCH_INTERPRETER)
+#define THREADED_INTERPRETER
+#endif
+
+#if defined(JIT) && !defined(THREADED_INTERPRETER)
+#error "The JIT needs the threaded interpreter"
+#endif
+
+#ifdef THREADED_INTERPRETER
+#define BYTECODE(n) op_ ## n:
+#define BYTECODE_DEFAULT op_default:
+#define DISPATCH_ON(b) COUNT_STATISTIC(vmStatistics.bytecodes[(b)]); goto *opcodeTable[(b)];
+#define NEXT do {if (checkEveryBytecode) goto checkEvents; bytecode = FETCH_BYTECODE(); COUNT_STATISTIC(vmStatistics.bytecodes[bytecode]); goto *opcodeTable[bytecode];} while (0)
+#define NEXT_CHECKED goto checkEvents
+#define NEXT_SAFEPOINT goto checkEventsAtSafepoint
+#define NEXT_RELOADED do {LOAD_STATE(); NEXT;} while (0)
+
+#define PUSH(x) (*sp++ = (x))
+#define POP() (*--sp)
+#define TOP() (sp[-1])
+#define FETCH_BYTECODE() (*pc++)
+#define JUMP(offset) (pc += (offset))
+#define LOCAL(x) (locals[1+(x)])
+#define STORE_LOCAL(x,y) (locals[1+(x)] = (y))
+#define RECEIVER() (locals[0])
+#define RECEIVER_INST_VAR(x) (receiverBody[x])
+#define LITERAL(x) (literals[x])
+
+#define SAFEPOINT() do { \
+		int64_t spDelta = sp - fastContext.stackPointer; \
+		int64_t pcDelta = pc - fastContext.currentPCPointer; \
+		(*fastContext.stackOffsetPointer) += SMALLINTEGER_INCREMENT(1) * spDelta; \
+		(*fastContext.currentPCOffset) += SMALLINTEGER_INCREMENT(1) * pcDelta; \
+		fastContext.stackPointer = sp; \
+		fastContext.currentPCPointer = pc; \
+	} while (0)
+
+#define LOAD_STATE() do { \
+		sp = fastContext.stackPointer; \
+		pc = fastContext.currentPCPointer; \
+		locals = fastContext.localsPointer; \
+		literals = asCompiledMethod(asFrame(currentContext)->method)->literals; \
+		receiverBody = isImmediate(locals[0]) ? NULL : oopPtr(objectBody(locals[0])); \
+	} while (0)
+#else
+#define BYTECODE(n) case n:
+#define BYTECODE_DEFAULT default:
+#define DISPATCH_ON(b) COUNT_STATISTIC(vmStatistics.bytecodes[(b)]); switch (b)
+#define NEXT if (checkEveryBytecode) break; else continue
+#define NEXT_CHECKED break
+#define NEXT_SAFEPOINT break
+#define NEXT_RELOADED NEXT
+
+#define PUSH(x) push(x)
+#define POP() pop()
+#define TOP() top()
+#define FETCH_BYTECODE() nextBytecode()
+#define JUMP(offset) jump(offset)
+#define LOCAL(x) getLocal(x)
+#define STORE_LOCAL(x,y) setLocal(x,y)
+#define RECEIVER() getReceiver()
+#define RECEIVER_INST_VAR(x) instVarAtInt(getReceiver(),(x))
+#define LITERAL(x) getLiteral(asFrame(currentContext)->method, (x))
+
+#define SAFEPOINT()
+#define LOAD_STATE()
+#endif
+
+// Store value into a slot of object without a safepoint.  Only an index out of bounds
+// needs one, to raise the error.  Not wrapped in do/while so that NEXT_SAFEPOINT leaves
+// the bytecode in the switch interpreter too.
+
+#define STORE_INTO(object, index, value) \
+	if ((index) >= totalObjectSize(object)) { \
+		SAFEPOINT(); \
+		raiseSTError (ST_ERROR_CLASS, "Index out of bounds"); \
+		NEXT_SAFEPOINT; \
+	} else { \
+		registerIfNeeded(object, value); \
+		instVarAtInt(object, index) = (value); \
+	}
+
 void interpret(void)
 {
 	suspended = 0;
@@ -888,9 +2071,42 @@ int basicInterpret (int maxBytecodes)
 	suspended = 0;
 	breakpointHit = FALSE;
 	errorString[0] = '\0';
+	clearInterrupt(INTERRUPT_BREAKPOINT | INTERRUPT_SUSPEND | INTERRUPT_ERROR);
 	oop junk;
 
-	eventWaitingFlag = maxBytecodes > 0;
+	// When single stepping or tracing, every bytecode goes through the checks at the
+	// bottom of the loop.  Otherwise only the safepoints do.
+	int checkEveryBytecode = (maxBytecodes > 0) || tracing;
+
+	if (maxBytecodes > 0)
+		quickeningSuspended = TRUE;
+
+#ifdef THREADED_INTERPRETER
+	static void *opcodeTable[256] = {
+		&&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07, &&op_0x08, &&op_0x09, &&op_0x0a, &&op_0x0b, &&op_0x0c, &&op_0x0d, &&op_0x0e, &&op_0x0f,
+		&&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17, &&op_0x18, &&op_0x19, &&op_0x1a, &&op_0x1b, &&op_0x1c, &&op_0x1d, &&op_0x1e, &&op_0x1f,
+		&&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27, &&op_0x28, &&op_0x29, &&op_0x2a, &&op_0x2b, &&op_0x2c, &&op_0x2d, &&op_0x2e, &&op_0x2f,
+		&&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37, &&op_0x38, &&op_0x39, &&op_0x3a, &&op_0x3b, &&op_0x3c, &&op_0x3d, &&op_0x3e, &&op_0x3f,
+		&&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47, &&op_0x48, &&op_0x49, &&op_0x4a, &&op_0x4b, &&op_0x4c, &&op_0x4d, &&op_0x4e, &&op_0x4f,
+		&&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57, &&op_0x58, &&op_0x59, &&op_0x5a, &&op_0x5b, &&op_0x5c, &&op_0x5d, &&op_0x5e, &&op_0x5f,
+		&&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67, &&op_0x68, &&op_0x69, &&op_0x6a, &&op_0x6b, &&op_0x6c, &&op_0x6d, &&op_0x6e, &&op_0x6f,
+		&&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77, &&op_0x78, &&op_0x79, &&op_0x7a, &&op_0x7b, &&op_0x7c, &&op_0x7d, &&op_0x7e, &&op_0x7f,
+		&&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87, &&op_0x88, &&op_0x89, &&op_0x8a, &&op_0x8b, &&op_0x8c, &&op_0x8d, &&op_0x8e, &&op_0x8f,
+		&&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97, &&op_0x98, &&op_0x99, &&op_0x9a, &&op_0x9b, &&op_0x9c, &&op_0x9d, &&op_0x9e, &&op_0x9f,
+		&&op_0xa0, &&op_0xa1, &&op_0xa2, &&op_0xa3, &&op_0xa4, &&op_0xa5, &&op_0xa6, &&op_0xa7, &&op_0xa8, &&op_0xa9, &&op_0xaa, &&op_0xab, &&op_0xac, &&op_0xad, &&op_0xae, &&op_default,
+		&&op_0xb0, &&op_0xb1, &&op_0xb2, &&op_0xb3, &&op_0xb4, &&op_0xb5, &&op_0xb6, &&op_0xb7, &&op_0xb8, &&op_0xb9, &&op_0xba, &&op_0xbb, &&op_0xbc, &&op_0xbd, &&op_0xbe, &&op_default,
+		&&op_0xc0, &&op_0xc1, &&op_0xc2, &&op_0xc3, &&op_0xc4, &&op_0xc5, &&op_0xc6, &&op_0xc7, &&op_0xc8, &&op_0xc9, &&op_0xca, &&op_0xcb, &&op_0xcc, &&op_0xcd, &&op_0xce, &&op_0xcf,
+		&&op_0xd0, &&op_0xd1, &&op_0xd2, &&op_0xd3, &&op_0xd4, &&op_0xd5, &&op_0xd6, &&op_0xd7, &&op_0xd8, &&op_0xd9, &&op_0xda, &&op_0xdb, &&op_0xdc, &&op_0xdd, &&op_0xde, &&op_0xdf,
+		&&op_0xe0, &&op_0xe1, &&op_0xe2, &&op_0xe3, &&op_0xe4, &&op_0xe5, &&op_0xe6, &&op_0xe7, &&op_0xe8, &&op_0xe9, &&op_0xea, &&op_0xeb, &&op_0xec, &&op_0xed, &&op_0xee, &&op_0xef,
+		&&op_0xf0, &&op_0xf1, &&op_0xf2, &&op_0xf3, &&op_0xf4, &&op_0xf5, &&op_0xf6, &&op_0xf7, &&op_0xf8, &&op_0xf9, &&op_0xfa, &&op_0xfb, &&op_0xfc, &&op_0xfd, &&op_0xfe, &&op_0xff
+	};
+
+	oop *sp;
+	uint8_t *pc;
+	oop *locals;
+	oop *literals;
+	oop *receiverBody;
+#endif
 
 	while (1) {
 		uint8_t bytecode;
@@ -902,617 +2118,809 @@ int basicInterpret (int maxBytecodes)
 			printf ("\n=== %s\n\n", logString);
 		}
 
-		if (asContext(currentContext)->method == ST_NIL) {
+		if (asFrame(currentContext)->method == ST_NIL) {
 			simlog ("Exitted\n");
 			return TRUE;
 		}
 
-		bytecode = nextBytecode();
+		LOAD_STATE();
 
-		switch (bytecode)
-		{
-		case 0x00: //  push inst var 0
-		case 0x01: //  push inst var 1
-		case 0x02: //  push inst var 2
-		case 0x03: //  push inst var 3
-		case 0x04: //  push inst var 4
-		case 0x05: //  push inst var 5
-		case 0x06: //  push inst var 6
-		case 0x07: //  push inst var 7
-		case 0x08: //  push inst var 8
-		case 0x09: //  push inst var 9
-		case 0x0a: //  push inst var 10
-		case 0x0b: //  push inst var 11
-		case 0x0c: //  push inst var 12
-		case 0x0d: //  push inst var 13
-		case 0x0e: //  push inst var 14
-		case 0x0f:  //  push inst var 15
-			push (instVarAtInt(getReceiver(),bytecode));
-			break;
+#ifdef JIT
+		// Run native code from here up to the next bytecode it can't handle, which we
+		// then interpret.  Native code is never entered while stepping or tracing.
+		if (!checkEveryBytecode && (stopFrame == ST_NIL) && isJitted(getBytecodes(asFrame(currentContext)->method))) {
+			oop bytecodesOop = getBytecodes(asFrame(currentContext)->method);
+			uint8_t *base = (uint8_t *) objectBody(bytecodesOop);
+			void *entry = jitEntryFor(bytecodesOop, pc - base);
 
-		case 0x10:  //  store inst var 0
-		case 0x11:  //  store inst var 1
-		case 0x12:  //  store inst var 2
-		case 0x13:  //  store inst var 3
-		case 0x14:  //  store inst var 4
-		case 0x15:  //  store inst var 5
-		case 0x16:  //  store inst var 6
-		case 0x17:  //  store inst var 7
-		case 0x18:  //  store inst var 8
-		case 0x19:  //  store inst var 9
-		case 0x1a:  //  store inst var 10
-		case 0x1b:  //  store inst var 11
-		case 0x1c:  //  store inst var 12
-		case 0x1d:  //  store inst var 13
-		case 0x1e:  //  store inst var 14
-		case 0x1f:  //  store inst var 15
-		{
-			oop value = top ();
-			instVarAtIntPut(getReceiver(), bytecode & 0x0f, value);
-			break;
+			if (entry != NULL) {
+				jitStateStruct jitState = {sp, locals, literals, receiverBody};
+				pc = base + jitRun(entry, &jitState);
+				sp = jitState.sp;
+			}
 		}
+#endif
 
-		case 0x20:  //  push local 1
-		case 0x21:  //  push local 2
-		case 0x22:  //  push local 3
-		case 0x23:  //  push local 4
-		case 0x24:  //  push local 5
-		case 0x25:  //  push local 6
-		case 0x26:  //  push local 7
-		case 0x27:  //  push local 8
-		case 0x28:  //  push local 9
-		case 0x29:  //  push local 10
-		case 0x2a:  //  push local 11
-		case 0x2b:  //  push local 12
-		case 0x2c:  //  push local 13
-		case 0x2d:  //  push local 14
-		case 0x2e:  //  push local 15
-		case 0x2f:  //  push local 16
-			push (getLocal( bytecode & 0x0f));
-			break;
-
-		case 0x30:  //  store local 1
-		case 0x31:  //  store local 2
-		case 0x32:  //  store local 3
-		case 0x33:  //  store local 4
-		case 0x34:  //  store local 5
-		case 0x35:  //  store local 6
-		case 0x36:  //  store local 7
-		case 0x37:  //  store local 8
-		case 0x38:  //  store local 9
-		case 0x39:  //  store local 10
-		case 0x3a:  //  store local 11
-		case 0x3b:  //  store local 12
-		case 0x3c:  //  store local 13
-		case 0x3d:  //  store local 14
-		case 0x3e:  //  store local 15
-		case 0x3f:  //  store local 16
-			setLocal( bytecode & 0x0f, top ());
-			break;
-
-		case 0x40: //  push static 1
-		case 0x41: //  push static 2
-		case 0x42: //  push static 3
-		case 0x43: //  push static 4
-		case 0x44: //  push static 5
-		case 0x45: //  push static 6
-		case 0x46: //  push static 7
-		case 0x47: //  push static 8
-		case 0x48: //  push static 9
-		case 0x49: //  push static 10
-		case 0x4a: //  push static 11
-		case 0x4b: //  push static 12
-		case 0x4c: //  push static 13
-		case 0x4d: //  push static 14
-		case 0x4e: //  push static 15
-		case 0x4f: //  push static 16
-			push (asAssociation(getLiteral(asContext(currentContext)->method, bytecode & 0x0f))->value);
-			break;
+		bytecode = FETCH_BYTECODE();
 
+		DISPATCH_ON(bytecode)
+		{
+		BYTECODE(0x00) //  push inst var 0
+		BYTECODE(0x01) //  push inst var 1
+		BYTECODE(0x02) //  push inst var 2
+		BYTECODE(0x03) //  push inst var 3
+		BYTECODE(0x04) //  push inst var 4
+		BYTECODE(0x05) //  push inst var 5
+		BYTECODE(0x06) //  push inst var 6
+		BYTECODE(0x07) //  push inst var 7
+		BYTECODE(0x08) //  push inst var 8
+		BYTECODE(0x09) //  push inst var 9
+		BYTECODE(0x0a) //  push inst var 10
+		BYTECODE(0x0b) //  push inst var 11
+		BYTECODE(0x0c) //  push inst var 12
+		BYTECODE(0x0d) //  push inst var 13
+		BYTECODE(0x0e) //  push inst var 14
+		BYTECODE(0x0f)  //  push inst var 15
+			PUSH (RECEIVER_INST_VAR(bytecode));
+			NEXT;
+
+		BYTECODE(0x10)  //  store inst var 0
+		BYTECODE(0x11)  //  store inst var 1
+		BYTECODE(0x12)  //  store inst var 2
+		BYTECODE(0x13)  //  store inst var 3
+		BYTECODE(0x14)  //  store inst var 4
+		BYTECODE(0x15)  //  store inst var 5
+		BYTECODE(0x16)  //  store inst var 6
+		BYTECODE(0x17)  //  store inst var 7
+		BYTECODE(0x18)  //  store inst var 8
+		BYTECODE(0x19)  //  store inst var 9
+		BYTECODE(0x1a)  //  store inst var 10
+		BYTECODE(0x1b)  //  store inst var 11
+		BYTECODE(0x1c)  //  store inst var 12
+		BYTECODE(0x1d)  //  store inst var 13
+		BYTECODE(0x1e)  //  store inst var 14
+		BYTECODE(0x1f)  //  store inst var 15
+		{
+			oop receiver = RECEIVER();
+			oop value = TOP ();
+			STORE_INTO(receiver, bytecode & 0x0f, value);
+			NEXT;
+		}
 
-		case 0x50: //  store static 1
-		case 0x51: //  store static 2
-		case 0x52: //  store static 3
-		case 0x53: //  store static 4
-		case 0x54: //  store static 5
-		case 0x55: //  store static 6
-		case 0x56: //  store static 7
-		case 0x57: //  store static 8
-		case 0x58: //  store static 9
-		case 0x59: //  store static 10
-		case 0x5a: //  store static 11
-		case 0x5b: //  store static 12
-		case 0x5c: //  store static 13
-		case 0x5d: //  store static 14
-		case 0x5e: //  store static 15
-		case 0x5f: //  store static 16
+		BYTECODE(0x20)  //  push local 1
+		BYTECODE(0x21)  //  push local 2
+		BYTECODE(0x22)  //  push local 3
+		BYTECODE(0x23)  //  push local 4
+		BYTECODE(0x24)  //  push local 5
+		BYTECODE(0x25)  //  push local 6
+		BYTECODE(0x26)  //  push local 7
+		BYTECODE(0x27)  //  push local 8
+		BYTECODE(0x28)  //  push local 9
+		BYTECODE(0x29)  //  push local 10
+		BYTECODE(0x2a)  //  push local 11
+		BYTECODE(0x2b)  //  push local 12
+		BYTECODE(0x2c)  //  push local 13
+		BYTECODE(0x2d)  //  push local 14
+		BYTECODE(0x2e)  //  push local 15
+		BYTECODE(0x2f)  //  push local 16
+			PUSH (LOCAL( bytecode & 0x0f));
+			NEXT;
+
+		BYTECODE(0x30)  //  store local 1
+		BYTECODE(0x31)  //  store local 2
+		BYTECODE(0x32)  //  store local 3
+		BYTECODE(0x33)  //  store local 4
+		BYTECODE(0x34)  //  store local 5
+		BYTECODE(0x35)  //  store local 6
+		BYTECODE(0x36)  //  store local 7
+		BYTECODE(0x37)  //  store local 8
+		BYTECODE(0x38)  //  store local 9
+		BYTECODE(0x39)  //  store local 10
+		BYTECODE(0x3a)  //  store local 11
+		BYTECODE(0x3b)  //  store local 12
+		BYTECODE(0x3c)  //  store local 13
+		BYTECODE(0x3d)  //  store local 14
+		BYTECODE(0x3e)  //  store local 15
+		BYTECODE(0x3f)  //  store local 16
+			STORE_LOCAL( bytecode & 0x0f, TOP ());
+			NEXT;
+
+		BYTECODE(0x40) //  push static 1
+		BYTECODE(0x41) //  push static 2
+		BYTECODE(0x42) //  push static 3
+		BYTECODE(0x43) //  push static 4
+		BYTECODE(0x44) //  push static 5
+		BYTECODE(0x45) //  push static 6
+		BYTECODE(0x46) //  push static 7
+		BYTECODE(0x47) //  push static 8
+		BYTECODE(0x48) //  push static 9
+		BYTECODE(0x49) //  push static 10
+		BYTECODE(0x4a) //  push static 11
+		BYTECODE(0x4b) //  push static 12
+		BYTECODE(0x4c) //  push static 13
+		BYTECODE(0x4d) //  push static 14
+		BYTECODE(0x4e) //  push static 15
+		BYTECODE(0x4f) //  push static 16
+			PUSH (asAssociation(LITERAL(bytecode & 0x0f))->value);
+			NEXT;
+
+
+		BYTECODE(0x50) //  store static 1
+		BYTECODE(0x51) //  store static 2
+		BYTECODE(0x52) //  store static 3
+		BYTECODE(0x53) //  store static 4
+		BYTECODE(0x54) //  store static 5
+		BYTECODE(0x55) //  store static 6
+		BYTECODE(0x56) //  store static 7
+		BYTECODE(0x57) //  store static 8
+		BYTECODE(0x58) //  store static 9
+		BYTECODE(0x59) //  store static 10
+		BYTECODE(0x5a) //  store static 11
+		BYTECODE(0x5b) //  store static 12
+		BYTECODE(0x5c) //  store static 13
+		BYTECODE(0x5d) //  store static 14
+		BYTECODE(0x5e) //  store static 15
+		BYTECODE(0x5f) //  store static 16
 		{
-			oop association = getLiteral(asContext(currentContext)->method, bytecode & 0x0f);
-			asAssociation(association)->value = top ();
+			oop association = LITERAL(bytecode & 0x0f);
+			asAssociation(association)->value = TOP ();
 			registerIfNeeded (association, asAssociation(association)->value);
-			break;
+			NEXT;
 		}
 
-		case 0x60:  //  push 1
-		case 0x61:  //  push 2
-		case 0x62:  //  push 3
-		case 0x63:  //  push 4
-		case 0x64:  //  push 5
-		case 0x65:  //  push 6
-		case 0x66:  //  push 7
-		case 0x67:  //  push 8
-		case 0x68:  //  push 9
-		case 0x69:  //  push 10
-		case 0x6a:  //  push 11
-		case 0x6b:  //  push 12
-		case 0x6c:  //  push 13
-		case 0x6d:  //  push 14
-		case 0x6e:  //  push 15
-		case 0x6f:  //  push 16
-			push (cIntToST((bytecode & 0x0f) + 1));
-			break;
-
-		case 0x70:  //  push 0
-		case 0x71:  //  push -1
-		case 0x72:  //  push -2
-		case 0x73:  //  push -3
-		case 0x74:  //  push -4
-		case 0x75:  //  push -5
-		case 0x76:  //  push -6
-		case 0x77:  //  push -7
-		case 0x78:  //  push -8
-		case 0x79:  //  push -9
-		case 0x7a:  //  push -10
-		case 0x7b:  //  push -11
-		case 0x7c:  //  push -12
-		case 0x7d:  //  push -13
-		case 0x7e:  //  push -14
-		case 0x7f:  //  push -15
-			push (cIntToST(-(bytecode & 0x0f)));
-			break;
-
-		case 0x80: //  push literal 1
-		case 0x81: //  push literal 2
-		case 0x82: //  push literal 3
-		case 0x83: //  push literal 4
-		case 0x84: //  push literal 5
-		case 0x85: //  push literal 6
-		case 0x86: //  push literal 7
-		case 0x87: //  push literal 8
-		case 0x88: //  push literal 9
-		case 0x89: //  push literal 10
-		case 0x8a: //  push literal 11
-		case 0x8b: //  push literal 12
-		case 0x8c: //  push literal 13
-		case 0x8d: //  push literal 14
-		case 0x8e: //  push literal 15
-		case 0x8f: //  push literal 16
-			push (getLiteral(asContext(currentContext)->method, bytecode & 0x0f));
-			break;
-
-		case 0x90:  //  push true
-			push (ST_TRUE);
-			break;
-
-		case 0x91:  //  push false
-			push (ST_FALSE);
-			break;
-
-		case 0x92:  //  push nil
-			push (ST_NIL);
-			break;
-
-		case 0x93:  //  push self
-			push (getReceiver());
-			break;
-
-		case 0x94: //  push inst var
+		BYTECODE(0x60)  //  push 1
+		BYTECODE(0x61)  //  push 2
+		BYTECODE(0x62)  //  push 3
+		BYTECODE(0x63)  //  push 4
+		BYTECODE(0x64)  //  push 5
+		BYTECODE(0x65)  //  push 6
+		BYTECODE(0x66)  //  push 7
+		BYTECODE(0x67)  //  push 8
+		BYTECODE(0x68)  //  push 9
+		BYTECODE(0x69)  //  push 10
+		BYTECODE(0x6a)  //  push 11
+		BYTECODE(0x6b)  //  push 12
+		BYTECODE(0x6c)  //  push 13
+		BYTECODE(0x6d)  //  push 14
+		BYTECODE(0x6e)  //  push 15
+		BYTECODE(0x6f)  //  push 16
+			PUSH (cIntToST((bytecode & 0x0f) + 1));
+			NEXT;
+
+		BYTECODE(0x70)  //  push 0
+		BYTECODE(0x71)  //  push -1
+		BYTECODE(0x72)  //  push -2
+		BYTECODE(0x73)  //  push -3
+		BYTECODE(0x74)  //  push -4
+		BYTECODE(0x75)  //  push -5
+		BYTECODE(0x76)  //  push -6
+		BYTECODE(0x77)  //  push -7
+		BYTECODE(0x78)  //  push -8
+		BYTECODE(0x79)  //  push -9
+		BYTECODE(0x7a)  //  push -10
+		BYTECODE(0x7b)  //  push -11
+		BYTECODE(0x7c)  //  push -12
+		BYTECODE(0x7d)  //  push -13
+		BYTECODE(0x7e)  //  push -14
+		BYTECODE(0x7f)  //  push -15
+			PUSH (cIntToST(-(bytecode & 0x0f)));
+			NEXT;
+
+		BYTECODE(0x80) //  push literal 1
+		BYTECODE(0x81) //  push literal 2
+		BYTECODE(0x82) //  push literal 3
+		BYTECODE(0x83) //  push literal 4
+		BYTECODE(0x84) //  push literal 5
+		BYTECODE(0x85) //  push literal 6
+		BYTECODE(0x86) //  push literal 7
+		BYTECODE(0x87) //  push literal 8
+		BYTECODE(0x88) //  push literal 9
+		BYTECODE(0x89) //  push literal 10
+		BYTECODE(0x8a) //  push literal 11
+		BYTECODE(0x8b) //  push literal 12
+		BYTECODE(0x8c) //  push literal 13
+		BYTECODE(0x8d) //  push literal 14
+		BYTECODE(0x8e) //  push literal 15
+		BYTECODE(0x8f) //  push literal 16
+			PUSH (LITERAL(bytecode & 0x0f));
+			NEXT;
+
+		BYTECODE(0x90)  //  push true
+			PUSH (ST_TRUE);
+			NEXT;
+
+		BYTECODE(0x91)  //  push false
+			PUSH (ST_FALSE);
+			NEXT;
+
+		BYTECODE(0x92)  //  push nil
+			PUSH (ST_NIL);
+			NEXT;
+
+		BYTECODE(0x93)  //  push self
+			PUSH (RECEIVER());
+			NEXT;
+
+		BYTECODE(0x94) //  push inst var
 		{
-			uint8_t instVarNumber = nextBytecode();
-			push (instVarAtInt(getReceiver(),instVarNumber));
+			uint8_t instVarNumber = FETCH_BYTECODE();
+			PUSH (RECEIVER_INST_VAR(instVarNumber));
 		}
-		break;
+		NEXT;
 
-		case 0x95: //  push inst var extended
+		BYTECODE(0x95) //  push inst var extended
 		{
-			uint16_t instVarNumber = nextBytecode() * 256 + nextBytecode();
-			push (instVarAtInt(getReceiver(),instVarNumber));
+			uint8_t instVarNumberHigh = FETCH_BYTECODE();
+			uint8_t instVarNumberLow = FETCH_BYTECODE();
+			uint16_t instVarNumber = instVarNumberHigh * 256 + instVarNumberLow;
+			PUSH (RECEIVER_INST_VAR(instVarNumber));
 		}
-		break;
+		NEXT;
 
-		case 0x96: //  push local
+		BYTECODE(0x96) //  push local
 		{
-			uint8_t localNumber = nextBytecode();
-			push (getLocal( localNumber));
+			uint8_t localNumber = FETCH_BYTECODE();
+			PUSH (LOCAL( localNumber));
 		}
-		break;
+		NEXT;
 
-		case 0x97: //  push local extended
+		BYTECODE(0x97) //  push local extended
 		{
-			uint16_t localNumber = nextBytecode() * 256 + nextBytecode();
-			push (getLocal( localNumber));
+			uint8_t localNumberHigh = FETCH_BYTECODE();
+			uint8_t localNumberLow = FETCH_BYTECODE();
+			uint16_t localNumber = localNumberHigh * 256 + localNumberLow;
+			PUSH (LOCAL( localNumber));
 		}
-		break;
+		NEXT;
 
-		case 0x98: //  push local indirect
-		case 0xb7: //  push self instvar indirect
+		BYTECODE(0x98) //  push local indirect
+		BYTECODE(0xb7) //  push self instvar indirect
 		{
-			uint8_t localNumber = nextBytecode();
-			uint8_t varNumber = nextBytecode();
-			oop copiedVariables = getLocal( localNumber);
-			push (instVarAtInt (copiedVariables, varNumber));
+			uint8_t localNumber = FETCH_BYTECODE();
+			uint8_t varNumber = FETCH_BYTECODE();
+			oop copiedVariables = LOCAL( localNumber);
+			PUSH (instVarAtInt (copiedVariables, varNumber));
 		}
-		break;
+		NEXT;
 
-		case 0x99: //  push local indirect extended
-		case 0xb8: //  push self instvar indirect extended
+		BYTECODE(0x99) //  push local indirect extended
+		BYTECODE(0xb8) //  push self instvar indirect extended
 		{
-			uint16_t localNumber = nextBytecode() * 256 + nextBytecode();
-			uint16_t varNumber = nextBytecode() * 256 + nextBytecode();
-			oop copiedVariables = getLocal( localNumber);
-			push (instVarAtInt (copiedVariables, varNumber));
+			uint8_t localNumberHigh = FETCH_BYTECODE();
+			uint8_t localNumberLow = FETCH_BYTECODE();
+			uint16_t localNumber = localNumberHigh * 256 + localNumberLow;
+			uint8_t varNumberHigh = FETCH_BYTECODE();
+			uint8_t varNumberLow = FETCH_BYTECODE();
+			uint16_t varNumber = varNumberHigh * 256 + varNumberLow;
+			oop copiedVariables = LOCAL( localNumber);
+			PUSH (instVarAtInt (copiedVariables, varNumber));
 		}
-		break;
+		NEXT;
 
-		case 0x9a: //  push global
+		BYTECODE(0x9a) //  push global
 		{
-			uint8_t literalNumber = nextBytecode();			
-			push (asAssociation(getLiteral(asContext(currentContext)->method, literalNumber))->value);
+			uint8_t literalNumber = FETCH_BYTECODE();			
+			PUSH (asAssociation(LITERAL(literalNumber))->value);
 		}
-		break;
+		NEXT;
 
-		case 0x9b: //  push global extended
+		BYTECODE(0x9b) //  push global extended
 		{
-			uint16_t literalNumber = nextBytecode() * 256 + nextBytecode();
-			push (asAssociation(getLiteral(asContext(currentContext)->method, literalNumber))->value);
+			uint8_t literalNumberHigh = FETCH_BYTECODE();
+			uint8_t literalNumberLow = FETCH_BYTECODE();
+			uint16_t literalNumber = literalNumberHigh * 256 + literalNumberLow;
+			PUSH (asAssociation(LITERAL(literalNumber))->value);
 		}
-		break;
+		NEXT;
 
-		case 0x9c: //  push literal
+		BYTECODE(0x9c) //  push literal
 		{
-			uint8_t literalNumber = nextBytecode();			
-			push (getLiteral(asContext(currentContext)->method, literalNumber));
+			uint8_t literalNumber = FETCH_BYTECODE();			
+			PUSH (LITERAL(literalNumber));
 		}
-		break;
+		NEXT;
 
-		case 0x9d: //  push literal extended
+		BYTECODE(0x9d) //  push literal extended
 		{
-			uint16_t literalNumber = nextBytecode() * 256 + nextBytecode();
-			push (getLiteral(asContext(currentContext)->method, literalNumber));
+			uint8_t literalNumberHigh = FETCH_BYTECODE();
+			uint8_t literalNumberLow = FETCH_BYTECODE();
+			uint16_t literalNumber = literalNumberHigh * 256 + literalNumberLow;
+			PUSH (LITERAL(literalNumber));
 		}
-		break;
+		NEXT;
 
-		case 0x9e: //  push one byte integer
+		BYTECODE(0x9e) //  push one byte integer
 		{
-			int8_t integer = (int8_t) nextBytecode();
-			push (cIntToST(integer));
+			int8_t integer = (int8_t) FETCH_BYTECODE();
+			PUSH (cIntToST(integer));
 		}
-		break;
+		NEXT;
 
-		case 0x9f: //  push two byte integer
+		BYTECODE(0x9f) //  push two byte integer
 		{
-			int16_t integer = (int16_t) (nextBytecode() * 256 + nextBytecode());
-			push (cIntToST(integer));
+			uint8_t integerHigh = FETCH_BYTECODE();
+			uint8_t integerLow = FETCH_BYTECODE();
+			int16_t integer = (int16_t) (integerHigh * 256 + integerLow);
+			PUSH (cIntToST(integer));
 		}
-		break;
+		NEXT;
 
-		case 0xa0: //  push four byte integer
+		BYTECODE(0xa0) //  push four byte integer
 		{
-			int32_t integer = (int32_t) (
-				nextBytecode() * 16777216
-				+ nextBytecode() * 65536
-				+ nextBytecode() * 256
-				+ nextBytecode());
-			push (cIntToST(integer));
+			uint32_t bytes = FETCH_BYTECODE();
+			bytes = bytes * 256 + FETCH_BYTECODE();
+			bytes = bytes * 256 + FETCH_BYTECODE();
+			bytes = bytes * 256 + FETCH_BYTECODE();
+			int32_t integer = (int32_t) bytes;
+			PUSH (cIntToST(integer));
 		}
-		break;
+		NEXT;
 
-		case 0xa1: //  push copying block
+		BYTECODE(0xa1) //  push copying block
+			SAFEPOINT();
 		{
 			uint8_t literalNumber = nextBytecode();
 			uint8_t numberOfCopiedVariables = nextBytecode();
 			oop compiledBlock;
 			oop blockClosureOop;
-			oop array;
-			int i;
 
 			blockClosureOop = newInstanceOfClass (ST_BLOCK_CLOSURE_CLASS, 0, EdenSpace);
 
-			compiledBlock = getLiteral(asContext(currentContext)->method, literalNumber);
+			compiledBlock = getLiteral(asFrame(currentContext)->method, literalNumber);
 			asBlockClosure(blockClosureOop) -> method = compiledBlock;
 			registerIfNeeded(blockClosureOop, compiledBlock);
 
-			push (blockClosureOop);
-			array = newInstanceOfClass (ST_ARRAY_CLASS, numberOfCopiedVariables, EdenSpace);
-			blockClosureOop = pop ();
-
-			asBlockClosure(blockClosureOop) -> copiedValues = array;
-			registerIfNeeded(blockClosureOop, array);
-
-			for (i=numberOfCopiedVariables ; i > 0 ; i--) {
-				oop object = pop ();
-				indexedVarAtIntPut (array, i, object);
-			}
-
+			blockClosureOop = popCopiedValues(blockClosureOop, numberOfCopiedVariables);
 			push (blockClosureOop);
 		}
-		break;
+		NEXT_RELOADED;
 
-		case 0xa2: //  push full block
+		BYTECODE(0xa2) //  push full block
+			SAFEPOINT();
 		{
 			uint8_t literalNumber = nextBytecode();
 			uint8_t numberOfCopiedVariables = nextBytecode();
 			oop compiledBlock;
 			oop blockClosureOop;
-			oop array;
-			int i;
 
 			blockClosureOop = newInstanceOfClass (ST_BLOCK_CLOSURE_CLASS, 0, EdenSpace);
-			compiledBlock = getLiteral(asContext(currentContext)->method, literalNumber);
+			compiledBlock = getLiteral(asFrame(currentContext)->method, literalNumber);
 			asBlockClosure(blockClosureOop) -> method = compiledBlock;
 			registerIfNeeded(blockClosureOop, compiledBlock);
 
-			if (stripTags(asContext(currentContext) -> methodContext) == ST_NIL)
+			if (stripTags(asFrame(currentContext) -> methodContext) == ST_NIL)
 				asBlockClosure(blockClosureOop) -> methodContext = markAsContextPointer(currentContext);
 			else
-				asBlockClosure(blockClosureOop) -> methodContext = asContext(currentContext)->methodContext;
+				asBlockClosure(blockClosureOop) -> methodContext = asFrame(currentContext)->methodContext;
 
-			push (blockClosureOop);
-			array = newInstanceOfClass (ST_ARRAY_CLASS, numberOfCopiedVariables, EdenSpace);
-			blockClosureOop = pop ();
-			
-			asBlockClosure(blockClosureOop) -> copiedValues = array;
-			registerIfNeeded(blockClosureOop, array);
-
-			for (i=numberOfCopiedVariables ; i > 0 ; i--) {
-				oop object = pop ();
-				indexedVarAtIntPut (array, i, object);
-				}
+			blockClosureOop = popCopiedValues(blockClosureOop, numberOfCopiedVariables);
 			push (blockClosureOop);
 		}
-		break;
+		NEXT_RELOADED;
 
-		case 0xa3: //  store inst var
+		BYTECODE(0xa3) //  store inst var
 			{
-			uint8_t instVarNumber = nextBytecode();		
-			oop value = top ();
-			instVarAtIntPut(getReceiver(), instVarNumber, value);
+			uint8_t instVarNumber = FETCH_BYTECODE();
+			oop receiver = RECEIVER();
+			oop value = TOP ();
+			STORE_INTO(receiver, instVarNumber, value);
 			}			
-			break;
+			NEXT;
 
-		case 0xa4: //  store inst var extended
+		BYTECODE(0xa4) //  store inst var extended
 			{
-			uint16_t instVarNumber = nextBytecode() * 256 + nextBytecode();
-			oop value = top ();
-			instVarAtIntPut(getReceiver(), instVarNumber, value);
+			uint8_t instVarNumberHigh = FETCH_BYTECODE();
+			uint8_t instVarNumberLow = FETCH_BYTECODE();
+			uint16_t instVarNumber = instVarNumberHigh * 256 + instVarNumberLow;
+			oop receiver = RECEIVER();
+			oop value = TOP ();
+			STORE_INTO(receiver, instVarNumber, value);
 			}			
-			break;
+			NEXT;
 
-		case 0xa5: //  store local
+		BYTECODE(0xa5) //  store local
 			{
-			uint8_t instVarNumber = nextBytecode();		
-			setLocal( instVarNumber, top ());
+			uint8_t instVarNumber = FETCH_BYTECODE();		
+			STORE_LOCAL( instVarNumber, TOP ());
 			}			
-			break;
+			NEXT;
 
-		case 0xa6: //  store local extended
+		BYTECODE(0xa6) //  store local extended
 			{
-			uint16_t instVarNumber = nextBytecode() * 256 + nextBytecode();
-			setLocal( instVarNumber, top ());
+			uint8_t instVarNumberHigh = FETCH_BYTECODE();
+			uint8_t instVarNumberLow = FETCH_BYTECODE();
+			uint16_t instVarNumber = instVarNumberHigh * 256 + instVarNumberLow;
+			STORE_LOCAL( instVarNumber, TOP ());
 			}			
-			break;
+			NEXT;
 
-		case 0xa7: //  store local indirect
-		case 0xb9: //  store self instvar indirect
+		BYTECODE(0xa7) //  store local indirect
+		BYTECODE(0xb9) //  store self instvar indirect
 			{
-			uint8_t localNumber = nextBytecode();
-			uint8_t varNumber = nextBytecode();
-			oop copiedVariables = getLocal( localNumber);
+			uint8_t localNumber = FETCH_BYTECODE();
+			uint8_t varNumber = FETCH_BYTECODE();
+			oop copiedVariables = LOCAL( localNumber);
 			if (isImmediate(copiedVariables)) {
+				SAFEPOINT();
 				LOGE("Indirect store into immediate object");
 				dumpWalkback("Indirect store into immediate object");
 				exit(1);
 			}
 			if (totalObjectSize(copiedVariables) < varNumber) {
+				SAFEPOINT();
 				LOGE("Indirect store out of bounds");
 				dumpWalkback("Indirect store out of bounds");
 				exit(1);
 			}
-			oop value = top ();
-			instVarAtIntPut (copiedVariables, varNumber, value);
+			oop value = TOP ();
+			STORE_INTO(copiedVariables, varNumber, value);
 			}
-			break;
+			NEXT;
 
-		case 0xa8: //  store local indirect extended
-		case 0xba: //  store self instvar indirect extended
+		BYTECODE(0xa8) //  store local indirect extended
+		BYTECODE(0xba) //  store self instvar indirect extended
 			{
-			uint16_t localNumber = nextBytecode() * 256 + nextBytecode();
-			uint16_t varNumber = nextBytecode() * 256 + nextBytecode();
-			oop copiedVariables = getLocal( localNumber);
-			oop value = top ();
-			instVarAtIntPut (copiedVariables, varNumber, value);
+			uint8_t localNumberHigh = FETCH_BYTECODE();
+			uint8_t localNumberLow = FETCH_BYTECODE();
+			uint16_t localNumber = localNumberHigh * 256 + localNumberLow;
+			uint8_t varNumberHigh = FETCH_BYTECODE();
+			uint8_t varNumberLow = FETCH_BYTECODE();
+			uint16_t varNumber = varNumberHigh * 256 + varNumberLow;
+			oop copiedVariables = LOCAL( localNumber);
+			oop value = TOP ();
+			STORE_INTO(copiedVariables, varNumber, value);
 			}
-			break;
+			NEXT;
 
 
-		case 0xa9: //  store global
+		BYTECODE(0xa9) //  store global
 			{
-			uint8_t literalNumber = nextBytecode();
-			oop association = getLiteral(asContext(currentContext)->method, literalNumber);
-			asAssociation(association)->value = top ();
+			uint8_t literalNumber = FETCH_BYTECODE();
+			oop association = LITERAL(literalNumber);
+			asAssociation(association)->value = TOP ();
 			registerIfNeeded(association, asAssociation(association)->value);
 			}
-			break;
+			NEXT;
 
-		case 0xaa: //  store global extended
+		BYTECODE(0xaa) //  store global extended
 			{
-			uint16_t literalNumber = nextBytecode() * 256 + nextBytecode();
-			oop association = getLiteral(asContext(currentContext)->method, literalNumber);
-			asAssociation(association)->value = top ();
+			uint8_t literalNumberHigh = FETCH_BYTECODE();
+			uint8_t literalNumberLow = FETCH_BYTECODE();
+			uint16_t literalNumber = literalNumberHigh * 256 + literalNumberLow;
+			oop association = LITERAL(literalNumber);
+			asAssociation(association)->value = TOP ();
 			registerIfNeeded(association, asAssociation(association)->value);
 			}
-			break;
+			NEXT;
 
-		case 0xab:  //  store new array
+		BYTECODE(0xab)  //  store new array
+			SAFEPOINT();
 		{
 			uint8_t numberOfCopiedVariables = nextBytecode();
 			uint8_t localNumber = nextBytecode();
 			oop array = newInstanceOfClass (ST_ARRAY_CLASS, numberOfCopiedVariables, EdenSpace);
 			setLocal( localNumber, array);
 		}
-		break;
+		NEXT_RELOADED;
 
-		case 0xac: //  pop
-			pop ();
-			break;
+		BYTECODE(0xac) //  pop
+			(void) POP ();
+			NEXT;
 
-		case 0xad: //  dup
-			push (top ());
-			break;
+		BYTECODE(0xad) //  dup
+		{
+			oop value = TOP ();
+			PUSH (value);
+		}
+		NEXT;
 
-		case 0xae: //  dropCascadeReceiver
+		BYTECODE(0xae) //  dropCascadeReceiver
 		{
-			oop value = pop ();
-			pop ();
-			push (value);
+			oop value = POP ();
+			(void) POP ();
+			PUSH (value);
 		}
-		break;
+		NEXT;
 
-		case 0xb0: //  jump
+		BYTECODE(0xb0) //  jump
 		{
-			int8_t offset = nextBytecode();
-			jump( offset);
+			int8_t offset = FETCH_BYTECODE();
+			JUMP( offset);
+			if (offset < 0) {
+				countHotMethod(asFrame(currentContext)->method, TRUE);
+				NEXT_CHECKED;
+			}
 		}
-		break;
+		NEXT;
 
-		case 0xb1: //  jump extended
+		BYTECODE(0xb1) //  jump extended
 		{
-			int16_t offset = nextBytecode() * 256 + nextBytecode();
-			jump( offset);
+			uint8_t offsetHigh = FETCH_BYTECODE();
+			uint8_t offsetLow = FETCH_BYTECODE();
+			int16_t offset = (int16_t) (offsetHigh * 256 + offsetLow);
+			JUMP( offset);
+			if (offset < 0) {
+				countHotMethod(asFrame(currentContext)->method, TRUE);
+				NEXT_CHECKED;
+			}
 		}
-		break;
+		NEXT;
 
-		case 0xb2: //  jump if true
+		BYTECODE(0xb2) //  jump if true
 		{
-			int8_t offset = nextBytecode();
-			if (pop () == ST_TRUE)
-				jump( offset);
-			break;
+			int8_t offset = FETCH_BYTECODE();
+			if (POP () == ST_TRUE) {
+				JUMP( offset);
+				if (offset < 0) {
+					countHotMethod(asFrame(currentContext)->method, TRUE);
+					NEXT_CHECKED;
+				}
+			}
+			NEXT;
 		}	
-		case 0xb3: //  jump if true extended
+		BYTECODE(0xb3) //  jump if true extended
 		{
-			int16_t offset = nextBytecode() * 256 + nextBytecode();
-			if (pop () == ST_TRUE)
-				jump( offset);
-			break;
+			uint8_t offsetHigh = FETCH_BYTECODE();
+			uint8_t offsetLow = FETCH_BYTECODE();
+			int16_t offset = (int16_t) (offsetHigh * 256 + offsetLow);
+			if (POP () == ST_TRUE) {
+				JUMP( offset);
+				if (offset < 0) {
+					countHotMethod(asFrame(currentContext)->method, TRUE);
+					NEXT_CHECKED;
+				}
+			}
+			NEXT;
 		}
-		break;
+		NEXT;
 
-		case 0xb4: //  jump if false
+		BYTECODE(0xb4) //  jump if false
 		{
-			int8_t offset = nextBytecode();
-			if (pop () == ST_FALSE)
-				jump( offset);
-			break;
+			int8_t offset = FETCH_BYTECODE();
+			if (POP () == ST_FALSE) {
+				JUMP( offset);
+				if (offset < 0) {
+					countHotMethod(asFrame(currentContext)->method, TRUE);
+					NEXT_CHECKED;
+				}
+			}
+			NEXT;
 		}	
-		case 0xb5: //  jump if false extended
+		BYTECODE(0xb5) //  jump if false extended
 		{
-			int16_t offset = nextBytecode() * 256 + nextBytecode();
-			if (pop () == ST_FALSE)
-				jump( offset);
-			break;
+			uint8_t offsetHigh = FETCH_BYTECODE();
+			uint8_t offsetLow = FETCH_BYTECODE();
+			int16_t offset = (int16_t) (offsetHigh * 256 + offsetLow);
+			if (POP () == ST_FALSE) {
+				JUMP( offset);
+				if (offset < 0) {
+					countHotMethod(asFrame(currentContext)->method, TRUE);
+					NEXT_CHECKED;
+				}
+			}
+			NEXT;
 		}
-		break;
+		NEXT;
 
-		case 0xb6: // thisContext
+		BYTECODE(0xb6) // thisContext
+			SAFEPOINT();
 			push(contextCopy(currentContext));
-			break;
+			NEXT_RELOADED;
 
-		case 0xc0: //  send literal 1
-		case 0xc1: //  send literal 2
-		case 0xc2: //  send literal 3
-		case 0xc3: //  send literal 4
-		case 0xc4: //  send literal 5
-		case 0xc5: //  send literal 6
-		case 0xc6: //  send literal 7
-		case 0xc7: //  send literal 8
-		case 0xc8: //  send literal 9
-		case 0xc9: //  send literal 10
-		case 0xca: //  send literal 11
-		case 0xcb: //  send literal 12
-		case 0xcc: //  send literal 13
-		case 0xcd: //  send literal 14
-		case 0xce: //  send literal 15
-		case 0xcf: //  send literal 16
+		BYTECODE(0xbb) //  quickened push local; push literal; call well known
+		{
+			uint8_t localBytecode = FETCH_BYTECODE();
+			uint8_t literalBytecode = FETCH_BYTECODE();
+			PUSH (LOCAL(localBytecode & 0x0f));
+			PUSH (LITERAL(literalBytecode & 0x0f));
+		}
+		goto quickenedWellKnown;
+
+		BYTECODE(0xbc) //  quickened push local; push integer; call well known
+		{
+			uint8_t localBytecode = FETCH_BYTECODE();
+			uint8_t integerBytecode = FETCH_BYTECODE();
+			PUSH (LOCAL(localBytecode & 0x0f));
+			if (integerBytecode <= 0x6f)
+				PUSH (cIntToST((integerBytecode & 0x0f) + 1));
+			else
+				PUSH (cIntToST(-(integerBytecode & 0x0f)));
+		}
+		goto quickenedWellKnown;
+
+		BYTECODE(0xbe) //  quickened push local; push local; call well known
+		{
+			uint8_t localBytecode = FETCH_BYTECODE();
+			uint8_t secondLocalBytecode = FETCH_BYTECODE();
+			PUSH (LOCAL(localBytecode & 0x0f));
+			PUSH (LOCAL(secondLocalBytecode & 0x0f));
+		}
+
+quickenedWellKnown:
+		{
+			// SmallInteger arithmetic and comparisons are done here, everything else
+			// (including overflow) goes through callWellKnown.
+
+			oop arg = POP ();
+			oop receiver = POP ();
+			uint8_t selectorNumber = FETCH_BYTECODE();
+			int handled = isSmallInteger(receiver) && isSmallInteger(arg);
+			oop result = ST_NIL;
+
+			if (handled) {
+				int64_t x = stIntToC(receiver);
+				int64_t y = stIntToC(arg);
+				int64_t carry;
+
+				switch (selectorNumber) {
+					case SPECIAL_PLUS:
+						carry = (x + y) & (int64_t)0xF000000000000000L;
+						handled = (carry == 0) || (carry == (int64_t)0xF000000000000000L);
+						result = cIntToST(x + y);
+						break;
+					case SPECIAL_MINUS:
+						carry = (x - y) & (int64_t)0xF000000000000000L;
+						handled = (carry == 0) || (carry == (int64_t)0xF000000000000000L);
+						result = cIntToST(x - y);
+						break;
+					case SPECIAL_IDENTICAL:
+					case SPECIAL_EQUALS:
+						result = (x == y) ? ST_TRUE : ST_FALSE;
+						break;
+					case SPECIAL_NOT_IDENTICAL:
+					case SPECIAL_NOT_EQUALS:
+						result = (x != y) ? ST_TRUE : ST_FALSE;
+						break;
+					case SPECIAL_LESS_THAN:
+						result = (x < y) ? ST_TRUE : ST_FALSE;
+						break;
+					case SPECIAL_GREATER_THAN:
+						result = (x > y) ? ST_TRUE : ST_FALSE;
+						break;
+					case SPECIAL_LESS_THAN_OR_EQUAL:
+						result = (x <= y) ? ST_TRUE : ST_FALSE;
+						break;
+					case SPECIAL_GREATER_THAN_OR_EQUAL:
+						result = (x >= y) ? ST_TRUE : ST_FALSE;
+						break;
+					case SPECIAL_BIT_AND:
+						result = cIntToST(x & y);
+						break;
+					case SPECIAL_BIT_OR:
+						result = cIntToST(x | y);
+						break;
+					case SPECIAL_BIT_XOR:
+						result = cIntToST(x ^ y);
+						break;
+					default:
+						handled = FALSE;
+						break;
+				}
+			}
+
+			if (handled) {
+				COUNT_STATISTIC(vmStatistics.specialSends[selectorNumber]);
+				PUSH (result);
+				NEXT;
+			}
+
+			PUSH (receiver);
+			PUSH (arg);
+			JUMP (-1);
+		}
+		SAFEPOINT();
+		callWellKnown();
+		NEXT_SAFEPOINT;
+
+		BYTECODE(0xbd) //  quickened push inst var; return
+			SAFEPOINT();
+			{
+			uint8_t instVarBytecode = nextBytecode();
+			push (instVarAtInt(getReceiver(), instVarBytecode));
+			if (returnFromContext())
+				NEXT_SAFEPOINT;
+			return TRUE;
+			}
+
+		BYTECODE(0xc0) //  send literal 1
+		BYTECODE(0xc1) //  send literal 2
+		BYTECODE(0xc2) //  send literal 3
+		BYTECODE(0xc3) //  send literal 4
+		BYTECODE(0xc4) //  send literal 5
+		BYTECODE(0xc5) //  send literal 6
+		BYTECODE(0xc6) //  send literal 7
+		BYTECODE(0xc7) //  send literal 8
+		BYTECODE(0xc8) //  send literal 9
+		BYTECODE(0xc9) //  send literal 10
+		BYTECODE(0xca) //  send literal 11
+		BYTECODE(0xcb) //  send literal 12
+		BYTECODE(0xcc) //  send literal 13
+		BYTECODE(0xcd) //  send literal 14
+		BYTECODE(0xce) //  send literal 15
+		BYTECODE(0xcf) //  send literal 16
+			SAFEPOINT();
 			{
 			int numberOfArguments = nextBytecode();
-			dispatch (getLiteral(asContext(currentContext)->method, bytecode & 0x0f), numberOfArguments);
-			break;
+			dispatchSend (getLiteral(asFrame(currentContext)->method, bytecode & 0x0f), numberOfArguments);
+			NEXT_SAFEPOINT;
 			}
 
-		case 0xd0: //  super call literal 1
-		case 0xd1: //  super call literal 2
-		case 0xd2: //  super call literal 3
-		case 0xd3: //  super call literal 4
-		case 0xd4: //  super call literal 5
-		case 0xd5: //  super call literal 6
+		BYTECODE(0xd0) //  super call literal 1
+		BYTECODE(0xd1) //  super call literal 2
+		BYTECODE(0xd2) //  super call literal 3
+		BYTECODE(0xd3) //  super call literal 4
+		BYTECODE(0xd4) //  super call literal 5
+		BYTECODE(0xd5) //  super call literal 6
+			SAFEPOINT();
 		{
 			uint32_t nextByte = nextBytecode();
-			dispatchSuper (getLiteral(asContext(currentContext)->method, bytecode & 0x0f), (uint64_t) nextByte);
-			break;
+			dispatchSuper (getLiteral(asFrame(currentContext)->method, bytecode & 0x0f), (uint64_t) nextByte);
+			NEXT_SAFEPOINT;
 		}
 
-		case 0xd6: //  call well known
+		BYTECODE(0xd6) //  call well known
+			SAFEPOINT();
 			callWellKnown();
-		break;
+		NEXT_SAFEPOINT;
 
-		case 0xd7: //  call literal
+		BYTECODE(0xd7) //  call literal
+			SAFEPOINT();
 			{
 			uint8_t literalNumber = nextBytecode();
 			uint8_t numberOfArguments = nextBytecode();
-			dispatch (getLiteral(asContext(currentContext)->method, literalNumber), numberOfArguments);
+			dispatchSend (getLiteral(asFrame(currentContext)->method, literalNumber), numberOfArguments);
 			}
-			break;
+			NEXT_SAFEPOINT;
 
-		case 0xd8:  //  call literal extended
+		BYTECODE(0xd8)  //  call literal extended
+			SAFEPOINT();
 			{
-			uint16_t literalNumber = nextBytecode() * 256 +  nextBytecode();
+			uint8_t literalNumberHigh = nextBytecode();
+			uint8_t literalNumberLow = nextBytecode();
+			uint16_t literalNumber = literalNumberHigh * 256 + literalNumberLow;
 			uint8_t numberOfArguments = nextBytecode();
-			dispatch (getLiteral(asContext(currentContext)->method, literalNumber), numberOfArguments);
+			dispatchSend (getLiteral(asFrame(currentContext)->method, literalNumber), numberOfArguments);
 			}
-			break;
+			NEXT_SAFEPOINT;
 
-		case 0xd9:  //  super call literal
+		BYTECODE(0xd9)  //  super call literal
+			SAFEPOINT();
 			{
 			uint8_t literalNumber = nextBytecode();
 			uint8_t numberOfArguments = nextBytecode();
- 			dispatchSuper (getLiteral(asContext(currentContext)->method, literalNumber), numberOfArguments);
+ 			dispatchSuper (getLiteral(asFrame(currentContext)->method, literalNumber), numberOfArguments);
 			}
-			break;
+			NEXT_SAFEPOINT;
 
-		case 0xda:  //  super call literal extended
+		BYTECODE(0xda)  //  super call literal extended
+			SAFEPOINT();
 			{
-			uint16_t literalNumber = nextBytecode() * 256 +  nextBytecode();
+			uint8_t literalNumberHigh = nextBytecode();
+			uint8_t literalNumberLow = nextBytecode();
+			uint16_t literalNumber = literalNumberHigh * 256 + literalNumberLow;
 			uint8_t numberOfArguments = nextBytecode();
-			dispatchSuper (getLiteral(asContext(currentContext)->method, literalNumber), numberOfArguments);
+			dispatchSuper (getLiteral(asFrame(currentContext)->method, literalNumber), numberOfArguments);
 			}
-			break;
+			NEXT_SAFEPOINT;
 
-		case 0xdb:  //  primitive call
+		BYTECODE(0xdb)  //  primitive call
+			SAFEPOINT();
 		{
 			uint16_t primitiveNumber = ((uint16_t) nextBytecode()) * 256;
 			primitiveNumber += ((uint16_t) nextBytecode());
 			invokePrimitive(primitiveNumber);
 		}
-		break;
+		NEXT_SAFEPOINT;
 
-		case 0xdc:  //  return
-		case 0xdd:  //  block return
+		BYTECODE(0xdc)  //  return
+		BYTECODE(0xdd)  //  block return
+			SAFEPOINT();
 			if (returnFromContext())
-				break;
+				NEXT_SAFEPOINT;
 			return TRUE;
 
-		case 0xde:  //  non local return
+		BYTECODE(0xde)  //  non local return
+			SAFEPOINT();
 			{
 			oop returnValue;
 			oop closureOop = getReceiver();
@@ -1525,11 +2933,12 @@ int basicInterpret (int maxBytecodes)
 			push (returnValue);
 
 			if (returnFromContext())
-				break;
+				NEXT_SAFEPOINT;
 			return TRUE;
 			}
 
-		case 0xdf:  //  primitive return
+		BYTECODE(0xdf)  //  primitive return
+			SAFEPOINT();
 		{
 			oop tos = pop ();
 			oop result = pop ();
@@ -1537,100 +2946,114 @@ int basicInterpret (int maxBytecodes)
 			if (result == cIntToST(0)) {
 				push (tos);
 				if (returnFromContext())
-					break;
+					NEXT_SAFEPOINT;
 				return TRUE;
 			}
 			else {
 				push (result);
 			}
 		}
-		break;
-
-		case 0xe0: //  send literal 1
-		case 0xe1: //  send literal 2
-		case 0xe2: //  send literal 3
-		case 0xe3: //  send literal 4
-		case 0xe4: //  send literal 5
-		case 0xe5: //  send literal 6
-		case 0xe6: //  send literal 7
-		case 0xe7: //  send literal 8
-		case 0xe8: //  send literal 9
-		case 0xe9: //  send literal 10
-		case 0xea: //  send literal 11
-		case 0xeb: //  send literal 12
-		case 0xec: //  send literal 13
-		case 0xed: //  send literal 14
-		case 0xee: //  send literal 15
-		case 0xef: //  send literal 16
+		NEXT_SAFEPOINT;
+
+		BYTECODE(0xe0) //  send literal 1
+		BYTECODE(0xe1) //  send literal 2
+		BYTECODE(0xe2) //  send literal 3
+		BYTECODE(0xe3) //  send literal 4
+		BYTECODE(0xe4) //  send literal 5
+		BYTECODE(0xe5) //  send literal 6
+		BYTECODE(0xe6) //  send literal 7
+		BYTECODE(0xe7) //  send literal 8
+		BYTECODE(0xe8) //  send literal 9
+		BYTECODE(0xe9) //  send literal 10
+		BYTECODE(0xea) //  send literal 11
+		BYTECODE(0xeb) //  send literal 12
+		BYTECODE(0xec) //  send literal 13
+		BYTECODE(0xed) //  send literal 14
+		BYTECODE(0xee) //  send literal 15
+		BYTECODE(0xef) //  send literal 16
+			SAFEPOINT();
 			{
 			int numberOfArguments = nextBytecode();
-			dispatch (getLiteral(asContext(currentContext)->method, bytecode & 0x0f), numberOfArguments);
-			break;
+			dispatchSend (getLiteral(asFrame(currentContext)->method, bytecode & 0x0f), numberOfArguments);
+			NEXT_SAFEPOINT;
 			}
 
-		case 0xf0: //  super call literal 1
-		case 0xf1: //  super call literal 2
-		case 0xf2: //  super call literal 3
-		case 0xf3: //  super call literal 4
-		case 0xf4: //  super call literal 5
-		case 0xf5: //  super call literal 6
+		BYTECODE(0xf0) //  super call literal 1
+		BYTECODE(0xf1) //  super call literal 2
+		BYTECODE(0xf2) //  super call literal 3
+		BYTECODE(0xf3) //  super call literal 4
+		BYTECODE(0xf4) //  super call literal 5
+		BYTECODE(0xf5) //  super call literal 6
+			SAFEPOINT();
 		{
 			uint32_t nextByte = nextBytecode();
-			dispatchSuper (getLiteral(asContext(currentContext)->method, bytecode & 0x0f), (uint64_t) nextByte);
-			break;
+			dispatchSuper (getLiteral(asFrame(currentContext)->method, bytecode & 0x0f), (uint64_t) nextByte);
+			NEXT_SAFEPOINT;
 		}
 
-		case 0xf6: //  call well known
+		BYTECODE(0xf6) //  call well known
+			SAFEPOINT();
 			callWellKnown();
-		break;
+		NEXT_SAFEPOINT;
 
-		case 0xf7: //  call literal
+		BYTECODE(0xf7) //  call literal
+			SAFEPOINT();
 			{
 			uint8_t literalNumber = nextBytecode();
 			uint8_t numberOfArguments = nextBytecode();
-			dispatch (getLiteral(asContext(currentContext)->method, literalNumber), numberOfArguments);
+			dispatchSend (getLiteral(asFrame(currentContext)->method, literalNumber), numberOfArguments);
 			}
-			break;
+			NEXT_SAFEPOINT;
 
-		case 0xf8:  //  call literal extended
+		BYTECODE(0xf8)  //  call literal extended
+			SAFEPOINT();
 			{
-			uint16_t literalNumber = nextBytecode() * 256 +  nextBytecode();
+			uint8_t literalNumberHigh = nextBytecode();
+			uint8_t literalNumberLow = nextBytecode();
+			uint16_t literalNumber = literalNumberHigh * 256 + literalNumberLow;
 			uint8_t numberOfArguments = nextBytecode();
-			dispatch (getLiteral(asContext(currentContext)->method, literalNumber), numberOfArguments);
+			dispatchSend (getLiteral(asFrame(currentContext)->method, literalNumber), numberOfArguments);
 			}
-			break;
+			NEXT_SAFEPOINT;
 
-		case 0xf9:  //  super call literal
+		BYTECODE(0xf9)  //  super call literal
+			SAFEPOINT();
 			{
 			uint8_t literalNumber = nextBytecode();
 			uint8_t numberOfArguments = nextBytecode();
- 			dispatchSuper (getLiteral(asContext(currentContext)->method, literalNumber), numberOfArguments);
+ 			dispatchSuper (getLiteral(asFrame(currentContext)->method, literalNumber), numberOfArguments);
 			}
-			break;
+			NEXT_SAFEPOINT;
 
-		case 0xfa:  //  super call literal extended
+		BYTECODE(0xfa)  //  super call literal extended
+			SAFEPOINT();
 			{
-			uint16_t literalNumber = nextBytecode() * 256 +  nextBytecode();
+			uint8_t literalNumberHigh = nextBytecode();
+			uint8_t literalNumberLow = nextBytecode();
+			uint16_t literalNumber = literalNumberHigh * 256 + literalNumberLow;
 			uint8_t numberOfArguments = nextBytecode();
-			dispatchSuper (getLiteral(asContext(currentContext)->method, literalNumber), numberOfArguments);
+			dispatchSuper (getLiteral(asFrame(currentContext)->method, literalNumber), numberOfArguments);
 			}
-			break;
+			NEXT_SAFEPOINT;
 
-		case 0xfb:  //  primitive call
+		BYTECODE(0xfb)  //  primitive call
+			SAFEPOINT();
 		{
 			uint16_t primitiveNumber = ((uint16_t) nextBytecode()) * 256;
 			primitiveNumber += ((uint16_t) nextBytecode());
 			invokePrimitive(primitiveNumber);
 		}
-		break;
+		NEXT_SAFEPOINT;
 
-		case 0xfc:  //  return
-		case 0xfd:  //  block return
+		BYTECODE(0xfc)  //  return
+		BYTECODE(0xfd)  //  block return
+			SAFEPOINT();
 			if (returnFromContext())
-				break;
+				NEXT_SAFEPOINT;
 			return TRUE;
 
-		case 0xfe:  //  non local return
+		BYTECODE(0xfe)  //  non local return
+			SAFEPOINT();
 			{
 			oop returnValue;
 			oop closureOop = getReceiver();
@@ -1643,11 +3066,12 @@ int basicInterpret (int maxBytecodes)
 			push (returnValue);
 
 			if (returnFromContext())
-				break;
+				NEXT_SAFEPOINT;
 			return TRUE;
 			}
 
-		case 0xff:  //  primitive return
+		BYTECODE(0xff)  //  primitive return
+			SAFEPOINT();
 		{
 			oop tos = pop ();
 			oop result = pop ();
@@ -1655,45 +3079,77 @@ int basicInterpret (int maxBytecodes)
 			if (result == cIntToST(0)) {
 				push (tos);
 				if (returnFromContext())
-					break;
+					NEXT_SAFEPOINT;
 				return TRUE;
 			}
 			else {
 				push (result);
 			}
 		}
-		break;
+		NEXT_SAFEPOINT;
 
-		default:
+		BYTECODE_DEFAULT
+			SAFEPOINT();
 			LOGE ("Bad bytecode: %x\n", bytecode);
 			return FALSE;
 		}
 
+#ifdef THREADED_INTERPRETER
+checkEvents:
+		SAFEPOINT();
+checkEventsAtSafepoint:
+#endif
 		if (currentContext == stopFrame){
 			return TRUE;
 		}
 
-	   if (eventWaitingFlag) {
-			if (breakpointHit) {
+		if (maxBytecodes > 0) {
+			count++;
+			if (count == maxBytecodes) {
+				return TRUE;
+			}
+		}
+
+		if (interruptPending) {
+			if (interruptPending & INTERRUPT_BREAKPOINT) {
 				LOGI ("breakpoint hit");
 				startupDebugger();
 				return TRUE;
 			}
 
-			if (maxBytecodes > 0) {
-				count++;
-				if (count == maxBytecodes) {
-					return TRUE;
-				}
+			if (interruptPending & (INTERRUPT_SUSPEND | INTERRUPT_ERROR))
+				return TRUE;
+
+			if (interruptPending & INTERRUPT_EVENT) {
+				clearInterrupt(INTERRUPT_EVENT);
+				if (pollForEvents != NULL)
+					pollForEvents();
 			}
 
-			if (suspended != 0) {
-			return TRUE;
+			if (interruptPending & INTERRUPT_PROFILE) {
+				clearInterrupt(INTERRUPT_PROFILE);
+				profileSample();
+			}
+
+			if (interruptPending & INTERRUPT_GARBAGE_COLLECT) {
+				clearInterrupt(INTERRUPT_GARBAGE_COLLECT);
+				globalGarbageCollect();
+			}
+
+			if (interruptPending & INTERRUPT_STACK_OVERFLOW) {
+				clearInterrupt(INTERRUPT_STACK_OVERFLOW);
+				raiseSTError (ST_ERROR_CLASS, "Stack overflow");
+			}
+
+			if (interruptPending & INTERRUPT_LOW_SPACE) {
+				clearInterrupt(INTERRUPT_LOW_SPACE);
+				raiseSTError (ST_ERROR_CLASS, "Low space");
 			}
 
-			if (errorString[0] != '\0')
-			   return TRUE;
-			eventWaitingFlag = maxBytecodes > 0;
+			if ((interruptPending & INTERRUPT_HOT_METHODS) && (maxBytecodes == 0)) {
+				clearInterrupt(INTERRUPT_HOT_METHODS);
+				reportHotMethods();
+			}
 		}
 	}
 }
@@ -0,0 +1,813 @@
+// jit.c
+//
+// Beagle Smalltalk
+// Copyright (c) 2025 Simberon Incorporated
+// Released under the MIT License
+// https://opensource.org/license/MIT
+//
+// Baseline template JIT for x86-64 Linux.  Build with "make JIT=yes".
+//
+// Once a method or block has been activated JIT_THRESHOLD times its bytecodes are
+// translated into machine code, one template per bytecode.  The templates cover the
+// pushes, stores into locals, pops, jumps and the SmallInteger arithmetic and
+// comparisons of call well known.  Every other bytecode (sends, returns, primitives,
+// allocation, thisContext, stores into the heap, breakpoints) and every failed fast
+// path exits back to basicInterpret at that bytecode, so the interpreter's own code
+// handles them and the native code never owns a frame.
+//
+// basicInterpret enters the native code at the top of its loop when the current pc
+// has a native entry point.  The native code keeps the stack pointer, locals,
+// literals and receiver body in registers (rbx, r12, r13 and r14) and returns the pc
+// offset where the interpreter should carry on.  Backward jumps exit when
+// interruptPending is set so that process switches, breakpoints and interrupts are
+// still seen.  The interpreter never enters native code while single stepping,
+// tracing or running a debugger step (stopFrame set), which is how the debugger,
+// thisContext and the step remote command always see an interpreted frame.
+//
+// Native code refers to old space objects by address so everything is thrown away
+// after a global garbage collection, become: or space reallocation (jitFlush).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "object.h"
+
+#ifdef JIT
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "The JIT only supports x86-64 Linux"
+#endif
+
+#define JIT_CODE_SPACE_SIZE (16 * 1024 * 1024)
+#define JIT_METHOD_TABLE_SIZE 4096
+#define JIT_COUNTER_TABLE_SIZE 4096
+#define JIT_THRESHOLD 1000
+#define JIT_MAX_TEMPLATE_SIZE 128
+
+// x86-64 registers and condition codes
+
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSI 6
+#define RDI 7
+#define R12 12
+#define R13 13
+#define R14 14
+#define R15 15
+
+#define REG_SP RBX
+#define REG_LOCALS R12
+#define REG_LITERALS R13
+#define REG_RECEIVER R14
+#define REG_STATE R15
+
+#define CC_O 0x0
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_L 0xc
+#define CC_GE 0xd
+#define CC_LE 0xe
+#define CC_G 0xf
+
+#define ALU_ADD 0
+#define ALU_OR 1
+#define ALU_AND 4
+#define ALU_SUB 5
+#define ALU_CMP 7
+
+typedef struct {
+	oop bytecodes;
+	uint64_t size;
+	uint32_t *entries;
+} jitMethodStruct;
+
+typedef struct {
+	oop bytecodes;
+	uint64_t count;
+} jitCounterStruct;
+
+typedef struct {
+	uint8_t *fixup;
+	uint64_t pc;
+	uint64_t undo;
+} jitExitStruct;
+
+int jitEnabled = TRUE;
+uint64_t jitCompiledMethods = 0;
+uint64_t jitNativeEntries = 0;
+uint64_t jitFlushes = 0;
+
+uint8_t *jitCodeSpace = NULL;
+uint8_t *jitCursor;
+uint8_t *jitEnterCode;
+uint8_t *jitExitCode;
+uint8_t *jitMethodCode;
+jitMethodStruct jitMethods[JIT_METHOD_TABLE_SIZE];
+uint64_t jitMethodCount = 0;
+jitCounterStruct jitCounters[JIT_COUNTER_TABLE_SIZE];
+
+#define jitHash(x) (((x) >> IMMEDIATE_SHIFT) ^ ((x) >> 12))
+
+// Instruction encoding
+
+void emitByte(uint8_t byte)
+{
+	*jitCursor++ = byte;
+}
+
+void emit32(uint32_t value)
+{
+	memcpy(jitCursor, &value, sizeof(value));
+	jitCursor += sizeof(value);
+}
+
+void emit64(uint64_t value)
+{
+	memcpy(jitCursor, &value, sizeof(value));
+	jitCursor += sizeof(value);
+}
+
+void emitRex(int reg, int rm)
+{
+	emitByte(0x48 | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+void emitModRM(int reg, int rm)
+{
+	emitByte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void emitModRMDisp32(int reg, int base, int32_t disp)
+{
+	emitByte(0x80 | ((reg & 7) << 3) | (base & 7));
+	if ((base & 7) == 4)
+		emitByte(0x24);
+	emit32(disp);
+}
+
+// mov dst, [base + disp]
+void emitLoad(int dst, int base, int32_t disp)
+{
+	emitRex(dst, base);
+	emitByte(0x8b);
+	emitModRMDisp32(dst, base, disp);
+}
+
+// mov [base + disp], src
+void emitStore(int base, int32_t disp, int src)
+{
+	emitRex(src, base);
+	emitByte(0x89);
+	emitModRMDisp32(src, base, disp);
+}
+
+// mov dst, imm64
+void emitLoadImmediate(int dst, uint64_t value)
+{
+	emitRex(0, dst);
+	emitByte(0xb8 + (dst & 7));
+	emit64(value);
+}
+
+// add/or/and/sub/cmp dst, imm32
+void emitAluImmediate(int operation, int dst, int32_t value)
+{
+	emitRex(0, dst);
+	emitByte(0x81);
+	emitModRM(operation, dst);
+	emit32(value);
+}
+
+// add/and/or/xor/sub/cmp/mov dst, src
+void emitAluRegister(uint8_t opcode, int dst, int src)
+{
+	emitRex(src, dst);
+	emitByte(opcode);
+	emitModRM(src, dst);
+}
+
+#define emitAdd(dst, src) emitAluRegister(0x01, dst, src)
+#define emitAnd(dst, src) emitAluRegister(0x21, dst, src)
+#define emitOr(dst, src) emitAluRegister(0x09, dst, src)
+#define emitXor(dst, src) emitAluRegister(0x31, dst, src)
+#define emitSub(dst, src) emitAluRegister(0x29, dst, src)
+#define emitCmp(dst, src) emitAluRegister(0x39, dst, src)
+#define emitMov(dst, src) emitAluRegister(0x89, dst, src)
+
+void emitImul(int dst, int src)
+{
+	emitRex(dst, src);
+	emitByte(0x0f);
+	emitByte(0xaf);
+	emitModRM(dst, src);
+}
+
+void emitSarImmediate(int dst, uint8_t count)
+{
+	emitRex(0, dst);
+	emitByte(0xc1);
+	emitModRM(7, dst);
+	emitByte(count);
+}
+
+void emitCmov(int condition, int dst, int src)
+{
+	emitRex(dst, src);
+	emitByte(0x0f);
+	emitByte(0x40 + condition);
+	emitModRM(dst, src);
+}
+
+void emitPush(int reg)
+{
+	if (reg >= 8)
+		emitByte(0x41);
+	emitByte(0x50 + (reg & 7));
+}
+
+void emitPop(int reg)
+{
+	if (reg >= 8)
+		emitByte(0x41);
+	emitByte(0x58 + (reg & 7));
+}
+
+void patchRel32(uint8_t *fixup, uint8_t *target)
+{
+	int32_t offset = (int32_t) (target - (fixup + sizeof(int32_t)));
+	memcpy(fixup, &offset, sizeof(offset));
+}
+
+// Answer the address of the rel32 so that it can be patched later
+uint8_t *emitJcc(int condition)
+{
+	emitByte(0x0f);
+	emitByte(0x80 + condition);
+	emit32(0);
+	return jitCursor - sizeof(int32_t);
+}
+
+uint8_t *emitJmp()
+{
+	emitByte(0xe9);
+	emit32(0);
+	return jitCursor - sizeof(int32_t);
+}
+
+// Smalltalk stack operations
+
+void emitPushRax()
+{
+	emitStore(REG_SP, 0, RAX);
+	emitAluImmediate(ALU_ADD, REG_SP, sizeof(oop));
+}
+
+void emitPushConstant(oop value)
+{
+	emitLoadImmediate(RAX, value);
+	emitPushRax();
+}
+
+void emitExitTo(uint64_t pcOffset)
+{
+	emitByte(0xb8);		// mov eax, pcOffset
+	emit32((uint32_t) pcOffset);
+	patchRel32(emitJmp(), jitExitCode);
+}
+
+// Method compilation
+
+typedef struct {
+	uint8_t **labels;
+	jitExitStruct *exits;
+	uint64_t numberOfExits;
+	jitExitStruct *jumps;
+	uint64_t numberOfJumps;
+} jitCompilationStruct;
+
+void addExit(jitCompilationStruct *compilation, uint8_t *fixup, uint64_t pcOffset, uint64_t undo)
+{
+	jitExitStruct *exit = &compilation->exits[compilation->numberOfExits++];
+
+	exit->fixup = fixup;
+	exit->pc = pcOffset;
+	exit->undo = undo;
+}
+
+void addJump(jitCompilationStruct *compilation, uint8_t *fixup, uint64_t target)
+{
+	jitExitStruct *jump = &compilation->jumps[compilation->numberOfJumps++];
+
+	jump->fixup = fixup;
+	jump->pc = target;
+	jump->undo = 0;
+}
+
+// Backward jumps leave the native code if an event is waiting so the interpreter
+// can deal with it at the jump target.
+void emitEventCheck(jitCompilationStruct *compilation, uint64_t target)
+{
+	emitLoadImmediate(RAX, (uint64_t) &interruptPending);
+	emitByte(0x83);		// cmp dword [rax], 0
+	emitByte(0x38);
+	emitByte(0x00);
+	addExit(compilation, emitJcc(CC_NE), target, 0);
+}
+
+void emitJump(jitCompilationStruct *compilation, uint64_t pcOffset, uint64_t target)
+{
+	if (target <= pcOffset)
+		emitEventCheck(compilation, target);
+	addJump(compilation, emitJmp(), target);
+}
+
+void emitConditionalJump(jitCompilationStruct *compilation, uint64_t pcOffset, uint64_t target, oop value)
+{
+	uint8_t *skip;
+
+	emitLoad(RAX, REG_SP, -(int32_t) sizeof(oop));
+	emitAluImmediate(ALU_SUB, REG_SP, sizeof(oop));
+	emitLoadImmediate(RCX, value);
+	emitCmp(RAX, RCX);
+
+	if (target > pcOffset) {
+		addJump(compilation, emitJcc(CC_E), target);
+		return;
+	}
+
+	skip = emitJcc(CC_NE);
+	emitJump(compilation, pcOffset, target);
+	patchRel32(skip, jitCursor);
+}
+
+int isJitWellKnown(uint8_t selectorNumber)
+{
+	switch (selectorNumber) {
+		case SPECIAL_PLUS:
+		case SPECIAL_MINUS:
+		case SPECIAL_TIMES:
+		case SPECIAL_IDENTICAL:
+		case SPECIAL_NOT_IDENTICAL:
+		case SPECIAL_EQUALS:
+		case SPECIAL_NOT_EQUALS:
+		case SPECIAL_LESS_THAN:
+		case SPECIAL_GREATER_THAN:
+		case SPECIAL_LESS_THAN_OR_EQUAL:
+		case SPECIAL_GREATER_THAN_OR_EQUAL:
+		case SPECIAL_BIT_AND:
+		case SPECIAL_BIT_OR:
+		case SPECIAL_BIT_XOR:
+			return TRUE;
+	}
+	return FALSE;
+}
+
+// The receiver and argument are on top of the stack.  If they're not both
+// SmallIntegers, or the result overflows, we pop undo values and exit at pcOffset so
+// that the interpreter runs the bytecode (and callWellKnown) from scratch.
+void emitWellKnown(jitCompilationStruct *compilation, uint8_t selectorNumber, uint64_t pcOffset, uint64_t undo)
+{
+	int condition = CC_E;
+
+	emitLoad(RAX, REG_SP, -2 * (int32_t) sizeof(oop));
+	emitLoad(RDX, REG_SP, -(int32_t) sizeof(oop));
+
+	if ((selectorNumber != SPECIAL_IDENTICAL) && (selectorNumber != SPECIAL_NOT_IDENTICAL)) {
+		emitMov(RCX, RAX);
+		emitAluImmediate(ALU_AND, RCX, IMMEDIATE_TAG_MASK);
+		emitAluImmediate(ALU_CMP, RCX, INT_TAG);
+		addExit(compilation, emitJcc(CC_NE), pcOffset, undo);
+		emitMov(RCX, RDX);
+		emitAluImmediate(ALU_AND, RCX, IMMEDIATE_TAG_MASK);
+		emitAluImmediate(ALU_CMP, RCX, INT_TAG);
+		addExit(compilation, emitJcc(CC_NE), pcOffset, undo);
+	}
+
+	switch (selectorNumber) {
+		case SPECIAL_PLUS:
+			emitAluImmediate(ALU_SUB, RAX, INT_TAG);
+			emitAdd(RAX, RDX);
+			addExit(compilation, emitJcc(CC_O), pcOffset, undo);
+			break;
+
+		case SPECIAL_MINUS:
+			emitSub(RAX, RDX);
+			addExit(compilation, emitJcc(CC_O), pcOffset, undo);
+			emitAluImmediate(ALU_ADD, RAX, INT_TAG);
+			break;
+
+		case SPECIAL_TIMES:
+			emitAluImmediate(ALU_SUB, RAX, INT_TAG);
+			emitSarImmediate(RDX, IMMEDIATE_SHIFT);
+			emitImul(RAX, RDX);
+			addExit(compilation, emitJcc(CC_O), pcOffset, undo);
+			emitAluImmediate(ALU_ADD, RAX, INT_TAG);
+			break;
+
+		case SPECIAL_BIT_AND:
+			// Both tags are INT_TAG so anding the oops keeps the tag
+			emitAnd(RAX, RDX);
+			break;
+
+		case SPECIAL_BIT_OR:
+			emitOr(RAX, RDX);
+			break;
+
+		case SPECIAL_BIT_XOR:
+			// The tags cancel out so put INT_TAG back
+			emitXor(RAX, RDX);
+			emitAluImmediate(ALU_OR, RAX, INT_TAG);
+			break;
+
+		default:
+			switch (selectorNumber) {
+				case SPECIAL_NOT_IDENTICAL:
+				case SPECIAL_NOT_EQUALS: condition = CC_NE; break;
+				case SPECIAL_LESS_THAN: condition = CC_L; break;
+				case SPECIAL_GREATER_THAN: condition = CC_G; break;
+				case SPECIAL_LESS_THAN_OR_EQUAL: condition = CC_LE; break;
+				case SPECIAL_GREATER_THAN_OR_EQUAL: condition = CC_GE; break;
+			}
+			emitCmp(RAX, RDX);
+			emitLoadImmediate(RAX, ST_FALSE);
+			emitLoadImmediate(RCX, ST_TRUE);
+			emitCmov(condition, RAX, RCX);
+			break;
+	}
+
+	emitStore(REG_SP, -2 * (int32_t) sizeof(oop), RAX);
+	emitAluImmediate(ALU_SUB, REG_SP, sizeof(oop));
+}
+
+// Push for the one byte push bytecodes that can appear in a superinstruction
+void emitShortPush(uint8_t bytecode)
+{
+	if ((bytecode & 0xf0) == 0x20)
+		emitLoad(RAX, REG_LOCALS, (1 + (bytecode & 0x0f)) * sizeof(oop));
+	else if ((bytecode & 0xf0) == 0x80)
+		emitLoad(RAX, REG_LITERALS, (bytecode & 0x0f) * sizeof(oop));
+	else if (bytecode <= 0x6f)
+		emitLoadImmediate(RAX, cIntToST((bytecode & 0x0f) + 1));
+	else
+		emitLoadImmediate(RAX, cIntToST(-(bytecode & 0x0f)));
+	emitPushRax();
+}
+
+// Emit the template for the bytecode at pcOffset.  Answer FALSE if there's no
+// template, in which case nothing has been emitted.
+int emitBytecode(jitCompilationStruct *compilation, uint8_t *bytecodes, uint64_t pcOffset, uint64_t length)
+{
+	uint8_t bytecode = bytecodes[pcOffset];
+	uint64_t next = pcOffset + length;
+
+	if (bytecode <= 0x0f) {
+		emitLoad(RAX, REG_RECEIVER, bytecode * sizeof(oop));
+		emitPushRax();
+		return TRUE;
+	}
+
+	if ((bytecode & 0xf0) == 0x20) {
+		emitLoad(RAX, REG_LOCALS, (1 + (bytecode & 0x0f)) * sizeof(oop));
+		emitPushRax();
+		return TRUE;
+	}
+
+	if ((bytecode & 0xf0) == 0x30) {
+		emitLoad(RAX, REG_SP, -(int32_t) sizeof(oop));
+		emitStore(REG_LOCALS, (1 + (bytecode & 0x0f)) * sizeof(oop), RAX);
+		return TRUE;
+	}
+
+	if ((bytecode & 0xf0) == 0x40) {
+		emitLoad(RAX, REG_LITERALS, (bytecode & 0x0f) * sizeof(oop));
+		emitLoad(RAX, RAX, offsetof(objectHeaderStruct, bodyPointer));
+		emitLoad(RAX, RAX, offsetof(associationStruct, value));
+		emitPushRax();
+		return TRUE;
+	}
+
+	if (((bytecode >= 0x60) && (bytecode <= 0x7f)) || ((bytecode & 0xf0) == 0x80)) {
+		emitShortPush(bytecode);
+		return TRUE;
+	}
+
+	switch (bytecode) {
+		case 0x90:
+			emitPushConstant(ST_TRUE);
+			return TRUE;
+
+		case 0x91:
+			emitPushConstant(ST_FALSE);
+			return TRUE;
+
+		case 0x92:
+			emitPushConstant(ST_NIL);
+			return TRUE;
+
+		case 0x93:
+			emitLoad(RAX, REG_LOCALS, 0);
+			emitPushRax();
+			return TRUE;
+
+		case 0x94:
+			emitLoad(RAX, REG_RECEIVER, bytecodes[pcOffset + 1] * sizeof(oop));
+			emitPushRax();
+			return TRUE;
+
+		case 0x96:
+			emitLoad(RAX, REG_LOCALS, (1 + bytecodes[pcOffset + 1]) * sizeof(oop));
+			emitPushRax();
+			return TRUE;
+
+		case 0x9c:
+			emitLoad(RAX, REG_LITERALS, bytecodes[pcOffset + 1] * sizeof(oop));
+			emitPushRax();
+			return TRUE;
+
+		case 0x9e:
+			emitPushConstant(cIntToST((int8_t) bytecodes[pcOffset + 1]));
+			return TRUE;
+
+		case 0x9f:
+			emitPushConstant(cIntToST((int16_t) (bytecodes[pcOffset + 1] * 256 + bytecodes[pcOffset + 2])));
+			return TRUE;
+
+		case 0xa0:
+			emitPushConstant(cIntToST((int32_t) (
+				bytecodes[pcOffset + 1] * 16777216
+				+ bytecodes[pcOffset + 2] * 65536
+				+ bytecodes[pcOffset + 3] * 256
+				+ bytecodes[pcOffset + 4])));
+			return TRUE;
+
+		case 0xa5:
+			emitLoad(RAX, REG_SP, -(int32_t) sizeof(oop));
+			emitStore(REG_LOCALS, (1 + bytecodes[pcOffset + 1]) * sizeof(oop), RAX);
+			return TRUE;
+
+		case 0xac:
+			emitAluImmediate(ALU_SUB, REG_SP, sizeof(oop));
+			return TRUE;
+
+		case 0xad:
+			emitLoad(RAX, REG_SP, -(int32_t) sizeof(oop));
+			emitPushRax();
+			return TRUE;
+
+		case 0xae:
+			emitLoad(RAX, REG_SP, -(int32_t) sizeof(oop));
+			emitStore(REG_SP, -2 * (int32_t) sizeof(oop), RAX);
+			emitAluImmediate(ALU_SUB, REG_SP, sizeof(oop));
+			return TRUE;
+
+		case 0xb0:
+			emitJump(compilation, pcOffset, next + (int8_t) bytecodes[pcOffset + 1]);
+			return TRUE;
+
+		case 0xb1:
+			emitJump(compilation, pcOffset, next + (int16_t) (bytecodes[pcOffset + 1] * 256 + bytecodes[pcOffset + 2]));
+			return TRUE;
+
+		case 0xb2:
+			emitConditionalJump(compilation, pcOffset, next + (int8_t) bytecodes[pcOffset + 1], ST_TRUE);
+			return TRUE;
+
+		case 0xb3:
+			emitConditionalJump(compilation, pcOffset, next + (int16_t) (bytecodes[pcOffset + 1] * 256 + bytecodes[pcOffset + 2]), ST_TRUE);
+			return TRUE;
+
+		case 0xb4:
+			emitConditionalJump(compilation, pcOffset, next + (int8_t) bytecodes[pcOffset + 1], ST_FALSE);
+			return TRUE;
+
+		case 0xb5:
+			emitConditionalJump(compilation, pcOffset, next + (int16_t) (bytecodes[pcOffset + 1] * 256 + bytecodes[pcOffset + 2]), ST_FALSE);
+			return TRUE;
+
+		case 0xd6:
+			if (!isJitWellKnown(bytecodes[pcOffset + 1]))
+				return FALSE;
+			emitWellKnown(compilation, bytecodes[pcOffset + 1], pcOffset, 0);
+			return TRUE;
+
+		case 0xbb:	// quickened push local; push literal|integer|local; call well known
+		case 0xbc:
+		case 0xbe:
+			if (!isJitWellKnown(bytecodes[pcOffset + 3]))
+				return FALSE;
+			emitShortPush(bytecodes[pcOffset + 1]);
+			emitShortPush(bytecodes[pcOffset + 2]);
+			emitWellKnown(compilation, bytecodes[pcOffset + 3], pcOffset, 2);
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+jitMethodStruct *jitMethodFor(oop bytecodesOop)
+{
+	uint64_t index = jitHash(bytecodesOop) & (JIT_METHOD_TABLE_SIZE - 1);
+
+	while (jitMethods[index].bytecodes != 0) {
+		if (jitMethods[index].bytecodes == bytecodesOop)
+			return &jitMethods[index];
+		index = (index + 1) & (JIT_METHOD_TABLE_SIZE - 1);
+	}
+
+	return NULL;
+}
+
+void jitCompile(oop bytecodesOop)
+{
+	uint8_t *bytecodes = (uint8_t *) objectBody(bytecodesOop);
+	uint64_t size = basicByteSize(bytecodesOop);
+	uint64_t pcOffset, length, i, index;
+	uint8_t *methodStart;
+	uint32_t *entries;
+	jitCompilationStruct compilation;
+
+	// Give up on methods that the tables can't hold.  Either way we don't come back.
+	markJitted(bytecodesOop);
+
+	if ((size == 0) || (jitMethodCount >= JIT_METHOD_TABLE_SIZE / 2))
+		return;
+
+	if ((uint64_t) (jitCursor - jitCodeSpace) + size * JIT_MAX_TEMPLATE_SIZE > JIT_CODE_SPACE_SIZE) {
+		jitFlush();
+		markJitted(bytecodesOop);
+		if (size * JIT_MAX_TEMPLATE_SIZE > JIT_CODE_SPACE_SIZE / 2)
+			return;
+	}
+
+	compilation.labels = calloc(size + 1, sizeof(uint8_t *));
+	compilation.exits = calloc(size * 4, sizeof(jitExitStruct));
+	compilation.jumps = calloc(size, sizeof(jitExitStruct));
+	compilation.numberOfExits = 0;
+	compilation.numberOfJumps = 0;
+	entries = calloc(size + 1, sizeof(uint32_t));
+	methodStart = jitCursor;
+
+	if ((compilation.labels == NULL) || (compilation.exits == NULL) || (compilation.jumps == NULL) || (entries == NULL))
+		goto abandon;
+
+	for (pcOffset = 0; pcOffset < size; pcOffset += length) {
+		length = bytecodeLengths[bytecodes[pcOffset]];
+		if ((length == 0) || (pcOffset + length > size))
+			goto abandon;
+
+		compilation.labels[pcOffset] = jitCursor;
+		if (emitBytecode(&compilation, bytecodes, pcOffset, length))
+			entries[pcOffset] = (uint32_t) (compilation.labels[pcOffset] - jitCodeSpace) + 1;
+		else
+			emitExitTo(pcOffset);
+	}
+
+	for (i = 0; i < compilation.numberOfJumps; i++) {
+		jitExitStruct *jump = &compilation.jumps[i];
+		if ((jump->pc >= size) || (compilation.labels[jump->pc] == NULL))
+			goto abandon;
+		patchRel32(jump->fixup, compilation.labels[jump->pc]);
+	}
+
+	for (i = 0; i < compilation.numberOfExits; i++) {
+		jitExitStruct *exit = &compilation.exits[i];
+		patchRel32(exit->fixup, jitCursor);
+		if (exit->undo != 0)
+			emitAluImmediate(ALU_SUB, REG_SP, exit->undo * sizeof(oop));
+		emitExitTo(exit->pc);
+	}
+
+	index = jitHash(bytecodesOop) & (JIT_METHOD_TABLE_SIZE - 1);
+	while (jitMethods[index].bytecodes != 0)
+		index = (index + 1) & (JIT_METHOD_TABLE_SIZE - 1);
+	jitMethods[index].bytecodes = bytecodesOop;
+	jitMethods[index].size = size;
+	jitMethods[index].entries = entries;
+	jitMethodCount++;
+	jitCompiledMethods++;
+
+	free (compilation.labels);
+	free (compilation.exits);
+	free (compilation.jumps);
+	return;
+
+abandon:
+	jitCursor = methodStart;
+	free (compilation.labels);
+	free (compilation.exits);
+	free (compilation.jumps);
+	free (entries);
+}
+
+// Interface to the interpreter
+
+void initializeJit()
+{
+	jitCodeSpace = mmap(NULL, JIT_CODE_SPACE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (jitCodeSpace == MAP_FAILED) {
+		LOGW ("Unable to allocate JIT code space - running interpreted");
+		jitCodeSpace = NULL;
+		jitEnabled = FALSE;
+		return;
+	}
+
+	jitCursor = jitCodeSpace;
+
+	// int64_t enter(jitStateStruct *state, void *entry)
+
+	jitEnterCode = jitCursor;
+	emitPush(RBX);
+	emitPush(R12);
+	emitPush(R13);
+	emitPush(R14);
+	emitPush(R15);
+	emitMov(REG_STATE, RDI);
+	emitLoad(REG_SP, REG_STATE, offsetof(jitStateStruct, sp));
+	emitLoad(REG_LOCALS, REG_STATE, offsetof(jitStateStruct, locals));
+	emitLoad(REG_LITERALS, REG_STATE, offsetof(jitStateStruct, literals));
+	emitLoad(REG_RECEIVER, REG_STATE, offsetof(jitStateStruct, receiverBody));
+	emitByte(0xff);		// jmp rsi
+	emitModRM(4, RSI);
+
+	// Common exit - eax holds the pc offset to continue interpreting at
+
+	jitExitCode = jitCursor;
+	emitStore(REG_STATE, offsetof(jitStateStruct, sp), REG_SP);
+	emitPop(R15);
+	emitPop(R14);
+	emitPop(R13);
+	emitPop(R12);
+	emitPop(RBX);
+	emitByte(0xc3);		// ret
+
+	jitMethodCode = jitCursor;
+	jitFlush();
+}
+
+void jitFlush()
+{
+	uint64_t i;
+
+	for (i = 0; i < JIT_METHOD_TABLE_SIZE; i++) {
+		free (jitMethods[i].entries);
+		jitMethods[i].bytecodes = 0;
+		jitMethods[i].entries = NULL;
+	}
+	memset(jitCounters, 0, sizeof(jitCounters));
+	jitMethodCount = 0;
+	jitFlushes++;
+
+	if (jitCodeSpace != NULL)
+		jitCursor = jitMethodCode;
+}
+
+void jitCountActivation(oop bytecodesOop)
+{
+	jitCounterStruct *counter;
+
+	if (!jitEnabled || isJitted(bytecodesOop) || !isObjectInOldSpace(bytecodesOop))
+		return;
+
+	counter = &jitCounters[jitHash(bytecodesOop) & (JIT_COUNTER_TABLE_SIZE - 1)];
+	if (counter->bytecodes != bytecodesOop) {
+		counter->bytecodes = bytecodesOop;
+		counter->count = 0;
+	}
+
+	if (++counter->count >= JIT_THRESHOLD)
+		jitCompile(bytecodesOop);
+}
+
+// Answer the native entry point for the bytecode at pcOffset or NULL if the
+// interpreter should run it
+void *jitEntryFor(oop bytecodesOop, uint64_t pcOffset)
+{
+	jitMethodStruct *jitMethod = jitMethodFor(bytecodesOop);
+
+	if (jitMethod == NULL) {
+		// Flushed (or we gave up compiling it) so start counting again
+		unmarkJitted(bytecodesOop);
+		return NULL;
+	}
+
+	if ((pcOffset >= jitMethod->size) || (jitMethod->entries[pcOffset] == 0))
+		return NULL;
+
+	return jitCodeSpace + jitMethod->entries[pcOffset] - 1;
+}
+
+uint64_t jitRun(void *entry, jitStateStruct *state)
+{
+	uint64_t (*enter)(jitStateStruct *, void *) = (uint64_t (*)(jitStateStruct *, void *)) jitEnterCode;
+
+	jitNativeEntries++;
+	return enter(state, entry);
+}
+
+#endif
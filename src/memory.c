@@ -7,7 +7,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#ifdef WINDOWS
+#include <windows.h>
+#else
 #include <sys/mman.h>
+#endif
 #include <unistd.h>
 #include "object.h"
 
@@ -20,10 +24,41 @@ memorySpaceStruct *WellKnownObjects;
 memorySpaceStruct *StackSpace;
 memorySpaceStruct *Spaces[MAX_SPACES];
 
+uint8_t *cardTable;
+uint64_t cardTableBase;
+uint64_t cardTableLimit;
+
+uint64_t heapBase;
+uint64_t heapPageSize;
+uint64_t spareNewSpaceOffset = 3 * NEW_SPACE_SLOT;
+
+memorySpaceStruct *oldSpaceSlots[MAX_OLD_SEGMENTS];
+memorySpaceStruct *oldSegments[MAX_OLD_SEGMENTS];
+int numberOfOldSegments = 0;
+memorySpaceStruct *tenureSegment;
+
+memorySpaceStruct *stackPages[MAX_STACK_PAGES];
+int currentStackPage = 0;
+
 memorySpaceStruct *ActiveSurvivorSpace;
 memorySpaceStruct *InactiveSurvivorSpace;
 int EdenUsedForGC = 0;
 
+uint16_t tenureAge = TENURE_AGE_LIMIT;
+uint16_t minimumTenureAge = 1;
+uint64_t survivorBytesByAge[TENURE_AGE_LIMIT + 1];
+uint64_t edenSurvivorBytes;
+uint64_t tenuredBytes;
+uint64_t prematureTenuredBytes;
+double survivalRate;
+
+uint64_t heapSoftLimit;
+uint64_t heapHardLimit;
+uint64_t initialEdenSize;
+uint64_t initialOldSpaceSize;
+int lowOccupancyCollections = 0;
+int markQueueOverflowed = FALSE;
+
 extern oop tenure (oop object);
 extern uint64_t gcCopyToInactiveObjectContents(oop object);
 extern void relocateAllObjectPointers();
@@ -117,6 +152,515 @@ memorySpaceStruct *allocateSpace (uint64_t size)
 	return space;
 }
 
+// Reserve address space without committing any memory to it.  Answer 0 if it can't be
+// reserved.
+
+uint64_t reserveAddressSpace(uint64_t size)
+{
+#ifdef WINDOWS
+	heapPageSize = 4096;
+	return asOop(VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS));
+#else
+	void *reservation;
+
+	heapPageSize = (uint64_t) sysconf(_SC_PAGESIZE);
+	reservation = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return reservation == MAP_FAILED ? 0 : asOop(reservation);
+#endif
+}
+
+// Reserve the heap and the card table for its old space region
+
+void reserveHeap(void)
+{
+	if (heapBase != 0)
+		return;
+
+	heapBase = reserveAddressSpace(HEAP_RESERVATION);
+	cardTable = (uint8_t *) reserveAddressSpace(OLD_SPACE_REGION >> CARD_SHIFT);
+	if ((heapBase == 0) || (cardTable == NULL)) {
+		LOGE ("Cannot reserve %" PRIu64 " bytes of address space for the heap", (uint64_t) HEAP_RESERVATION);
+		ERROR_EXIT;
+	}
+
+	cardTableBase = heapBase + OLD_SPACE_OFFSET;
+	cardTableLimit = OLD_SPACE_REGION;
+}
+
+#define roundToHeapPage(x) (((x) + heapPageSize - 1) & ~(heapPageSize - 1))
+
+void commitHeapPages(uint64_t start, uint64_t end)
+{
+	start = roundToHeapPage(start);
+	end = roundToHeapPage(end);
+	if (end <= start)
+		return;
+
+#ifdef WINDOWS
+	if (VirtualAlloc((void *) start, end - start, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+#else
+	if (mprotect((void *) start, end - start, PROT_READ | PROT_WRITE) != 0) {
+#endif
+		LOGE ("Cannot commit %" PRIu64 " bytes of heap", end - start);
+		ERROR_EXIT;
+	}
+}
+
+// Give the pages back to the system but keep the addresses reserved
+
+void decommitHeapPages(uint64_t start, uint64_t end)
+{
+	start = roundToHeapPage(start);
+	end = roundToHeapPage(end);
+	if (end <= start)
+		return;
+
+#ifdef WINDOWS
+	VirtualFree((void *) start, end - start, MEM_DECOMMIT);
+#else
+	mmap((void *) start, end - start, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+#endif
+}
+
+// Commit the part of the card table that covers a space in the old space region
+
+void commitCardTable(memorySpaceStruct *space)
+{
+	uint64_t start = asOop(&cardTable[cardIndex(space)]);
+
+	commitHeapPages(start & ~(heapPageSize - 1), asOop(&cardTable[cardIndex(endOfSpace(space))]) + 1);
+}
+
+uint64_t heapSlotSize(uint64_t offset)
+{
+	if (offset < NEW_SPACE_RESERVATION)
+		return NEW_SPACE_SLOT;
+
+	if (offset < OLD_SPACE_OFFSET)
+		return STACK_PAGE_SLOT;
+
+	return OLD_SPACE_SLOT;
+}
+
+// Lay out a space at offset in the heap.  Answer NULL if it doesn't fit in its slot.
+
+memorySpaceStruct *allocateSpaceInHeap (uint64_t offset, uint64_t size)
+{
+	memorySpaceStruct *space = (memorySpaceStruct *) (heapBase + offset);
+
+	if ((offset == NOT_IN_HEAP) || (sizeof(memorySpaceStruct) + size > heapSlotSize(offset)))
+		return NULL;
+
+	commitHeapPages(asOop(space), asOop(space) + sizeof(memorySpaceStruct) + size);
+
+	space -> spaceSize = size;
+	space -> firstFreeBlock = 0;
+	space -> lastFreeBlock = size / sizeof(oop) - 1;
+	space -> rememberedSetSpaceNumber = 0;
+
+	if (offset >= OLD_SPACE_OFFSET) {
+		oldSegmentOf(space) = space;
+		commitCardTable(space);
+	}
+
+	return space;
+}
+
+// Answer the offset of a free slot in the old space region, or NOT_IN_HEAP if every
+// slot is in use.
+
+uint64_t oldSpaceSlotOffset(void)
+{
+	uint64_t slot;
+
+	for (slot = 0; slot < MAX_OLD_SEGMENTS; slot++)
+		if (oldSpaceSlots[slot] == NULL)
+			return OLD_SPACE_OFFSET + slot * OLD_SPACE_SLOT;
+
+	return NOT_IN_HEAP;
+}
+
+// Free a space.  A space in the heap gives back its pages.  Its slot becomes the spare one
+// for new space, or free again in the old space region along with its cards.
+
+void releaseSpace(memorySpaceStruct *space)
+{
+	if (!isSpaceInHeap(space)) {
+		free (space);
+		return;
+	}
+
+	if (isObjectInOldSpaceRegion(space)) {
+		decommitHeapPages(asOop(&cardTable[cardIndex(space)]), asOop(&cardTable[cardIndex(endOfSpace(space))]) + 1);
+		oldSegmentOf(space) = NULL;
+	}
+
+	decommitHeapPages(asOop(space), asOop(space) + sizeof(memorySpaceStruct) + space->spaceSize);
+	if (asOop(space) - heapBase < NEW_SPACE_RESERVATION)
+		spareNewSpaceOffset = asOop(space) - heapBase;
+}
+
+// Change the size of an object space in the heap without moving its headers, so nothing
+// that points at its objects changes.  The bodies at the top of the space slide up or down
+// by the change in size and only their body pointers need fixing.  Answer FALSE if the
+// space isn't in the heap, the new size doesn't fit its slot or its objects don't fit the
+// new size.
+
+int resizeSpaceInPlace(memorySpaceStruct *space, uint64_t size)
+{
+	uint64_t oldWords = spaceSize(space);
+	uint64_t newWords = size / sizeof(oop);
+	uint64_t bodyWords = oldWords - (space->lastFreeBlock + 1);
+	int64_t delta = (int64_t) newWords - (int64_t) oldWords;
+	oop bodiesStart = asOop(&space->space[space->lastFreeBlock + 1]);
+	oop bodiesEnd = asOop(endOfSpace(space));
+	uint64_t index;
+
+	if (!isSpaceInHeap(space) || isTopHeaderSpace(space))
+		return FALSE;
+
+	if (sizeof(memorySpaceStruct) + size > heapSlotSize(asOop(space) - heapBase))
+		return FALSE;
+
+	if (space->firstFreeBlock + bodyWords + 64 >= newWords)
+		return FALSE;
+
+	if (delta > 0)
+		commitHeapPages(asOop(space), asOop(space) + sizeof(memorySpaceStruct) + newWords * sizeof(oop));
+
+	memmove (oopPtr(bodiesStart) + delta, oopPtr(bodiesStart), bodyWords * sizeof(oop));
+	for (index = 0; index < space->firstFreeBlock; index += sizeof(objectHeaderStruct) / sizeof(oop)) {
+		objectHeaderStruct *header = asObjectHeader(&space->space[index]);
+
+		if (header->bodyPointer >= bodiesStart && header->bodyPointer < bodiesEnd)
+			header->bodyPointer += delta * (int64_t) sizeof(oop);
+	}
+
+	space->lastFreeBlock += delta;
+	space->spaceSize = newWords * sizeof(oop);
+	if (delta < 0)
+		decommitHeapPages(asOop(endOfSpace(space)), bodiesEnd);
+
+	if (spaceHasSpaceObject(space))
+		asObjectHeader(&space->space[0])->size = space->spaceSize + sizeof(memorySpaceStruct);
+
+	if (isObjectInOldSpaceRegion(space))
+		commitCardTable(space);
+
+	return TRUE;
+}
+
+uint64_t heapSize(void)
+{
+	uint64_t size = EdenSpace->spaceSize + SurvivorSpace1->spaceSize + SurvivorSpace2->spaceSize;
+	int i;
+
+	for (i = 0; i < numberOfOldSegments; i++)
+		size += oldSegments[i]->spaceSize;
+
+	return size;
+}
+
+// Remember the loaded sizes of Eden and OldSpace and fill in the limits that weren't
+// given on the command line.
+
+void initializeHeapSizing(void)
+{
+	initialEdenSize = EdenSpace->spaceSize;
+	initialOldSpaceSize = OldSpace->spaceSize;
+
+	if (heapHardLimit == 0)
+		heapHardLimit = DEFAULT_HEAP_HARD_LIMIT;
+	if (heapSoftLimit == 0)
+		heapSoftLimit = DEFAULT_HEAP_SOFT_LIMIT;
+	if (heapSoftLimit > heapHardLimit)
+		heapSoftLimit = heapHardLimit;
+}
+
+// Grow Eden in place by at least needed bytes.  This is only done straight after a
+// scavenge, when Eden is empty and no bodies move.  Answer FALSE if that would pass the
+// hard limit or the end of Eden's slot.
+
+int growSpace(memorySpaceStruct *space, uint64_t needed)
+{
+	uint64_t minimumGrowth = needed + 65 * sizeof(oop);
+	uint64_t growth = space->spaceSize / 100 * HEAP_GROWTH_PERCENT;
+
+	if (growth < minimumGrowth)
+		growth = minimumGrowth;
+
+	if (heapSize() + growth > heapSoftLimit) {
+		growth = minimumGrowth;
+		requestInterrupt(INTERRUPT_GARBAGE_COLLECT);
+	}
+
+	growth = roundToHeapPage(growth);
+	if ((heapSize() + growth > heapHardLimit) || !resizeSpaceInPlace(space, space->spaceSize + growth)) {
+		LOGW ("Cannot grow Eden by %" PRIu64 " bytes", growth);
+		return FALSE;
+	}
+
+	LOGI ("Grew Eden to %" PRIu64 " bytes", space->spaceSize);
+	return TRUE;
+}
+
+// Collect the old space segments after an image is loaded.  They're OldSpace and the
+// extra spaces that were read into the old space region.
+
+void findOldSegments(void)
+{
+	int i;
+
+	numberOfOldSegments = 0;
+	for (i = 0; (i < MAX_SPACES) && (Spaces[i]->spaceSize > 0); i++)
+		if (isObjectInOldSpaceRegion(Spaces[i]))
+			oldSegments[numberOfOldSegments++] = Spaces[i];
+
+	tenureSegment = OldSpace;
+}
+
+void enumerateObjectsInOldSpace(enumerationFunction function, void *args)
+{
+	int i;
+
+	for (i = 0; i < numberOfOldSegments; i++)
+		enumerateObjectsInSpace(oldSegments[i], function, args);
+}
+
+// Add a segment with at least needed bytes free as the last of the spaces in Spaces.
+// Answer NULL if it would take the heap past limit or the old space slots or Spaces
+// have no room for it.
+
+memorySpaceStruct *addOldSegment(uint64_t needed, uint64_t limit)
+{
+	memorySpaceStruct *segment = NULL;
+	uint64_t size = roundToHeapPage(needed + 65 * sizeof(oop));
+	uint64_t offset = oldSpaceSlotOffset();
+	int n;
+
+	if (size < MINIMUM_OLD_SEGMENT_SIZE)
+		size = MINIMUM_OLD_SEGMENT_SIZE;
+
+	for (n = 0; (n < MAX_SPACES - 1) && (Spaces[n]->spaceSize > 0); n++)
+		;
+
+	if (heapSize() + size > heapSoftLimit)
+		requestInterrupt(INTERRUPT_GARBAGE_COLLECT);
+
+	if ((heapSize() + size <= limit) && (offset != NOT_IN_HEAP) && (n + 1 < MAX_SPACES))
+		segment = allocateSpaceInHeap(offset, size);
+	if (segment == NULL) {
+		LOGW ("Cannot add an old space segment of %" PRIu64 " bytes", size);
+		return NULL;
+	}
+
+	segment->spaceType = OLD_SPACE;
+	segment->spaceFlags = OldSpace->spaceFlags & ~SPACE_HAS_SPACE_OBJECT;
+	segment->spaceNumber = n;
+	segment->rememberedSetSpaceNumber = OldSpace->rememberedSetSpaceNumber;
+
+	Spaces[n + 1] = Spaces[n];
+	Spaces[n] = segment;
+	oldSegments[numberOfOldSegments++] = segment;
+
+	LOGI ("Added old space segment %d of %" PRIu64 " bytes", numberOfOldSegments - 1, size);
+	return segment;
+}
+
+// Take an empty segment out of Spaces and give back its slot.  OldSpace is never removed.
+
+void removeOldSegment(int segmentIndex)
+{
+	memorySpaceStruct *segment = oldSegments[segmentIndex];
+	int i;
+
+	for (i = segmentIndex; i < numberOfOldSegments - 1; i++)
+		oldSegments[i] = oldSegments[i + 1];
+	numberOfOldSegments--;
+
+	for (i = 0; Spaces[i] != segment; i++)
+		;
+	for (; Spaces[i + 1]->spaceSize > 0; i++) {
+		Spaces[i] = Spaces[i + 1];
+		Spaces[i]->spaceNumber = i;
+	}
+	Spaces[i] = Spaces[i + 1];
+	Spaces[i + 1] = NULL;
+
+	if (tenureSegment == segment)
+		tenureSegment = OldSpace;
+
+	releaseSpace (segment);
+	LOGI ("Released empty old space segment %d", segmentIndex);
+}
+
+// Make sure some old space segment has at least needed bytes free and tenure into it.
+// Old space grows by adding a segment and never by growing one in place, since that
+// slides the bodies of the objects already in it, and the interpreter, the JIT and the
+// primitives keep body pointers of old objects across allocations.  Below heapSoftLimit
+// the new segment is HEAP_GROWTH_PERCENT of old space, up to OLD_SEGMENT_SIZE, so the
+// number of segments stays small as old space gets large.
+
+int growOldSpace(uint64_t needed)
+{
+	memorySpaceStruct *segment;
+	uint64_t size = 0;
+	int i;
+
+	for (i = 0; i < numberOfOldSegments; i++)
+		size += oldSegments[i]->spaceSize;
+	size = size / 100 * HEAP_GROWTH_PERCENT;
+	if (size > OLD_SEGMENT_SIZE)
+		size = OLD_SEGMENT_SIZE;
+	if ((size < needed) || (heapSize() + size > heapSoftLimit))
+		size = needed;
+
+	segment = addOldSegment(size, heapHardLimit);
+	if (segment == NULL)
+		return FALSE;
+
+	tenureSegment = segment;
+	return TRUE;
+}
+
+// Called at the end of a global collection, when Eden is empty.  Eden goes back to the size
+// it was loaded with and the added segments that are empty are released.  Once old space
+// has stayed mostly empty for long enough each segment shrinks to twice what it holds.
+
+void shrinkHeap(void)
+{
+	uint64_t used = 0, size = 0, segmentSize, minimumSize;
+	int i;
+
+	if (EdenSpace->spaceSize > initialEdenSize)
+		resizeSpaceInPlace(EdenSpace, initialEdenSize);
+
+	for (i = numberOfOldSegments - 1; i > 0; i--)
+		if (oldSegments[i]->firstFreeBlock == 0)
+			removeOldSegment(i);
+
+	for (i = 0; i < numberOfOldSegments; i++) {
+		used += spaceUsedBytes(oldSegments[i]);
+		size += oldSegments[i]->spaceSize;
+	}
+
+	if (used * 100 < size * HEAP_SHRINK_OCCUPANCY_PERCENT)
+		lowOccupancyCollections++;
+	else
+		lowOccupancyCollections = 0;
+
+	if (lowOccupancyCollections < HEAP_SHRINK_COLLECTIONS)
+		return;
+
+	lowOccupancyCollections = 0;
+	for (i = 0; i < numberOfOldSegments; i++) {
+		segmentSize = roundToHeapPage(spaceUsedBytes(oldSegments[i]) * 2);
+		minimumSize = (oldSegments[i] == OldSpace) ? initialOldSpaceSize : MINIMUM_OLD_SEGMENT_SIZE;
+		if (segmentSize < minimumSize)
+			segmentSize = minimumSize;
+		if ((segmentSize < oldSegments[i]->spaceSize) && resizeSpaceInPlace(oldSegments[i], segmentSize))
+			LOGI ("Shrank old space segment %d to %" PRIu64 " bytes", i, oldSegments[i]->spaceSize);
+	}
+}
+
+// Stop the interpreter at the next safepoint with message as the error when the stack
+// can't get another page.  The frame being allocated goes into the part of the current
+// page newStackFrame keeps free.
+
+memorySpaceStruct *stackOutOfSpace(char *message)
+{
+	LOGE ("%s", message);
+	snprintf (errorString, 1024, "%s", message);
+	requestInterrupt(INTERRUPT_ERROR);
+	return stackPages[currentStackPage];
+}
+
+// Move the stack on to the next page when the current one fills.  Pages aren't
+// registered in Spaces, so they're never saved with the image.  Page i lives in the i-th
+// stack page slot of the heap so the page holding a pointer can be found directly.  A
+// page that has been emptied is kept for reuse since a deep recursion usually goes back
+// and forth across the same page boundary.  Moving on to a reserve page raises a stack
+// overflow error in the process at the next safepoint.  It's raised once until the
+// stack has unwound out of the reserve.
+
+int stackOverflowRaised = FALSE;
+
+memorySpaceStruct *pushStackPage(void)
+{
+	memorySpaceStruct *page;
+
+	if (currentStackPage + 1 >= MAX_STACK_PAGES)
+		return stackOutOfSpace("Out of stack space");
+
+	if ((currentStackPage + 1 >= MAX_STACK_PAGES - STACK_RESERVE_PAGES) && !stackOverflowRaised) {
+		stackOverflowRaised = TRUE;
+		requestInterrupt(INTERRUPT_STACK_OVERFLOW);
+	}
+
+	page = stackPages[currentStackPage + 1];
+	if (page == NULL) {
+		page = allocateSpaceInHeap (STACK_PAGES_OFFSET + (currentStackPage + 1) * STACK_PAGE_SLOT, StackSpace->spaceSize);
+		if (page == NULL)
+			return stackOutOfSpace("Cannot allocate a stack page");
+		page->spaceType = STACK_SPACE;
+		page->spaceNumber = StackSpace->spaceNumber;
+		page->spaceFlags = StackSpace->spaceFlags & ~SPACE_HAS_SPACE_OBJECT;
+		stackPages[currentStackPage + 1] = page;
+	}
+
+	page->firstFreeBlock = 0;
+	page->lastFreeBlock = spaceSize(page) - 1;
+	currentStackPage++;
+
+	return page;
+}
+
+// Unwind to the page holding frame after a return.  One emptied page is kept and any
+// beyond it are given back.
+
+memorySpaceStruct *popStackPagesTo(oop frame)
+{
+	int i;
+
+	while ((currentStackPage > 0) && !isPointerInStackPage(frame, stackPages[currentStackPage])) {
+		stackPages[currentStackPage]->firstFreeBlock = 0;
+		stackPages[currentStackPage]->lastFreeBlock = spaceSize(stackPages[currentStackPage]) - 1;
+		currentStackPage--;
+	}
+
+	for (i = currentStackPage + 2; (i < MAX_STACK_PAGES) && (stackPages[i] != NULL); i++) {
+		releaseSpace (stackPages[i]);
+		stackPages[i] = NULL;
+	}
+
+	if (currentStackPage < MAX_STACK_PAGES - STACK_RESERVE_PAGES)
+		stackOverflowRaised = FALSE;
+
+	return stackPages[currentStackPage];
+}
+
+memorySpaceStruct *stackPageContaining(oop pointer)
+{
+	uint64_t offset = asOop(pointer) - heapBase - STACK_PAGES_OFFSET;
+	uint64_t i = offset / STACK_PAGE_SLOT;
+
+	if ((offset >= MAX_STACK_PAGES * STACK_PAGE_SLOT) || (i > (uint64_t) currentStackPage) || (stackPages[i] == NULL))
+		return NULL;
+
+	return isPointerInStackPage(pointer, stackPages[i]) ? stackPages[i] : NULL;
+}
+
+int isObjectInStackPages(oop object)
+{
+	memorySpaceStruct *page;
+
+	if (isImmediate(object))
+		return FALSE;
+
+	page = stackPageContaining(object);
+	return (page != NULL) && isObjectInSpace(object, page);
+}
+
 oop allocateObjectInStackSpace (uint64_t size, memorySpaceStruct *space)
 {
 	uint64_t allocatedSize = (((size + 7) & 0xFFFFFFFFFFFFFFF8) - sizeof(objectHeaderStruct)) / sizeof(oop);
@@ -142,6 +686,13 @@ oop allocateObjectInStackSpace (uint64_t size, memorySpaceStruct *space)
 	return asOop(result);
 }
 
+int hasRoomInSpace (uint64_t size, memorySpaceStruct *space)
+{
+	uint64_t allocatedSize = (((size + 7) & 0xFFFFFFFFFFFFFFF8) - sizeof(objectHeaderStruct)) / sizeof(oop);
+
+	return (space->firstFreeBlock + allocatedSize + 64) < space->lastFreeBlock;
+}
+
 oop allocateObjectInSpace (uint64_t size, memorySpaceStruct *space)
 {
 	uint64_t allocatedSize = (((size + 7) & 0xFFFFFFFFFFFFFFF8) - sizeof(objectHeaderStruct)) / sizeof(oop);
@@ -150,23 +701,23 @@ oop allocateObjectInSpace (uint64_t size, memorySpaceStruct *space)
 	if (isTopHeaderSpace(space))
 		return (allocateObjectInStackSpace (size, space));
 
-	if (isObjectSpace(space) && (space->firstFreeBlock + allocatedSize + 64) >= space->lastFreeBlock)
+	// When Eden can't grow or no old space segment can be found the allocation fails and
+	// the image gets a low space error at the next safepoint
+	if (isObjectSpace(space) && !hasRoomInSpace(size, space))
 	{
 		if (space == EdenSpace) {
 			scavenge();
 			space = EdenSpace;
+			if (!hasRoomInSpace(size, space) && !growSpace(space, size))
+				space = NULL;
 		}
-		if ((space->firstFreeBlock + allocatedSize + 64) >= space->lastFreeBlock)
+		else if (spaceIsMarkSweepManaged(space))
+			space = oldSegmentForAllocation(size);
+		if ((space == NULL) || !hasRoomInSpace(size, space))
 		{
-			if (space == EdenSpace) {
-				LOGI ("Ran out of space in Eden");
-				dumpWalkback("Ran out of space in Eden");
-			}
-			else {
-				LOGI ("Ran out of space outside of Eden");
-				dumpWalkback("Ran out of space outside of Eden");
-			}
-			ERROR_EXIT;
+			LOGW ("Cannot allocate an object of %" PRIu64 " bytes", size);
+			requestInterrupt(INTERRUPT_LOW_SPACE);
+			return asOop(NULL);
 		}
 	}
 
@@ -263,21 +814,86 @@ void moveObjectToSpace(oop pointer, memorySpaceStruct *space)
 	oop newObject = allocateObjectInSpace(memorySize(pointer), space);
 	copyObjectTo(pointer, newObject);
 }
+// Objects that have reached tenureAge, or that don't fit in the survivor space, are
+// tenured if an old space segment has room.  Objects forced out by become: have flips past
+// TENURE_AGE_LIMIT and aren't counted as tenured by the policy.
+
+// Answer the segment to tenure an object of the given size into, starting with the one
+// the last object went to, or NULL if none of them has room.
+
+memorySpaceStruct *oldSegmentWithRoom(uint64_t size)
+{
+	int i;
+
+	if (hasRoomInSpace(size, tenureSegment))
+		return tenureSegment;
+
+	for (i = 0; i < numberOfOldSegments; i++)
+		if (hasRoomInSpace(size, oldSegments[i]))
+			return tenureSegment = oldSegments[i];
+
+	return NULL;
+}
+
+// Answer a segment with room for an object of the given size that has to go in old
+// space, growing old space if none has it.  At heapHardLimit a segment is added past the
+// limit anyway and the image gets a low space error at the next safepoint.  Answer NULL
+// only when there's no address space or memory left for a segment at all.
+
+memorySpaceStruct *oldSegmentForAllocation(uint64_t size)
+{
+	memorySpaceStruct *segment = oldSegmentWithRoom(size);
+
+	if ((segment == NULL) && growOldSpace(size))
+		segment = oldSegmentWithRoom(size);
+
+	if (segment == NULL) {
+		segment = addOldSegment(size, HEAP_RESERVATION);
+		if (segment == NULL)
+			return NULL;
+		LOGW ("Old space is past the hard limit");
+		requestInterrupt(INTERRUPT_LOW_SPACE);
+		tenureSegment = segment;
+	}
+
+	return segment;
+}
+
 void copyToInactiveSurvivorSpace (oop pointer)
 {
 	oop newObject;
+	uint64_t size = memorySize(pointer);
 
-	if (asObjectHeader(pointer)->flips > 300) {
+	if (isObjectInEdenSpace(pointer))
+		edenSurvivorBytes += size;
+
+	// An object that doesn't fit in the survivor space has to be tenured, even if that
+	// means growing old space
+	if (((asObjectHeader(pointer)->flips >= tenureAge) && (oldSegmentWithRoom(size) != NULL))
+			|| (!hasRoomInSpace(size, InactiveSurvivorSpace) && (oldSegmentForAllocation(size) != NULL))) {
 //		LOGI ("Tenuring %"PRIx64, pointer);
 		newObject = tenure (pointer);
 		copyObjectTo(pointer, newObject);
+		if (asObjectHeader(pointer)->flips < TENURE_AGE_LIMIT) {
+			markTenured(newObject);
+			tenuredBytes += size;
+		}
 		gcCopyToInactiveObjectContents(newObject);
-		registerRememberedSetObject(newObject);
+		markCard(newObject);
 	}
 	else {
-		newObject = allocateObjectInSpace(memorySize(pointer), InactiveSurvivorSpace);
+		newObject = allocateObjectInSpace(size, InactiveSurvivorSpace);
 		copyObjectTo(pointer, newObject);
-		asObjectHeader(newObject)->flips++;
+		// An object that couldn't be tenured keeps aging past the last cohort, and stops
+		// at the largest count flips holds rather than wrapping back to a young age.  The
+		// capped count is still past tenureAge, which never goes above TENURE_AGE_LIMIT,
+		// and is counted in the last cohort, which adjustTenureAge leaves out.
+		if (asObjectHeader(newObject)->flips < 0xFFFF)
+			asObjectHeader(newObject)->flips++;
+		if (asObjectHeader(newObject)->flips < TENURE_AGE_LIMIT)
+			survivorBytesByAge[asObjectHeader(newObject)->flips] += size;
+		else
+			survivorBytesByAge[TENURE_AGE_LIMIT] += size;
 	}
 }
 
@@ -358,16 +974,17 @@ uint64_t gcCopyToInactiveWellKnownObjects()
 //	LOGI ("Finished Relocating Well Known Objects");
 }
 
-uint64_t gcCopyToInactiveStack()
+void gcCopyToInactiveFrame(__attribute__((unused)) oop frame, oop *slots, uint64_t numberOfSlots, void *count)
 {
-	oop frame;
+	*(uint64_t *) count += gcCopyToInactivePointerRange(slots, numberOfSlots);
+}
 
-	for (frame = currentContext;
-		asOop(frame) != ST_NIL;
-		frame = asContext(frame)->frame) {
+uint64_t gcCopyToInactiveStack()
+{
+	uint64_t count = 0;
 
-		gcCopyToInactiveObjectContents(frame);
-	}
+	enumerateStackFrames(currentContext, gcCopyToInactiveFrame, &count);
+	return count;
 }
 
 uint64_t gcCopyToInactiveRegistry()
@@ -399,122 +1016,70 @@ uint64_t gcCopyToInactiveSpace(memorySpaceStruct *space)
 	return count;
 }
 
-uint64_t findRememberedSetObject(oop object)
-{
-
-	uint64_t spaceMaxIndex = (RememberedSet->spaceSize)/sizeof(oop);
-
-	uint64_t index = asObjectHeader(object)->identityHash % spaceMaxIndex;
-	uint64_t startIndex = index;
-
-	while (oopPtr(RememberedSet->space[index]) != NULL)
-	{
-		if (RememberedSet->space[index] == object)
-			return 1;
-
-		index++;
-		if (index >= spaceMaxIndex)
-			index = 0;
-
-		if (startIndex == index)
-		{
-			LOGE ("Remembered Set is full");
-			return 0;
-		}
-	}
-	return 0;
-
-}
+// Mark every card of a segment so the next scavenge scans all of it.  Nothing records
+// which objects point into new space after an image is loaded or a segment moves, so the
+// first scan has to find them.
 
-void registerRememberedSetObject(oop object)
+void markCardsOfSpace(memorySpaceStruct *space)
 {
-		
-	uint64_t spaceMaxIndex = (RememberedSet->spaceSize)/sizeof(oop);
-
-	uint64_t index = asObjectHeader(object)->identityHash % spaceMaxIndex;
-	uint64_t startIndex = index;
+	memset (&cardTable[cardIndex(space)], 1, (size_t) (cardIndex(endOfSpace(space)) - cardIndex(space) + 1));
+}
 
-//	LOGI ("registerRememberedSetObject spaceMaxIndex: %"PRIx64" index: %"PRIx64"", spaceMaxIndex, index);
+// Mark the cards of every segment.  The image's remembered set is cleared since the cards
+// replace it.
 
-	while (oopPtr(RememberedSet->space[index]) != NULL)
-	{
-		if (RememberedSet->space[index] == object)
-			return;
+void markAllCards(void)
+{
+	int i;
 
-		index++;
-		if (index >= spaceMaxIndex)
-			index = 0;
+	for (i = 0; i < numberOfOldSegments; i++)
+		markCardsOfSpace(oldSegments[i]);
 
-		if (startIndex == index)
-		{
-			LOGE ("Remembered Set is full");
-			return;
-		}
-	}
-
-	RememberedSet->space[index] = object;
+	memset (RememberedSet->space, 0, (size_t) (RememberedSet->spaceSize
+		- (spaceHasSpaceObject(RememberedSet) ? sizeof(objectHeaderStruct) : 0)));
 }
 
-int unregisterRememberedSetObject(oop object)
-{
-	uint64_t spaceMaxIndex = (RememberedSet->spaceSize)/sizeof(oop);
-
-	uint64_t index = asObjectHeader(object)->identityHash % spaceMaxIndex;
-	uint64_t startIndex = index;
+// Scan the objects whose headers start in the marked cards of a segment.  A card stays
+// marked while one of its objects still points into new space.  Objects tenured during
+// the scan are scanned as they're copied and mark their own cards.
 
-	while (oopPtr(RememberedSet->space[index]) != NULL)
-	{
-		if (RememberedSet->space[index] == object) {
-			RememberedSet->space[index] = 0;
-			return 1;
+void gcCopyToInactiveSegmentCards(memorySpaceStruct *segment)
+{
+	uint64_t card, cardStart, address, count;
+	uint64_t headerSize = sizeof(objectHeaderStruct);
+	uint64_t headers = asOop(&segment->space[0]);
+
+	for (card = cardIndex(headers); card <= cardIndex(&segment->space[segment->firstFreeBlock]); card++) {
+		if (cardTable[card] == 0)
+			continue;
+
+		cardTable[card] = 0;
+		count = 0;
+		cardStart = cardTableBase + (card << CARD_SHIFT);
+		address = (cardStart <= headers) ? headers : headers + (cardStart - headers + headerSize - 1) / headerSize * headerSize;
+		for (; address < cardStart + CARD_SIZE && address < asOop(&segment->space[segment->firstFreeBlock]);
+				address += headerSize) {
+			oop object = asOop(address);
+
+			if (isFree(object) || isSpaceObject(object))
+				continue;
+
+			count += gcCopyToInactiveObjectContents(object);
 		}
 
-		index++;
-		if (index >= spaceMaxIndex)
-			index = 0;
-
-		if (startIndex == index)
-		{
-			LOGE ("Remembered Set is full");
-			return 0;
-		}
+		if (count != 0)
+			cardTable[card] = 1;
 	}
-	return 0;
 }
 
-void rehashRememberedSet()
+void gcCopyToInactiveCards()
 {
 	int i;
-//	LOGI ("rehashRememberedSet");
 
-	for (i=0; i < ((RememberedSet->spaceSize) / sizeof(oop)); i++)
-	{
-		if (oopPtr(RememberedSet->space[i]) != NULL)
-		{
-			oop object = RememberedSet->space[i];
-			RememberedSet->space[i] = 0;
-			registerRememberedSetObject(object);
-		}
-	}
+	for (i = 0; i < numberOfOldSegments; i++)
+		gcCopyToInactiveSegmentCards(oldSegments[i]);
 }
 
-void gcCopyToInactiveRememberedSet()
-{
-	int i;
-//	LOGI ("gcCopyToInactiveRememberedSet");
-
-	for (i=0; i < ((RememberedSet->spaceSize) / sizeof(oop)); i++)
-	{
-		if (oopPtr(RememberedSet->space[i]) != NULL)
-		{
-			oop object = RememberedSet->space[i];
-			if (gcCopyToInactiveObjectContents(object) == 0)
-				RememberedSet->space[i] = 0;
-		}
-	}
-}
-
-
 void flipSurvivorSpaces()
 {
 	memorySpaceStruct *temp;
@@ -564,7 +1129,7 @@ void clearEden()
 oop tenure (oop object)
 {
 	oop newObject;
-	newObject = allocateObjectInSpace(memorySize(object), OldSpace);
+	newObject = allocateObjectInSpace(memorySize(object), oldSegmentWithRoom(memorySize(object)));
 
 	return newObject;
 }
@@ -573,18 +1138,85 @@ void gcCopyToInactiveForScavenge()
 {
 	gcCopyToInactiveWellKnownObjects();
 	gcCopyToInactiveStack();
-	gcCopyToInactiveRememberedSet();
+	gcCopyToInactiveCards();
 	gcCopyToInactiveSpace(InactiveSurvivorSpace);
-	rehashRememberedSet();
+}
+
+// Set the age at which the next scavenge tenures.  Room is left in the survivor space for
+// the objects expected to survive from Eden at the smoothed survival rate, and the
+// youngest cohorts that fit in the rest of the target stay.
+
+void adjustTenureAge(uint64_t edenBytes)
+{
+	uint64_t target = ActiveSurvivorSpace->spaceSize / 100 * TARGET_SURVIVOR_PERCENT;
+	uint64_t expected, kept = 0;
+	uint16_t age;
+
+	if (edenBytes != 0)
+		survivalRate = (3 * survivalRate + (double) edenSurvivorBytes / (double) edenBytes) / 4;
+
+	expected = (uint64_t) (survivalRate * (double) EdenSpace->spaceSize);
+	target = (expected < target) ? target - expected : 0;
+
+	for (age = 1; age < TENURE_AGE_LIMIT; age++) {
+		kept += survivorBytesByAge[age];
+		if (kept > target)
+			break;
+	}
+
+	tenureAge = (age < minimumTenureAge) ? minimumTenureAge : age;
+}
+
+// Raise the minimum tenure age when too much of what was tenured since the last global
+// collection died in OldSpace, and let it fall again when little did.
+
+void adjustMinimumTenureAge()
+{
+	uint64_t percent;
+
+	if (tenuredBytes == 0)
+		return;
+
+	percent = prematureTenuredBytes * 100 / tenuredBytes;
+	if ((percent > PREMATURE_TENURING_HIGH_PERCENT) && (minimumTenureAge < TENURE_AGE_LIMIT))
+		minimumTenureAge = (minimumTenureAge * 2 < TENURE_AGE_LIMIT) ? minimumTenureAge * 2 : TENURE_AGE_LIMIT;
+	else if ((percent < PREMATURE_TENURING_LOW_PERCENT) && (minimumTenureAge > 1))
+		minimumTenureAge--;
+
+	if (tenureAge < minimumTenureAge)
+		tenureAge = minimumTenureAge;
+
+	LOGI ("Premature tenuring: %" PRIu64 "%% of %" PRIu64 " bytes, minimum tenure age %d",
+		percent, tenuredBytes, minimumTenureAge);
+	tenuredBytes = 0;
+	prematureTenuredBytes = 0;
 }
 
 void scavenge()
 {
+	uint64_t edenBytes = spaceUsedBytes(EdenSpace);
+	uint64_t promotionBytes = edenBytes + spaceUsedBytes(ActiveSurvivorSpace);
+	int i;
+
 //	LOGI ("Scavenging from %"PRIx64" to %"PRIx64"", ActiveSurvivorSpace, InactiveSurvivorSpace);
 
+	statisticsFoldSelectors();
+
+	// Make room beforehand in one segment for everything that could be tenured, so the
+	// scavenge doesn't add a segment for each object that doesn't fit.
+	for (i = 0; i < numberOfOldSegments; i++)
+		if (spaceFreeBytes(oldSegments[i]) > spaceFreeBytes(tenureSegment))
+			tenureSegment = oldSegments[i];
+	if (spaceFreeBytes(tenureSegment) < promotionBytes)
+		growOldSpace(promotionBytes);
+
+	memset (survivorBytesByAge, 0, sizeof(survivorBytesByAge));
+	edenSurvivorBytes = 0;
 	gcCopyToInactiveForScavenge();
 	flipSurvivorSpaces();
 	clearEden();
+	adjustTenureAge(edenBytes);
+	loadSpecialSelectors();
 	captureFastContext(currentContext);
 //	LOGI ("Scavenge finished");
 }
@@ -620,27 +1252,30 @@ void gcQueueMarkObject(oop object)
 	if (isQueuedForMark(object))
 		return;
 
+	// When the queue in Eden is full the object is left for gcRecoverFromMarkQueueOverflow
+	if ((EdenSpace->firstFreeBlock + 1) % spaceSize(EdenSpace) == EdenSpace->lastFreeBlock) {
+		markQueueOverflowed = TRUE;
+		return;
+	}
+
 	queueForMarkObject(object);
 
 	EdenSpace->space[EdenSpace->firstFreeBlock] = object;
 
 	EdenSpace->firstFreeBlock = (EdenSpace->firstFreeBlock + 1) % spaceSize(EdenSpace);
-	if (EdenSpace->firstFreeBlock == EdenSpace->lastFreeBlock) {
-		LOGE("Out of space in Eden during global GC");
-		ERROR_EXIT;
-	}
 }
 
-void gcQueueMarkStack(oop context)
+void gcQueueMarkFrame(__attribute__((unused)) oop frame, oop *slots, uint64_t numberOfSlots, __attribute__((unused)) void *args)
 {
-	oop frame;
+	uint64_t i;
 
-	for (frame = context;
-		asOop(frame) != ST_NIL;
-		frame = asContext(frame)->frame) {
+	for (i = 0; i < numberOfSlots; i++)
+		gcQueueMarkObject(slots[i]);
+}
 
-		gcQueueMarkObject(frame);
-	}
+void gcQueueMarkStack(oop context)
+{
+	enumerateStackFrames(context, gcQueueMarkFrame, NULL);
 }
 
 void gcQueueMarkPointerSpace(memorySpaceStruct *space)
@@ -650,17 +1285,8 @@ void gcQueueMarkPointerSpace(memorySpaceStruct *space)
 		gcQueueMarkObject(space->space[i]);
 }
 
-void gcMarkObject(oop object)
+void gcQueueMarkReferents(oop object)
 {
-	if (isImmediate(object))
-		return;
-
-	if (isMarked(object))
-		return;
-
-	markObject(object);
-	unqueueForMarkObject(object);
-
 	gcQueueMarkObject(asObjectHeader(object)->stClass);
 
 	if (!(isBytes(object))) {
@@ -672,6 +1298,19 @@ void gcMarkObject(oop object)
 	}
 }
 
+void gcMarkObject(oop object)
+{
+	if (isImmediate(object))
+		return;
+
+	if (isMarked(object))
+		return;
+
+	markObject(object);
+	unqueueForMarkObject(object);
+	gcQueueMarkReferents(object);
+}
+
 void gcPropagateMarks()
 {
 	for (; EdenSpace->lastFreeBlock != EdenSpace->firstFreeBlock;  EdenSpace->lastFreeBlock = (EdenSpace->lastFreeBlock + 1) % spaceSize(EdenSpace)) {
@@ -679,13 +1318,45 @@ void gcPropagateMarks()
 	}
 }
 
+void gcRequeueMarkedObject(oop object, void *args)
+{
+	if (isFree(object) || !isMarked(object))
+		return;
+
+	gcQueueMarkReferents(object);
+	gcPropagateMarks();
+}
+
+// Every object the full queue left behind is a root or is referenced by a marked object,
+// so queue the roots and the referents of every marked object again until nothing is
+// left behind.
+
+void gcRecoverFromMarkQueueOverflow()
+{
+	while (markQueueOverflowed) {
+		markQueueOverflowed = FALSE;
+		gcQueueMarkStack(currentContext);
+		gcQueueMarkPointerSpace(WellKnownObjects);
+		gcPropagateMarks();
+
+		enumerateObjectsInOldSpace(gcRequeueMarkedObject, NULL);
+		enumerateObjectsInSpace(ActiveSurvivorSpace, gcRequeueMarkedObject, NULL);
+	}
+}
+
 void sweepObject(oop object, void *args)
 {
 	if (isFree(object)) {return;}
+
+	if (isTenured(object)) {
+		unmarkTenured(object);
+		if (!isMarked(object))
+			prematureTenuredBytes += memorySize(object);
+	}
+
 	if (isMarked(object)) {return;}
 	if (isSpaceObject(object)) {return;}
 
-	unregisterRememberedSetObject(object);
 	markObjectFree(object);
 }
 
@@ -790,7 +1461,7 @@ void dumpOop(oop p, FILE *file)
 	else if (isFloat(p))
 		fprintf (file, "%lf", (double) stFloatToC(p));
 
-	else if ((p >= asOop(&StackSpace->space[0])) && (p <= asOop(&StackSpace->space[StackSpace->spaceSize / sizeof(oop)]))) {
+	else if (stackPageContaining(p) != NULL) {
 		fprintf (file, "stack pointer");
 		}
 	else if (classOf(p) == ST_BYTE_STRING_CLASS)
@@ -854,12 +1525,10 @@ void gcCompactHeaders(memorySpaceStruct *space)
 
 	while ((firstFreeHeader != NULL) && (lastUsedHeader != NULL) && (firstFreeHeader < lastUsedHeader))
 	{
-		int wasRegistered;
-		wasRegistered = unregisterRememberedSetObject(asOop(lastUsedHeader));
 //		LOGI("Move object from %d to %d", headerNumber(lastUsedHeader, space), headerNumber(firstFreeHeader, space));
 		*firstFreeHeader = *lastUsedHeader;
-		if (wasRegistered)
-			registerRememberedSetObject(asOop(firstFreeHeader));
+		if (isObjectInCardTable(lastUsedHeader) && isCardMarked(lastUsedHeader))
+			markCard(firstFreeHeader);
 		markObjectRelocated(lastUsedHeader)
 		;
 		markObjectFree(lastUsedHeader);
@@ -874,9 +1543,6 @@ void gcCompactHeaders(memorySpaceStruct *space)
 		space->firstFreeBlock = 0;
 	else
 		space->firstFreeBlock = ((uint64_t)(lastUsedHeader + 1) - (uint64_t)asObjectHeader(&space->space[0])) / sizeof(oop);
-
-	clearEden();
-	relocateAllObjectPointers();
 }
 
 int objectBodyCompare(const void *a, const void *b)
@@ -900,6 +1566,10 @@ void gcCompactBodies(memorySpaceStruct *space)
 {
 	uint64_t *copyToBody, *copyFromBody, *nextCopyFromBody;
 
+	// A segment that hasn't had anything tenured into it has no bodies to walk
+	if (space->lastFreeBlock + 1 >= spaceSize(space))
+		return;
+
 	copyToBody = copyFromBody = &space->space[spaceSize(space) - 1];
 	nextCopyFromBody = copyFromBody - totalObjectSize(*copyFromBody) -1;
 
@@ -945,25 +1615,36 @@ void relocateObjectPointersInPointerSpace(memorySpaceStruct *space)
 	enumeratePointersInSpace(space, &relocateObjectPointer, NULL);
 }
 
+void relocateFramePointers(__attribute__((unused)) oop frame, oop *slots, uint64_t numberOfSlots, __attribute__((unused)) void *args)
+{
+	uint64_t i;
+
+	for (i = 0; i < numberOfSlots; i++)
+		relocateObjectPointer(&slots[i], NULL);
+}
+
 void relocateAllObjectPointers()
 {
-	relocateObjectPointersInObjectSpace(OldSpace);
+	int i;
+
+	for (i = 0; i < numberOfOldSegments; i++)
+		relocateObjectPointersInObjectSpace(oldSegments[i]);
 	relocateObjectPointersInObjectSpace(EdenSpace);
 	relocateObjectPointersInObjectSpace(ActiveSurvivorSpace);
 	relocateObjectPointersInPointerSpace(WellKnownObjects);
-	relocateObjectPointersInObjectSpace(StackSpace);
-	relocateObjectPointersInPointerSpace(RememberedSet);
-	rehashRememberedSet();
+	enumerateStackFrames(currentContext, relocateFramePointers, NULL);
 }
 
 void globalGarbageCollect()
 {
+	int i;
+
 	LOGI ("Starting global garbage collection");
 
 	scavenge();
-	gcMarkSpaceUnused(OldSpace);
+	for (i = 0; i < numberOfOldSegments; i++)
+		gcMarkSpaceUnused(oldSegments[i]);
 	gcMarkSpaceUnused(ActiveSurvivorSpace);
-	gcMarkSpaceUnused(StackSpace);
 
 	gcPrepareEdenForGC();
 
@@ -971,31 +1652,61 @@ void globalGarbageCollect()
 	gcQueueMarkPointerSpace(WellKnownObjects);
 
 	gcPropagateMarks();
+	gcRecoverFromMarkQueueOverflow();
 
-	gcSweep(OldSpace);
+	for (i = 0; i < numberOfOldSegments; i++)
+		gcSweep(oldSegments[i]);
 	gcSweep(ActiveSurvivorSpace);
-	gcSweep(StackSpace);
-
-	gcCompactSpace(OldSpace);
 
+	// Each segment is compacted on its own and the pointers to all the objects that moved
+	// are fixed in one pass afterwards
+	for (i = 0; i < numberOfOldSegments; i++)
+		gcCompactSpace(oldSegments[i]);
 	clearEden();
-	gcMarkSpaceUnused(OldSpace);
+	relocateAllObjectPointers();
+	methodCacheFlush();
+
+	for (i = 0; i < numberOfOldSegments; i++)
+		gcMarkSpaceUnused(oldSegments[i]);
 	gcMarkSpaceUnused(ActiveSurvivorSpace);
-	gcMarkSpaceUnused(StackSpace);
 
+	shrinkHeap();
+	clearInterrupt(INTERRUPT_GARBAGE_COLLECT);
+	adjustMinimumTenureAge();
 	auditImage();
 	captureFastContext(currentContext);
 }
 
 
+// Give a space a new size.  A space in the heap that already has a space object is
+// resized in place.  Otherwise its objects are copied to a new space, which gets a space
+// object and back pointers for every body.  A new space is copied to the spare new space
+// slot and an old space segment to a free old space slot.
+
 void reallocateSpace(int spaceIndex, uint64_t size)
 {
 	memorySpaceStruct *sourceSpace = Spaces[spaceIndex];
-	memorySpaceStruct *destinationSpace = allocateSpace(size + sizeof(objectHeaderStruct));
+	memorySpaceStruct *destinationSpace;
 	objectHeaderStruct *spaceObject;
 
 	uint64_t index;
 
+	statisticsFoldSelectors();
+	if (isSpaceInHeap(sourceSpace) && spaceHasSpaceObject(sourceSpace) && !isTopHeaderSpace(sourceSpace)) {
+		if (!resizeSpaceInPlace(sourceSpace, size + sizeof(objectHeaderStruct)))
+			LOGE ("Cannot resize space %d to %" PRIu64 " bytes", spaceIndex, size);
+		return;
+	}
+
+	if (!isSpaceInHeap(sourceSpace))
+		destinationSpace = allocateSpace(size + sizeof(objectHeaderStruct));
+	else if (asOop(sourceSpace) - heapBase < NEW_SPACE_RESERVATION)
+		destinationSpace = allocateSpaceInHeap(spareNewSpaceOffset, size + sizeof(objectHeaderStruct));
+	else if (asOop(sourceSpace) - heapBase >= OLD_SPACE_OFFSET)
+		destinationSpace = allocateSpaceInHeap(oldSpaceSlotOffset(), size + sizeof(objectHeaderStruct));
+	else
+		destinationSpace = NULL;
+
 	if (destinationSpace == NULL) {
 		LOGE ("Cannot allocate new space");
 		return;
@@ -1046,8 +1757,15 @@ void reallocateSpace(int spaceIndex, uint64_t size)
 	if (Spaces[spaceIndex] == StackSpace) StackSpace = destinationSpace;
 	if (Spaces[spaceIndex] == WellKnownObjects) WellKnownObjects = destinationSpace;
 	if (Spaces[spaceIndex] == RememberedSet) RememberedSet = destinationSpace;
+	if (Spaces[spaceIndex] == tenureSegment) tenureSegment = destinationSpace;
+	for (index = 0; index < numberOfOldSegments; index++)
+		if (oldSegments[index] == sourceSpace)
+			oldSegments[index] = destinationSpace;
 
 	Spaces[spaceIndex] = destinationSpace;
+	if (isObjectInOldSpaceRegion(destinationSpace))
+		markCardsOfSpace(destinationSpace);
+	methodCacheFlush();
 
-	free (sourceSpace);
+	releaseSpace (sourceSpace);
 }
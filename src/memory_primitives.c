@@ -17,6 +17,8 @@
 #define PRIM_CREATE_OBJECT_HEADER_BACK_POINTERS 301
 #define PRIM_SET_SYSTEM 302
 #define PRIM_REALLOCATE_SPACE 303
+#define PRIM_HEAP_STATISTICS 574
+#define PRIM_SET_HEAP_LIMITS 575
 
 int ExitOnAuditFail = 0;
 #define exitIfNeeded() if (ExitOnAuditFail) exit(1)
@@ -82,7 +84,7 @@ void auditObject(oop object, memorySpaceStruct *space, char *spaceName)
 	}
 */
 
-	if ((asObjectHeader(object)->flags & 0xFF00) != 0) {
+	if ((asObjectHeader(object)->flags & 0xFF00 & ~(QUICKENED | JITTED | INLINE_COPIED_VALUE | TENURED)) != 0) {
 		LOGI ("Audit: Object %"PRIx64" bad flags %x", object, asObjectHeader(object)->flags);
 		exitIfNeeded();
 	}
@@ -115,8 +117,8 @@ void auditObject(oop object, memorySpaceStruct *space, char *spaceName)
 			if (isFree(object))
 				LOGI ("Free object %" PRIx64 " connected to used object %" PRIx64, instVarObject, object);
 			if (isObjectInOldSpace(object) && (isObjectInAnyNewSpace(instVarObject))) {
-				if (!findRememberedSetObject(object))
-					LOGI ("Audit: Object not in remembered set %" PRIx64" %" PRIx64, object, instVarObject);
+				if (!isCardMarked(object))
+					LOGI ("Audit: Object's card isn't marked %" PRIx64" %" PRIx64, object, instVarObject);
 			}
 			auditPointer(instVarObject, object);
 		}
@@ -135,30 +137,28 @@ void auditObjectSpace(memorySpaceStruct *space, char *spaceName)
 	}
 }
 
-void auditStackSpace(oop context, memorySpaceStruct *space, char *spaceName)
+void auditFrame(oop frame, oop *slots, uint64_t numberOfSlots, __attribute__((unused)) void *args)
 {
-/*	oop object;
+	uint64_t i;
 
-	for (object = (oop) &space->space[space->lastFreeBlock + 1];
-			object < (oop)&space->space[spaceSize(space) - 1];
-			object += sizeof (objectHeaderStruct))
-	{
-		auditObject(object, space, spaceName);
+	if (stackPageContaining(frame) == NULL) {
+		LOGI ("Audit: Frame %"PRIx64" not in a stack page", frame);
+		return;
 	}
-*/
-	oop frame;
+
+	for (i = 0; i < numberOfSlots; i++)
+		auditPointer(slots[i], frame);
+}
+
+void auditStackSpace(oop context)
+{
 	if (context == ST_NIL)
 		return;
 
 	if (oopPtr(context) == NULL)
 		return;
 
-	for (frame = context;
-		frame != ST_NIL;
-		frame = asContext(frame)->frame) {
-
-		auditObject(frame, space, spaceName);
-	}
+	enumerateStackFrames(context, auditFrame, NULL);
 }
 
 void auditPointerSpace(memorySpaceStruct *space)
@@ -198,18 +198,22 @@ extern int EdenUsedForGC;
 
 void auditImage()
 {
+	int segment;
+
 	if (!EdenUsedForGC)
 		auditObjectSpace(EdenSpace, "Eden Space");
 	auditObjectSpace(SurvivorSpace1, "Survivor Space 1");
 	auditObjectSpace(SurvivorSpace2, "Survivor Space 2");
-	auditObjectSpace(OldSpace, "Old Space");
-	auditStackSpace(currentContext, currentStackSpace, "Stack Space");
+	for (segment = 0; segment < numberOfOldSegments; segment++)
+		auditObjectSpace(oldSegments[segment], "Old Space");
+	auditStackSpace(currentContext);
 	auditPointerSpace(RememberedSet);
 	auditPointerSpace(WellKnownObjects);
 	auditBackPointers(EdenSpace);
 	auditBackPointers(SurvivorSpace1);
 	auditBackPointers(SurvivorSpace2);
-	auditBackPointers(OldSpace);
+	for (segment = 0; segment < numberOfOldSegments; segment++)
+		auditBackPointers(oldSegments[segment]);
 }
 
 void debugAuditImage()
@@ -282,10 +286,57 @@ void primReallocateObjectSpace()
 	push (cIntToST(0));
 }
 
+// Answer an Array with the number of old space segments, the bytes old space has and
+// uses, the size of the whole heap and the soft and hard heap limits
+void primHeapStatistics()
+{
+	oop array = newInstanceOfClass (ST_ARRAY_CLASS, 6, EdenSpace);
+	uint64_t oldSize = 0, oldUsed = 0;
+	int i;
+
+	for (i = 0; i < numberOfOldSegments; i++) {
+		oldSize += oldSegments[i]->spaceSize;
+		oldUsed += spaceUsedBytes(oldSegments[i]);
+	}
+
+	indexedVarAtIntPut (array, 1, cIntToST(numberOfOldSegments));
+	indexedVarAtIntPut (array, 2, cIntToST(oldSize));
+	indexedVarAtIntPut (array, 3, cIntToST(oldUsed));
+	indexedVarAtIntPut (array, 4, cIntToST(heapSize()));
+	indexedVarAtIntPut (array, 5, cIntToST(heapSoftLimit));
+	indexedVarAtIntPut (array, 6, cIntToST(heapHardLimit));
+
+	push (cIntToST(0));
+	push (array);
+}
+
+// Set the soft and hard heap limits in bytes.  Fail unless both are positive and the
+// soft limit isn't above the hard one.
+void primSetHeapLimits()
+{
+	oop softLimitOop = getLocal(0);
+	oop hardLimitOop = getLocal(1);
+
+	if (!isSmallInteger(softLimitOop) || !isSmallInteger(hardLimitOop)
+			|| (stIntToC(softLimitOop) <= 0) || (stIntToC(softLimitOop) > stIntToC(hardLimitOop))) {
+		push (cIntToST(1));
+		push (getReceiver());
+		return;
+	}
+
+	heapSoftLimit = stIntToC(softLimitOop);
+	heapHardLimit = stIntToC(hardLimitOop);
+
+	push (cIntToST(0));
+	push (getReceiver());
+}
+
 void initializeMemoryPrimitives()
 {
 	primitiveTable[PRIM_AUDIT_IMAGE] = primAuditImage;
 	primitiveTable[PRIM_CREATE_OBJECT_HEADER_BACK_POINTERS] = primReallocateObjectSpaces;
 	primitiveTable[PRIM_SET_SYSTEM] = primSetSystem;	
 	primitiveTable[PRIM_REALLOCATE_SPACE] = primReallocateObjectSpace;
+	primitiveTable[PRIM_HEAP_STATISTICS] = primHeapStatistics;
+	primitiveTable[PRIM_SET_HEAP_LIMITS] = primSetHeapLimits;
 }
@@ -99,7 +99,7 @@ typedef struct {
 #define spaceIsStackManaged(x) isStackSpace(x)
 #define makeStackManagedSpace(x) ((asMemorySpace(x))->spaceFlags |= SPACE_IS_STACK_MANAGED)
 
-#define spaceIsMarkSweepManaged(x) ((x)==OldSpace)
+#define spaceIsMarkSweepManaged(x) (asMemorySpace(x)->spaceType==OLD_SPACE)
 #define makeMarkSweepManagedSpace(x) ((asMemorySpace(x))->spaceFlags |= SPACE_IS_MARK_SWEEP_MANAGED)
 
 #define spaceHasSpaceObject(x) (((asMemorySpace(x))->spaceFlags & SPACE_HAS_SPACE_OBJECT) == SPACE_HAS_SPACE_OBJECT)
@@ -116,17 +116,27 @@ typedef struct {
 } contextStruct;
 #define asContext(x) ((contextStruct *)objectBody(x))
 
+// Frames in the stack pages have no object header.  A frame oop points straight at its
+// contextStruct, so frame fields are reached with asFrame rather than asContext.
+#define asFrame(x) ((contextStruct *)oopPtr(x))
+
 typedef struct {
 	oop *stackPointer;
 	oop *stackOffsetPointer;
 	oop *localsPointer;
 	uint8_t *currentPCPointer;
 	oop *currentPCOffset;
-	uint64_t *stackSpaceFirstFreeBlock;
 	contextStruct *currentContextBody;
 } fastContextStruct;
 
 extern oop contextCopy(oop context);
+typedef void (*frameEnumerationFunction)(oop frame, oop *slots, uint64_t numberOfSlots, void *args);
+extern oop *frameSlotsEnd(oop frame, oop calledFrame);
+extern void enumerateStackFrames(oop context, frameEnumerationFunction function, void *args);
+extern void quickenBytecodes(oop bytecodesOop);
+extern void unquickenBytecodes(oop bytecodesOop);
+extern void unquickenAll(void);
+extern const uint8_t bytecodeLengths[256];
 
 typedef struct {
   uint64_t size;
@@ -139,6 +149,10 @@ typedef struct {
 #define QUEUED_FOR_MARK 32
 #define SPACE_OBJECT 64
 #define VM_MIGRATION_NEW 128
+#define QUICKENED 256
+#define JITTED 512
+#define INLINE_COPIED_VALUE 1024
+#define TENURED 2048
   uint16_t flips;
   uint32_t numberOfNamedInstanceVariables;
   oop stClass;
@@ -164,6 +178,18 @@ typedef struct {
 #define isVMMigrationNew(x) ((asObjectHeader(x)->flags & VM_MIGRATION_NEW) == VM_MIGRATION_NEW)
 #define markVMMigrationNew(x) do {asObjectHeader(x)->flags |= VM_MIGRATION_NEW;} while (0)
 #define unmarkVMMigrationNew(x) do {asObjectHeader(x)->flags &= ~VM_MIGRATION_NEW;} while (0)
+#define isQuickened(x) ((asObjectHeader(x)->flags & QUICKENED) == QUICKENED)
+#define markQuickened(x) do {asObjectHeader(x)->flags |= QUICKENED;} while (0)
+#define unmarkQuickened(x) do {asObjectHeader(x)->flags &= ~QUICKENED;} while (0)
+#define isJitted(x) ((asObjectHeader(x)->flags & JITTED) == JITTED)
+#define markJitted(x) do {asObjectHeader(x)->flags |= JITTED;} while (0)
+#define unmarkJitted(x) do {asObjectHeader(x)->flags &= ~JITTED;} while (0)
+#define isInlineCopiedValue(x) ((asObjectHeader(x)->flags & INLINE_COPIED_VALUE) == INLINE_COPIED_VALUE)
+#define markInlineCopiedValue(x) do {asObjectHeader(x)->flags |= INLINE_COPIED_VALUE;} while (0)
+#define unmarkInlineCopiedValue(x) do {asObjectHeader(x)->flags &= ~INLINE_COPIED_VALUE;} while (0)
+#define isTenured(x) ((asObjectHeader(x)->flags & TENURED) == TENURED)
+#define markTenured(x) do {asObjectHeader(x)->flags |= TENURED;} while (0)
+#define unmarkTenured(x) do {asObjectHeader(x)->flags &= ~TENURED;} while (0)
 
 typedef struct {
   oop bytecodes;
@@ -257,6 +283,43 @@ typedef struct {
 	picCacheEntryStruct entry[PIC_CACHE_SIZE];
 } picCacheStruct;
 
+#define METHOD_CACHE_SIZE 4096
+
+typedef struct {
+	oop selector;
+	oop methodClass;
+	oop method;
+} methodCacheEntryStruct;
+
+#define HOT_METHOD_TABLE_SIZE 1024
+#define HOT_METHOD_QUEUE_SIZE 16
+
+typedef struct {
+	oop method;
+	uint32_t activations;
+	uint32_t backEdges;
+} hotMethodCounterStruct;
+
+#define PROFILE_TABLE_SIZE 4096
+#define PROFILE_MAX_DEPTH 256
+#define PROFILE_FRAME_NAME_SIZE 256
+#define PROFILE_CLASS_NAME_LENGTH 96
+#define PROFILE_SELECTOR_LENGTH 150
+#define PROFILE_DEFAULT_INTERVAL 1000
+
+typedef struct {
+	char *stack;
+	uint64_t hash;
+	uint64_t count;
+} profileStackStruct;
+
+typedef struct {
+	char *name;
+	uint64_t selfCount;
+	uint64_t totalCount;
+	uint64_t lastStack;
+} profileMethodStruct;
+
 
 typedef struct {
   oop method;
@@ -407,7 +470,7 @@ typedef struct{
 
 
 #define jump(offset) do {(*fastContext.currentPCOffset) += (SMALLINTEGER_INCREMENT(1) * (offset)), fastContext.currentPCPointer += (offset);} while(0)
-#define previousFrame(c) asContext((asContext(c)->frame))
+#define previousFrame(c) asFrame((asFrame(c)->frame))
 #define stackAt(i) (fastContext.localsPointer[i])
 #define getReceiver() (stackAt(0))
 
@@ -418,8 +481,11 @@ typedef struct{
 #define getLocal(x)  (stackAt(1+(x)))
 #define setLocal(x,y)  (stackAt(1+(x))=(y))
 
-#define push(x) do {(*fastContext.stackSpaceFirstFreeBlock)++; asObjectHeader(currentContext)->size += sizeof(oop); *fastContext.stackPointer++ = (x); (*fastContext.stackOffsetPointer)+=SMALLINTEGER_INCREMENT(1);} while (0)
-#define pop() ((*fastContext.stackSpaceFirstFreeBlock)--, asObjectHeader(currentContext)->size -= sizeof(oop), (*fastContext.stackOffsetPointer)-=SMALLINTEGER_INCREMENT(1) , *(--fastContext.stackPointer) )
+// Pushing and popping only maintain the stack offset.  The stack space's firstFreeBlock
+// is brought up to date by newStackFrame and the extent of each frame is worked out
+// by frameSlotsEnd.
+#define push(x) do {*fastContext.stackPointer++ = (x); (*fastContext.stackOffsetPointer)+=SMALLINTEGER_INCREMENT(1);} while (0)
+#define pop() ((*fastContext.stackOffsetPointer)-=SMALLINTEGER_INCREMENT(1) , *(--fastContext.stackPointer) )
 #define top() (*(fastContext.stackPointer - 1))
 
 #define simlog(...) do {logPtr += sprintf (logPtr, __VA_ARGS__);} while(0)
@@ -438,7 +504,6 @@ typedef struct{
 #define isImmediate(x)  ((((uint64_t)(x)) & IMMEDIATE_TAG_MASK) != 0)
 #define isCharacter(x)  ((((uint64_t)(x)) & IMMEDIATE_TAG_MASK) == CHAR_TAG)
 #define isSmallInteger(x) ((((uint64_t)(x)) & IMMEDIATE_TAG_MASK) == INT_TAG)
-#define isFloat(x) ((((uint64_t)(x)) & IMMEDIATE_TAG_MASK) == FLOAT_TAG)
 
 #define stIntToC(x) (((int64_t)(x))>>IMMEDIATE_SHIFT)
 #define cIntToST(x) ((oop)(((uint64_t)(x))<<IMMEDIATE_SHIFT | INT_TAG))
@@ -446,40 +511,38 @@ typedef struct{
 #define cCharToST(x) ((oop)(((uint64_t)(x))<<IMMEDIATE_SHIFT | CHAR_TAG))
 extern oop asSumLargeInteger(int64_t x);
 
-// ST floats are in the format:
-// sign: 1 bit    exponent: 8 bits  mantissa 52 bits   tag: 3 bits
+// Immediate floats hold any double whose exponent fits in 8 bits, plus +/-0.0.
+// The IEEE bits are rotated left by one so the sign ends up in the low bit, the
+// exponent is rebased from 11 bits to 8 bits and the result is shifted over the tag:
 //
-// IEEE floats are in the format:
-// sign: 1 bit    exponent: 11 bits  mantissa 52 bits
+// exponent: 8 bits   mantissa: 52 bits   sign: 1 bit   tag: 3 bits
 //
+// Zero has an exponent of 0 so it's left alone instead of being rebased.  Doubles
+// outside this range (very large or small values, denormals, infinities and NaNs)
+// are boxed in an 8 byte instance of the BoxedFloat class (or of Float itself in
+// images that haven't registered BoxedFloat in its well known slot yet).
 
-// To convert an ST float to an IEEE float, shift left by 1 then convert to a signed integer so the exponent
-// is sign extended when we shift back.
 typedef union {
 	uint64_t intValue;
 	double doubleValue;
-	struct {
-		uint64_t mantissa:52;
-		uint64_t exponent: 11;
-		uint64_t sign: 1;
-	} structValue;
 } doubleConverter;
-extern doubleConverter dc;
-
-#define stFloatToC(x) (\
-	(x)==FLOAT_TAG?0.0:(\
-	dc.structValue.mantissa = ((x)&0x007FFFFFFFFFFFF8ull)>>3,\
-	dc.structValue.exponent = ((((x)&0x7F80000000000000ull)>>55)+1023-127),\
-	dc.structValue.sign=(((x)&0x8000000000000000ull)>>63),\
-	dc.doubleValue))
-	
-#define cFloatToST(x) (\
-	dc.doubleValue = (x),\
-	(dc.doubleValue==0.0)?FLOAT_TAG:(\
-		(((uint64_t)dc.structValue.mantissa)<<3) | \
-		((((uint64_t)dc.structValue.exponent)-1023 + 127) << 55) | \
-		(((uint64_t)dc.structValue.sign) << 63) | FLOAT_TAG))
 
+#define doubleToBits(x) (((doubleConverter){.doubleValue = (x)}).intValue)
+#define bitsToDouble(x) (((doubleConverter){.intValue = (x)}).doubleValue)
+#define SMALL_FLOAT_EXPONENT_OFFSET (((uint64_t)(1023 - 127)) << 53)
+
+#define isSmallFloat(x) ((((uint64_t)(x)) & IMMEDIATE_TAG_MASK) == FLOAT_TAG)
+#define hasBoxedFloatClass() ((WellKnownObjects->firstFreeBlock > O_BOXED_FLOAT_CLASS) && (ST_BOXED_FLOAT_CLASS != asOop(NULL)) && (ST_BOXED_FLOAT_CLASS != ST_NIL))
+#define isBoxedFloat(x) ((!isImmediate(x)) && ((asObjectHeader(x)->stClass == ST_FLOAT_CLASS) || (hasBoxedFloatClass() && (asObjectHeader(x)->stClass == ST_BOXED_FLOAT_CLASS))))
+#define isFloat(x) (isSmallFloat(x) || isBoxedFloat(x))
+
+#define smallFloatRotatedBits(x) ((((uint64_t)(x)) >> IMMEDIATE_SHIFT) + (SMALL_FLOAT_EXPONENT_OFFSET & (0 - (uint64_t)((((uint64_t)(x)) >> IMMEDIATE_SHIFT) > 1))))
+#define smallFloatToC(x) bitsToDouble((smallFloatRotatedBits(x) >> 1) | (smallFloatRotatedBits(x) << 63))
+#define boxedFloatToC(x) (*((double *) objectBody(x)))
+#define stFloatToC(x) (isSmallFloat(x) ? smallFloatToC(x) : boxedFloatToC(x))
+
+extern oop cFloatToST(double value);
+extern oop allocateBoxedFloat(double value);
 
 // Object header flags
 #define isBytes(x) ((asObjectHeader(x)->flags & BYTES) == BYTES)
@@ -503,7 +566,7 @@ extern doubleConverter dc;
 #define isFalse(x) ((x) == ST_FALSE?1:0)
 #define classOf(x) ((isSmallInteger(x))? ST_SMALL_INTEGER_CLASS :\
 		(isCharacter(x)) ? ST_CHARACTER_CLASS :\
-		(isFloat(x)) ? ST_FLOAT_CLASS : \
+		(isSmallFloat(x)) ? ST_FLOAT_CLASS : \
 		(isContextPointer(x)) ? ST_SMALL_INTEGER_CLASS : \
 		asObjectHeader(x)->stClass)
 
@@ -513,13 +576,29 @@ extern doubleConverter dc;
 
 #define stOffsetToPC(x) ((x)==asOop(NULL)?asOop(NULL):(asOop(&((uint8_t *)Spaces[(((x)>> 56) - 1) & 0xFF]->space) [((x) & 0xFFFFFFFFFFFFF8) >> 3])))
 
+// Card marking
+//
+// The old space region of the heap is divided into cards of CARD_SIZE bytes, each with a
+// byte in cardTable.  Storing a pointer into an object whose header is in an old space
+// segment marks the header's card and a scavenge scans the objects whose headers start
+// in marked cards.  The unsigned subtraction makes one compare reject objects in new
+// space and on the stack, which are scanned anyway.  The card table is reserved with the
+// heap and only the part covering a segment is committed.
+
+#define CARD_SHIFT 9
+#define CARD_SIZE (1 << CARD_SHIFT)
+#define isObjectInCardTable(o) ((asOop(o) - cardTableBase) < cardTableLimit)
+#define cardIndex(o) ((asOop(o) - cardTableBase) >> CARD_SHIFT)
+#define markCard(o) do {cardTable[cardIndex(o)] = 1;} while (0)
+#define isCardMarked(o) (cardTable[cardIndex(o)] != 0)
+
 // Macros to read and write instance variables.
-// If you write an instance variable with an oop that points to new space,
-// you may need to register the object in the remembered set so that the
-// scavenging garbage collector can find it.
+// If you write an instance variable with an oop that may point to new space,
+// you need to mark the object's card so that the scavenging garbage collector
+// can find it.
 
-#define registerIfNeeded(object,value)     do {if(!isObjectInAnyNewSpace(object) && (isObjectInAnyNewSpace(value)))	\
-      registerRememberedSetObject(asOop(object)); } while (0)
+#define registerIfNeeded(object,value)     do {if(!isImmediate(value) && isObjectInCardTable(object))	\
+      markCard(object); } while (0)
 
 //#define basicInstVarAtIntPut(object, index, value) (oopPtr(asObjectHeader(object)->bodyPointer))[index] = (value)
 
@@ -557,10 +636,21 @@ extern doubleConverter dc;
 // Special Selectors
 // Special selectors are symbols which the VM knows about and needs to use.  These are stored in the SimTalkSystem class
 // in a class instance variable.  The variable contains an array of two elements for each selector - the pointer to the
-// symbol itself and an integer representing the number of arguments for that symbol.
+// symbol itself and an integer representing the number of arguments for that symbol.  The interpreter works from a
+// copy in specialSelectorTable, which loadSpecialSelectors refreshes after anything that can move the symbols.
+
+#define MAX_SPECIAL_SELECTORS 256
 
-#define specialSelectors(i) asOop(instVarAtInt(asSystemClass(ST_SYSTEM_CLASS)->specialSelectors, (i)*2))
-#define specialSelectorArguments(i) stIntToC(instVarAtInt(asSystemClass(ST_SYSTEM_CLASS)->specialSelectors, (i)*2 + 1))
+typedef struct {
+	oop selector;
+	uint64_t numArgs;
+} specialSelectorStruct;
+
+extern specialSelectorStruct specialSelectorTable[MAX_SPECIAL_SELECTORS];
+extern void loadSpecialSelectors(void);
+
+#define specialSelectors(i) (specialSelectorTable[i].selector)
+#define specialSelectorArguments(i) (specialSelectorTable[i].numArgs)
 
 #define SPECIAL_PLUS 0x00
 #define SPECIAL_MINUS 0x01
@@ -583,6 +673,19 @@ extern doubleConverter dc;
 #define SPECIAL_HALT 0x12
 #define SPECIAL_DEBUGIT 0x13
 #define SPECIAL_EVALUATE_JSON 0x14
+#define SPECIAL_AT 0x15
+#define SPECIAL_AT_PUT 0x16
+#define SPECIAL_SIZE 0x17
+#define SPECIAL_CLASS 0x18
+#define SPECIAL_VALUE 0x19
+#define SPECIAL_VALUE_COLON 0x1a
+#define SPECIAL_INT_DIVIDE 0x1b
+#define SPECIAL_MODULO 0x1c
+#define SPECIAL_BIT_AND 0x1d
+#define SPECIAL_DIVIDE 0x1e
+#define SPECIAL_BIT_OR 0x1f
+#define SPECIAL_BIT_XOR 0x20
+#define SPECIAL_BIT_SHIFT 0x21
 
 #define ERROR_EXIT exit(1)
 
@@ -608,7 +711,24 @@ extern memorySpaceStruct *currentStackSpace;
 extern int breakpointHit;
 extern int suspended;
 extern char errorString[];
-extern int eventWaitingFlag;
+
+// Reasons for the interpreter to stop what it's doing at the next safepoint (a send,
+// a return, a primitive call or a backward jump).  They're all kept in the one
+// interruptPending word so the interpreter and native code only ever test that, and
+// anything, including a signal handler, a timer or an I/O callback, can set one with
+// requestInterrupt.
+#define INTERRUPT_BREAKPOINT 1
+#define INTERRUPT_SUSPEND 2
+#define INTERRUPT_ERROR 4
+#define INTERRUPT_HOT_METHODS 8
+#define INTERRUPT_EVENT 16
+#define INTERRUPT_PROFILE 32
+#define INTERRUPT_GARBAGE_COLLECT 64
+#define INTERRUPT_STACK_OVERFLOW 128
+#define INTERRUPT_LOW_SPACE 256
+extern volatile uint32_t interruptPending;
+#define requestInterrupt(x) do {(void) __atomic_fetch_or(&interruptPending, (uint32_t) (x), __ATOMIC_SEQ_CST);} while (0)
+#define clearInterrupt(x) do {(void) __atomic_fetch_and(&interruptPending, ~(uint32_t) (x), __ATOMIC_SEQ_CST);} while (0)
 
 typedef void (*cleanupProcType)(void);
 extern cleanupProcType cleanupProcs[];
@@ -617,18 +737,22 @@ extern int cleanupProcIndex;
 extern void captureFastContext(oop context);
 extern void invoke(oop method, uint64_t numArgs);
 extern void invokeBlock(oop blockClosure, uint64_t numArgs);
+extern oop popCopiedValues(oop blockClosureOop, uint8_t numberOfCopiedVariables);
 extern oop findCompiledMethod (oop selector, oop aClass);
 extern void dispatch (oop selector, uint64_t numArgs);
+extern void dispatchSend (oop selector, uint64_t numArgs);
 extern void setupInterpreter(memorySpaceStruct *space);
 extern void interpret(void);
 extern int basicInterpret(int maxBytecodes);
 extern void invokePrimitive(unsigned short primitiveNumber);
 extern void initializePrimitiveTable(void);
+extern void prepareImage(void);
 extern void launchImage(void);
 
 extern void allocateImageSpace (uint64_t size);
 extern void allocateImageRememberedSet (uint64_t size);
 extern oop allocateObjectInSpace (uint64_t size, memorySpaceStruct *space);
+extern oop allocateObjectInStackSpace (uint64_t size, memorySpaceStruct *space);
 extern oop newInstanceOfClass (oop behavior, uint64_t indexedVars, memorySpaceStruct *space);
 extern void finish(void);
 extern oop identityDictionaryAt (oop dictionary, oop key);
@@ -636,23 +760,62 @@ extern oop identityDictionaryKeyAtValue (oop dictionary, oop value);
 extern oop globalVariableAt(oop symbol);
 
 #define ERROR_BAD_PARAMETER_TYPE 1
+#define PRIMITIVE_TABLE_SIZE 2048
 typedef void (*primitiveFunction)(void);
 extern primitiveFunction primitiveTable[];
+extern uint8_t framelessPrimitive[];
+extern oop *framelessLocalsPointer;
+
+// Primitives that only compute a result from the receiver and arguments (no sends,
+// no block evaluation, no looking at the context chain) can be run by the interpreter
+// on the caller's stack without building a CodeContext.
+
+#define FRAMELESS_PRIMITIVE(n, f) do {primitiveTable[n] = (f); framelessPrimitive[n] = TRUE;} while (0)
+
+// Execution counts kept when the VM is built with VM_STATISTICS (see statistics.c)
+#define STATISTICS_SELECTOR_TABLE_SIZE 4096
+
+typedef struct {
+	uint64_t bytecodes[256];
+	uint64_t specialSends[MAX_SPECIAL_SELECTORS];
+	uint64_t primitiveCalls[PRIMITIVE_TABLE_SIZE];
+	uint64_t messagesNotUnderstood;
+	uint64_t blockActivations;
+} vmStatisticsStruct;
+
+typedef struct {
+	oop selector;
+	uint64_t count;
+} selectorCountStruct;
+
+typedef struct {
+	char *name;
+	uint64_t count;
+} selectorNameCountStruct;
+
+#ifdef VM_STATISTICS
+#define COUNT_STATISTIC(x) ((x)++)
+#define COUNT_SEND(selector) statisticsCountSend(selector)
+#else
+#define COUNT_STATISTIC(x)
+#define COUNT_SEND(selector)
+#endif
 
 extern void initializeFloatPrimitives(void);
 extern void initializeIntegerPrimitives(void);
 extern void initializeSocketPrimitives(void);
 extern void initializeFilePrimitives(void);
 extern void initializeMemoryPrimitives();
+extern void initializeProfilerPrimitives(void);
+extern void initializeStatisticsPrimitives(void);
 
 extern void handleSocketCommands(void);
 
-extern void registerRememberedSetObject(oop);
-extern int unregisterRememberedSetObject(oop);
-
 extern uint8_t *readResource (char *resourceName, uint32_t *sizePtr);
 
 extern void setupRemoteSocket(void);
+extern void evaluate(char *code);
+extern int headless;
 typedef uint64_t readFunctionType(uint8_t *buffer, uint64_t size, void *data);
 extern uint64_t loadImage(readFunctionType *readFunction, void *data, char *filename);
 extern void saveImage(FILE *file);
@@ -674,6 +837,58 @@ extern void dumpWalkback(char *message);
 extern void dispatchSpecial0 (unsigned int selectorNumber, oop receiver);
 extern void dispatchSpecial1 (unsigned int selectorNumber, oop receiver, oop arg1);
 extern void dispatchSpecial2 (unsigned int selectorNumber, oop receiver, oop arg1, oop arg2);
+extern void picFlush();
+extern oop lookupMethod(oop selector, oop classOop);
+extern void methodCacheFlush();
+extern void methodCacheFlushSelector(oop selector);
+extern void flushMethodCaches();
+extern void picClearAll();
+extern uint64_t picHits;
+extern uint64_t picMisses;
+extern uint64_t picMegamorphicSends;
+extern uint64_t picFlushes;
+extern uint64_t methodCacheHits;
+extern uint64_t methodCacheMisses;
+extern uint64_t picFeedback(oop methodOop, oop *feedback);
+extern hotMethodCounterStruct *hotMethodCounterFor(oop methodOop);
+extern void countHotMethod(oop methodOop, int backEdge);
+extern void hotMethodFlush(void);
+extern uint64_t hotMethodThreshold;
+extern uint64_t hotMethodsReported;
+extern void classNameOf(oop aClass, char *className);
+extern int profileStart(uint64_t microseconds);
+extern void profileStop(void);
+extern void profileSample(void);
+extern char *profileCollapsedStacks(void);
+extern char *profileReport(uint64_t topN);
+extern uint64_t profileSamples;
+extern int profiling;
+extern vmStatisticsStruct vmStatistics;
+extern void statisticsCountSend(oop selector);
+extern void statisticsFoldSelectors(void);
+extern void statisticsReport(char *buffer, size_t size, uint64_t top);
+
+#ifdef JIT
+// State shared between basicInterpret and native code generated by jit.c
+
+typedef struct {
+	oop *sp;
+	oop *locals;
+	oop *literals;
+	oop *receiverBody;
+} jitStateStruct;
+
+extern int jitEnabled;
+extern uint64_t jitCompiledMethods;
+extern uint64_t jitNativeEntries;
+extern uint64_t jitFlushes;
+extern void initializeJit(void);
+extern void jitFlush(void);
+extern void jitCountActivation(oop bytecodesOop);
+extern void *jitEntryFor(oop bytecodesOop, uint64_t pcOffset);
+extern uint64_t jitRun(void *entry, jitStateStruct *state);
+#endif
+
 extern void raiseSTError(oop errorClass, char *message);
 extern void scavenge();
 extern uint64_t nextObjectIncrement(oop object);
@@ -681,11 +896,12 @@ extern oop stPtrToC(oop x);
 extern int checkObject(oop x);
 extern void auditImage();
 extern void logBytecode();
-extern uint64_t findRememberedSetObject(oop object);
 extern void globalGarbageCollect();
 extern void startupDebugger();
 extern oop smallToLargeInteger(oop x);
 extern oop largeIntegerTimes(oop x, oop y);
+extern oop smallIntegerBitShift(int64_t x, int64_t shift);
+#define MAX_BIT_SHIFT 0x10000
 
 
 typedef void (*spaceEnumerationFunction)(memorySpaceStruct *, void *args);
@@ -705,6 +921,145 @@ extern memorySpaceStruct *OldSpace;
 extern memorySpaceStruct *WellKnownObjects;
 extern memorySpaceStruct *StackSpace;
 
+extern uint8_t *cardTable;
+extern uint64_t cardTableBase;
+extern uint64_t cardTableLimit;
+extern void markAllCards(void);
+
+// The heap
+//
+// One range of HEAP_RESERVATION bytes of address space is reserved at startup and every
+// space the scavenger or the stack uses is laid out in it at a fixed offset: Eden, both
+// survivor spaces and a spare slot in new space at the start, then the stack pages and
+// then the slots for the old space segments.  Pages are only committed as a space needs
+// them, so a space can grow in place, and whether an object is in new space is a single
+// compare.  The spare slots let reallocateSpace copy a space without leaving its region.
+//
+// WebAssembly has a 4 GB address space and Emscripten's mmap allocates the whole range
+// up front, so the Emscripten build lays out a 1 GB heap with smaller slots instead.
+
+#ifdef __EMSCRIPTEN__
+#define HEAP_RESERVATION (1ull << 30)
+#define NEW_SPACE_SLOT (32ull << 20)
+#define STACK_PAGE_SLOT (8ull << 20)
+#define OLD_SPACE_SLOT (128ull << 20)
+#else
+#define HEAP_RESERVATION (256ull << 30)
+#define NEW_SPACE_SLOT (1ull << 30)
+#define STACK_PAGE_SLOT (64ull << 20)
+#define OLD_SPACE_SLOT (4ull << 30)
+#endif
+#define NEW_SPACE_RESERVATION (4 * NEW_SPACE_SLOT)
+#define EDEN_OFFSET 0
+#define SURVIVOR_SPACE_1_OFFSET (1 * NEW_SPACE_SLOT)
+#define SURVIVOR_SPACE_2_OFFSET (2 * NEW_SPACE_SLOT)
+#define STACK_PAGES_OFFSET NEW_SPACE_RESERVATION
+#define OLD_SPACE_OFFSET (STACK_PAGES_OFFSET + MAX_STACK_PAGES * STACK_PAGE_SLOT)
+#define OLD_SPACE_REGION (HEAP_RESERVATION - OLD_SPACE_OFFSET)
+#define NOT_IN_HEAP (~0ull)
+
+extern uint64_t heapBase;
+#define isSpaceInHeap(s) ((asOop(s) - heapBase) < HEAP_RESERVATION)
+extern void reserveHeap(void);
+extern uint64_t heapSlotSize(uint64_t offset);
+extern memorySpaceStruct *allocateSpaceInHeap(uint64_t offset, uint64_t size);
+extern int resizeSpaceInPlace(memorySpaceStruct *space, uint64_t size);
+
+// Old space segments
+//
+// Old space is made of segments.  OldSpace is the first and is Spaces[7], and the others
+// are extra spaces after it in Spaces, so the image saves and loads each one.  Every
+// segment has its own slot in the old space region, and oldSpaceSlots gives the space in
+// each slot so the segment holding an object is found directly.  When old space needs to
+// grow a new segment is added, of up to OLD_SEGMENT_SIZE unless one object needs more, so
+// the objects already in old space never move outside a global collection.  A global
+// collection compacts each segment on its own and releases the added segments that end
+// up empty.
+
+#define MAX_OLD_SEGMENTS (OLD_SPACE_REGION / OLD_SPACE_SLOT)
+#ifdef __EMSCRIPTEN__
+#define OLD_SEGMENT_SIZE (64ull << 20)
+#define MINIMUM_OLD_SEGMENT_SIZE (16ull << 20)
+#else
+#define OLD_SEGMENT_SIZE (1ull << 30)
+#define MINIMUM_OLD_SEGMENT_SIZE (64ull << 20)
+#endif
+#define NEXT_OLD_SEGMENT (~1ull)
+extern memorySpaceStruct *oldSpaceSlots[];
+extern memorySpaceStruct *oldSegments[];
+extern int numberOfOldSegments;
+extern void findOldSegments(void);
+extern void enumerateObjectsInOldSpace(enumerationFunction function, void *args);
+extern uint64_t oldSpaceSlotOffset(void);
+#define isObjectInOldSpaceRegion(o) ((asOop(o) - heapBase - OLD_SPACE_OFFSET) < OLD_SPACE_REGION)
+#define oldSegmentOf(o) (oldSpaceSlots[(asOop(o) - heapBase - OLD_SPACE_OFFSET) / OLD_SPACE_SLOT])
+
+// Heap sizing
+//
+// Eden and old space grow instead of running out.  Below heapSoftLimit Eden grows by
+// HEAP_GROWTH_PERCENT of its size, which it only does straight after a scavenge when it's
+// empty, and old space by a segment of HEAP_GROWTH_PERCENT of its size.  Past it a space only grows by what it needs and a
+// global collection is requested for the next safepoint.  Nothing grows past
+// heapHardLimit, except that an object that has to go in old space gets a segment past
+// it and the image is sent a low space error.  The old space segments shrink when
+// HEAP_SHRINK_COLLECTIONS global collections in a row leave old space less than
+// HEAP_SHRINK_OCCUPANCY_PERCENT full.  Neither Eden nor OldSpace shrinks below the size
+// it was loaded with.
+
+#ifdef __EMSCRIPTEN__
+#define DEFAULT_HEAP_SOFT_LIMIT (512ull << 20)
+#else
+#define DEFAULT_HEAP_SOFT_LIMIT (1ull << 30)
+#endif
+#define DEFAULT_HEAP_HARD_LIMIT (NEW_SPACE_RESERVATION + OLD_SPACE_REGION)
+#define HEAP_GROWTH_PERCENT 50
+#define HEAP_SHRINK_OCCUPANCY_PERCENT 25
+#define HEAP_SHRINK_COLLECTIONS 3
+#define spaceFreeBytes(s) (((s)->lastFreeBlock + 1 - (s)->firstFreeBlock) * sizeof(oop))
+#define spaceUsedBytes(s) ((s)->spaceSize - spaceFreeBytes(s))
+
+extern uint64_t heapSoftLimit;
+extern uint64_t heapHardLimit;
+extern uint64_t heapSize(void);
+extern void initializeHeapSizing(void);
+extern int growSpace(memorySpaceStruct *space, uint64_t needed);
+extern int growOldSpace(uint64_t needed);
+extern memorySpaceStruct *oldSegmentForAllocation(uint64_t size);
+
+// Tenuring
+//
+// An object's flips count the scavenges it has survived and a scavenge tenures the objects
+// whose flips have reached tenureAge.  After each scavenge tenureAge is set so the cohorts
+// that stay, plus the survivors expected from the next Eden, fill about
+// TARGET_SURVIVOR_PERCENT of a survivor space.  Objects tenured since the last global
+// collection are flagged TENURED and the ones it frees were tenured prematurely.  When too
+// many were, minimumTenureAge goes up so objects stay in new space longer.
+
+#define TENURE_AGE_LIMIT 300
+#define TARGET_SURVIVOR_PERCENT 50
+#define PREMATURE_TENURING_HIGH_PERCENT 25
+#define PREMATURE_TENURING_LOW_PERCENT 5
+extern uint16_t tenureAge;
+extern uint16_t minimumTenureAge;
+
+// The stack grows into additional pages of the same size as StackSpace when it fills.
+// stackPages[0] is StackSpace and the pages above currentStackPage are empty.  The last
+// STACK_RESERVE_PAGES pages are only used once a stack overflow error has been raised,
+// so the process has room to handle it and unwind.
+#ifdef __EMSCRIPTEN__
+#define MAX_STACK_PAGES 16
+#else
+#define MAX_STACK_PAGES 64
+#endif
+#define STACK_RESERVE_PAGES 1
+extern memorySpaceStruct *stackPages[];
+extern int currentStackPage;
+extern memorySpaceStruct *pushStackPage(void);
+extern memorySpaceStruct *popStackPagesTo(oop frame);
+extern memorySpaceStruct *stackPageContaining(oop pointer);
+extern int isObjectInStackPages(oop object);
+#define isPointerInStackPage(p,s) ((asOop(p) - asOop(&(s)->space[0])) < (s)->spaceSize)
+
 extern memorySpaceStruct *ActiveSurvivorSpace;
 extern memorySpaceStruct *InactiveSurvivorSpace;
 extern int tracing;
@@ -748,7 +1103,10 @@ extern int tracing;
 #define O_ERROR_CLASS 31
 #define O_JSON_PARSER_CLASS 32
 #define O_MEMORY_SPACE_CLASS 33
-#define O_LAST_WELL_KNOWN_OBJECT 33
+#define O_HOT_METHOD_HANDLER 34
+#define O_HOT_METHOD_SELECTOR 35
+#define O_BOXED_FLOAT_CLASS 36
+#define O_LAST_WELL_KNOWN_OBJECT 36
 
 #define ST_NIL ((oop)(WellKnownObjects->space[O_NIL]))
 #define ST_TRUE ((oop)(WellKnownObjects->space[O_TRUE]))
@@ -784,29 +1142,36 @@ extern int tracing;
 #define ST_ERROR_CLASS ((oop)(WellKnownObjects->space[O_ERROR_CLASS]))
 #define ST_JSON_PARSER_CLASS ((oop)(WellKnownObjects->space[O_JSON_PARSER_CLASS]))
 #define ST_MEMORY_SPACE_CLASS ((oop)(WellKnownObjects->space[O_MEMORY_SPACE_CLASS]))
+#define ST_HOT_METHOD_HANDLER ((oop)(WellKnownObjects->space[O_HOT_METHOD_HANDLER]))
+#define ST_HOT_METHOD_SELECTOR ((oop)(WellKnownObjects->space[O_HOT_METHOD_SELECTOR]))
+#define ST_BOXED_FLOAT_CLASS ((oop)(WellKnownObjects->space[O_BOXED_FLOAT_CLASS]))
 
 
 // Space testing macros
 //
-// These macros determining which memory space contains the object
+// These macros determining which memory space contains the object.  isObjectInNewSpace
+// only checks that the object is in the new space region of the heap, which includes the
+// inactive survivor space, so the scavenger tests for that space first.
 
-#define isObjectInSpace(o,s) ((!isImmediate(o)) && (isStackSpace(s)? ((asOop(o) >= asOop(&s->space[s->lastFreeBlock+1])) && (asOop(o) < asOop(&s->space[s->spaceSize / sizeof(oop)]))) : ((asOop(o) >= asOop(&s->space[0])) && (asOop(o) < asOop(&s->space[s->firstFreeBlock])))))
+#define isObjectInSpace(o,s) ((!isImmediate(o)) && (isStackSpace(s)? \
+		((asOop(o) - asOop(&(s)->space[(s)->lastFreeBlock + 1])) < (s)->spaceSize - ((s)->lastFreeBlock + 1) * sizeof(oop)) : \
+		((asOop(o) - asOop(&(s)->space[0])) < (s)->firstFreeBlock * sizeof(oop))))
 #define isObjectInActiveSurvivorSpace(o) (isObjectInSpace((o),ActiveSurvivorSpace))
 #define isObjectInInactiveSurvivorSpace(o) (isObjectInSpace((o),InactiveSurvivorSpace))
 #define isObjectInEdenSpace(o) (isObjectInSpace((o),EdenSpace))
-#define isObjectInNewSpace(o) (isObjectInSpace((o),EdenSpace) || isObjectInSpace((o),ActiveSurvivorSpace))
-#define isObjectInAnyNewSpace(o) (isObjectInNewSpace((o)) || isObjectInActiveSurvivorSpace((o)))
-#define isObjectInOldSpace(o) (isObjectInSpace((o),OldSpace))
-#define isObjectInObjectSpace(o) (isObjectInNewSpace(o) || (isObjectInOldSpace(o)))
-#define isObjectInStackSpace(o) (isObjectInSpace((o),StackSpace))
+#define isObjectInNewSpace(o) ((!isImmediate(o)) && ((asOop(o) - heapBase) < NEW_SPACE_RESERVATION))
+#define isObjectInAnyNewSpace(o) (isObjectInNewSpace(o))
+#define isObjectInOldSpace(o) ((!isImmediate(o)) && isObjectInOldSpaceRegion(o) && (oldSegmentOf(o) != NULL) && isObjectInSpace((o),oldSegmentOf(o)))
+#define isObjectInObjectSpace(o) (isObjectInEdenSpace(o) || isObjectInActiveSurvivorSpace(o) || (isObjectInOldSpace(o)))
+#define isObjectInStackSpace(o) (isObjectInStackPages(o))
 #define isObjectInWellKnownObjectsSpace(o) (isObjectInSpace((o),WellKnownObjectsSpace))
-#define isObjectInActiveMemorySpace(o) (isObjectInNewSpace(o) ||  isObjectInOldSpace(o))
+#define isObjectInActiveMemorySpace(o) (isObjectInObjectSpace(o))
 
 #define isBodyInSpace(o,s) ((!isImmediate(o)) && ((asObjectHeader(o)->bodyPointer) >= (oop)&((s)->space[s->lastFreeBlock + 1])) && ((asObjectHeader(o)->bodyPointer) < (oop) endOfSpace(s)))
 #define isBodyInEdenSpace(o) (isBodyInSpace((o),EdenSpace))
 #define isBodyInActiveSurvivorSpace(o) (isBodyInSpace((o),ActiveSurvivorSpace))
 #define isBodyInInactiveSurvivorSpace(o) (isBodyInSpace((o),InactiveSurvivorSpace))
-#define isBodyInOldSpace(o) (isBodyInSpace((o),OldSpace))
+#define isBodyInOldSpace(o) (isBodyInSpace((o),oldSegmentOf(o)))
 #define isValidPointerOop(o) (isObjectInNewSpace(o) || isObjectInObjectSpace(o) || isObjectInStackSpace(o))
 #define isValidOop(o) (isImmediate(o) || isSpaceObject(o) || isValidPointerOop(o))
 
@@ -17,7 +17,6 @@
 #include <emscripten/emscripten.h>
 #endif
 
-#define PRIMITIVE_TABLE_SIZE 2048
 
 
 #define PRIM_BASIC_AT 60
@@ -32,6 +31,7 @@
 #define PRIM_CLASS 111
 #define PRIM_CHARACTER_AS_INTEGER 410
 #define PRIM_CHARACTER_NEW_COLON 411
+#define PRIM_MICROSECONDS 412
 #define PRIM_VALUE 501
 #define PRIM_VALUE_COLON 502
 #define PRIM_VALUE_VALUE 503
@@ -54,6 +54,14 @@
 #define PRIM_WALKBACK 557
 #define PRIM_SAVE_IMAGE 558
 #define PRIM_GLOBAL_GC 559
+#define PRIM_FLUSH_INLINE_CACHES 560
+#define PRIM_INLINE_CACHE_STATISTICS 561
+#define PRIM_FLUSH_METHOD_CACHES_FOR 562
+#define PRIM_UNQUICKENED_BYTECODES 563
+#define PRIM_SEND_SITE_FEEDBACK 564
+#define PRIM_EXECUTION_COUNTS 565
+#define PRIM_BLOCK_COPIED_VALUES 566
+#define PRIM_BLOCK_COPIED_VALUES_PUT 567
 
 #define PRIM_MARK_VM_MIGRATION_NEW 701
 #define PRIM_UNMARK_VM_MIGRATION_NEW 702
@@ -86,6 +94,7 @@ uint64_t numberOfSuspends = 0;
 uint64_t wakeupTime;
 
 primitiveFunction primitiveTable[PRIMITIVE_TABLE_SIZE];
+uint8_t framelessPrimitive[PRIMITIVE_TABLE_SIZE];
 
 
 void primIdentityHash()
@@ -130,7 +139,7 @@ void primNew()
 	oop newObjectOop;
 
 	newObjectOop = newInstanceOfClass (receiverOop, 0, EdenSpace);
-	if (asObjectHeader(newObjectOop) == NULL) {
+	if (newObjectOop == ST_NIL) {
 		push (cIntToST(1));
 		push (getReceiver());
 		return;
@@ -155,7 +164,7 @@ void primNewColon()
 	}
 
 	newObjectOop = newInstanceOfClass (receiverOop, stIntToC(arg0Oop), EdenSpace);
-	if (asObjectHeader(newObjectOop) == NULL) {
+	if (newObjectOop == ST_NIL) {
 		push (cIntToST(1));
 		push (getReceiver());
 		return;
@@ -261,6 +270,11 @@ void primBasicAtPut()
 			push (receiver);
 		}
 		else {
+#ifdef JIT
+			// Native code compiled from these bytecodes is now out of date
+			if (isJitted(receiver))
+				jitFlush();
+#endif
 			basicByteAtIntPut(receiver, indexInt, stIntToC(value));
 			push (cIntToST(0));
 			push (value);
@@ -383,7 +397,7 @@ void primSuspend()
 	// LOGW("System suspended on event processing");
     
 	suspended = 1;
-	eventWaitingFlag = TRUE;
+	requestInterrupt(INTERRUPT_SUSPEND);
 	push (cIntToST(0));
 	push (cIntToST(1));
 }
@@ -423,6 +437,26 @@ void primMilliseconds()
 	push (cIntToST(result));
 }
 
+// A monotonic clock for timing code.  Unlike the millisecond clock it doesn't jump
+// when the system time is changed.
+void primMicroseconds()
+{
+	uint64_t result;
+#ifdef WINDOWS
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	result = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	result = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	push (cIntToST(0));
+	push (cIntToST(result));
+}
+
 
 void primFinish()
 {
@@ -521,7 +555,13 @@ void primFloatAtPut() {
 void primUninterpretedBytesCopy() {
 	oop receiverOop = getReceiver();
 	oop copyOop = newInstanceOfClass(asObjectHeader(receiverOop)->stClass, basicByteSize(receiverOop), EdenSpace);
+	if (copyOop == ST_NIL) {
+		push (cIntToST(1));
+		push (getReceiver());
+		return;
+	}
 
+	receiverOop = getReceiver();
 	int i;
 	for (i=0; i<basicByteSize(receiverOop); i++)
 		basicByteAtIntPut(copyOop,i,basicByteAtInt(receiverOop,i));
@@ -630,6 +670,7 @@ void primAllInstances(){
 	// Collect instances in survivor space
 	oop object;
 	uint64_t instances = 0;
+	int segment;
 
 	for (object = (oop) &ActiveSurvivorSpace->space[0];
 			object < (oop) &ActiveSurvivorSpace->space[ActiveSurvivorSpace->firstFreeBlock];
@@ -645,18 +686,23 @@ void primAllInstances(){
 		}
 	}
 
-	// Collect instances in old space
-	for (object = (oop) &OldSpace->space[0];
-			object < (oop) &OldSpace->space[OldSpace->firstFreeBlock];
-			object += nextObjectIncrement(object) * sizeof(oop))
+	// Collect instances in each old space segment
+	for (segment = 0; segment < numberOfOldSegments; segment++)
 	{
-		if (asObjectHeader(object)->stClass == receiver)
+		memorySpaceStruct *space = oldSegments[segment];
+
+		for (object = (oop) &space->space[0];
+				object < (oop) &space->space[space->firstFreeBlock];
+				object += nextObjectIncrement(object) * sizeof(oop))
 		{
-			asObjectHeader(array)->size += sizeof(oop);
-			asObjectHeader(array)->bodyPointer -= sizeof(oop);
-			indexedVarAtIntPut(array, 1, object);
-			EdenSpace->lastFreeBlock--;
-			instances++;
+			if (asObjectHeader(object)->stClass == receiver)
+			{
+				asObjectHeader(array)->size += sizeof(oop);
+				asObjectHeader(array)->bodyPointer -= sizeof(oop);
+				indexedVarAtIntPut(array, 1, object);
+				EdenSpace->lastFreeBlock--;
+				instances++;
+			}
 		}
 	}
 
@@ -676,9 +722,6 @@ void primWalkback(){
 
 void swapHeaders(oop object1, oop object2)
 { 
-	int isObject1Registered = unregisterRememberedSetObject(object1);
-	int isObject2Registered = unregisterRememberedSetObject(object2);
-
 	uint64_t tempSize = asObjectHeader(object1)->size;
 	asObjectHeader(object1)->size = asObjectHeader(object2)->size;
 	asObjectHeader(object2)->size = tempSize;
@@ -710,11 +753,11 @@ void swapHeaders(oop object1, oop object2)
 	setBodyHeaderPointer(object1);
 	setBodyHeaderPointer(object2);
 
-	if (isObject1Registered)
-		registerRememberedSetObject(object2);
-
-	if (isObject2Registered)
-		registerRememberedSetObject(object1);
+	// Each header now has the other's body, so either may point into new space
+	if (isObjectInCardTable(object1))
+		markCard(object1);
+	if (isObjectInCardTable(object2))
+		markCard(object2);
 }
 
 void primBecome(){
@@ -732,6 +775,7 @@ void primBecome(){
 	
 	if (isObjectInActiveSurvivorSpace(receiver) && isObjectInActiveSurvivorSpace(objectToBecome)) {
 		swapHeaders(receiver, objectToBecome);
+		flushMethodCaches();
 		push (cIntToST(0));
 		push (cIntToST(1));
 		return;
@@ -739,6 +783,7 @@ void primBecome(){
 
 	if (isObjectInOldSpace(receiver) && isObjectInOldSpace(objectToBecome)) {
 		swapHeaders(receiver, objectToBecome);
+		flushMethodCaches();
 		push (cIntToST(0));
 		push (cIntToST(1));
 		return;
@@ -759,6 +804,7 @@ void primBecome(){
 	
 	if (isObjectInOldSpace(receiver) && isObjectInOldSpace(objectToBecome)) {
 		swapHeaders(receiver, objectToBecome);
+		flushMethodCaches();
 		push (cIntToST(0));
 		push (cIntToST(1));
 		return;
@@ -796,6 +842,123 @@ void primGlobalGarbageCollect()
 	push (cIntToST(0));
 }
 
+void primFlushInlineCaches()
+{
+	flushMethodCaches();
+	push (cIntToST(0));
+	push (cIntToST(0));
+}
+
+// Called when a method is installed or removed.  Only the global method cache entries
+// for the selector are flushed but the PICs can't be flushed selectively.
+void primFlushMethodCachesFor()
+{
+	oop selector = getLocal( 0);
+
+	methodCacheFlushSelector(selector);
+	picFlush();
+	push (cIntToST(0));
+	push (cIntToST(0));
+}
+
+// Answer the receiver's bytecodes with any quickened bytecodes put back the way the
+// compiler generated them
+void primUnquickenedBytecodes()
+{
+	oop receiver = getReceiver();
+	oop bytecodesOop = getBytecodes(receiver);
+
+	if (isImmediate(bytecodesOop) || !isBytes(bytecodesOop))
+		PRIMITIVE_FAIL(1);
+
+	unquickenBytecodes(bytecodesOop);
+	push (cIntToST(0));
+	push (bytecodesOop);
+}
+
+// Answer an Array describing the classes each send site in the receiver has seen.  Each
+// site is the bytecode offset after the send, the number of classes (-1 if the site is
+// megamorphic) and then the classes.
+void primSendSiteFeedback()
+{
+	oop receiver = getReceiver();
+	oop array;
+	uint64_t size = picFeedback(receiver, NULL);
+
+	array = newInstanceOfClass (ST_ARRAY_CLASS, size, EdenSpace);
+	receiver = getReceiver();
+	picFeedback(receiver, (oop *) objectBody(array));
+
+	push (cIntToST(0));
+	push (array);
+}
+
+// Answer an Array with the number of activations and backward jumps counted for the
+// receiver since the counters were last cleared
+void primExecutionCounts()
+{
+	oop receiver = getReceiver();
+	hotMethodCounterStruct *counter = hotMethodCounterFor(receiver);
+	oop array = newInstanceOfClass (ST_ARRAY_CLASS, 2, EdenSpace);
+
+	indexedVarAtIntPut (array, 1, cIntToST(counter == NULL ? 0 : counter->activations));
+	indexedVarAtIntPut (array, 2, cIntToST(counter == NULL ? 0 : counter->backEdges));
+
+	push (cIntToST(0));
+	push (array);
+}
+
+// Answer the receiver's copied values as an Array, even when the block closure keeps
+// a single copied value inline
+void primBlockCopiedValues()
+{
+	oop receiver = getReceiver();
+	oop array;
+
+	if (!isInlineCopiedValue(receiver)) {
+		push (cIntToST(0));
+		push (asBlockClosure(receiver)->copiedValues);
+		return;
+	}
+
+	array = newInstanceOfClass (ST_ARRAY_CLASS, 1, EdenSpace);
+	receiver = getReceiver();
+	indexedVarAtIntPut (array, 1, asBlockClosure(receiver)->copiedValues);
+
+	push (cIntToST(0));
+	push (array);
+}
+
+void primBlockCopiedValuesPut()
+{
+	oop receiver = getReceiver();
+	oop arg0Oop = getLocal( 0);
+
+	asBlockClosure(receiver)->copiedValues = arg0Oop;
+	registerIfNeeded(receiver, arg0Oop);
+	unmarkInlineCopiedValue(receiver);
+
+	push (cIntToST(0));
+	push (receiver);
+}
+
+// Answer an Array with the PIC hits, misses, megamorphic sends and flushes followed
+// by the global method cache hits and misses
+void primInlineCacheStatistics()
+{
+	oop array = newInstanceOfClass (ST_ARRAY_CLASS, 6, EdenSpace);
+
+	indexedVarAtIntPut (array, 1, cIntToST(picHits));
+	indexedVarAtIntPut (array, 2, cIntToST(picMisses));
+	indexedVarAtIntPut (array, 3, cIntToST(picMegamorphicSends));
+	indexedVarAtIntPut (array, 4, cIntToST(picFlushes));
+	indexedVarAtIntPut (array, 5, cIntToST(methodCacheHits));
+	indexedVarAtIntPut (array, 6, cIntToST(methodCacheMisses));
+
+	push (cIntToST(0));
+	push (array);
+}
+
 void primWellKnownAt()
 {
 	oop arg0Oop = getLocal( 0);
@@ -957,33 +1120,36 @@ void primIsVMMigrationNew()
 void initializePrimitiveTable()
 {
 	int i;
-	for (i=0; i<PRIMITIVE_TABLE_SIZE; i++)
+	for (i=0; i<PRIMITIVE_TABLE_SIZE; i++) {
 		primitiveTable[i] = NULL;
+		framelessPrimitive[i] = FALSE;
+	}
 
-	primitiveTable[PRIM_BASIC_AT] = primBasicAt;
-	primitiveTable[PRIM_BASIC_AT_PUT] = primBasicAtPut;
-	primitiveTable[PRIM_BASIC_SIZE] = primBasicSize;
-	primitiveTable[PRIM_BYTESTRING_BASIC_AT] = primByteStringBasicAt;
-	primitiveTable[PRIM_BYTESTRING_BASIC_AT_PUT] = primByteStringBasicAtPut;
-	primitiveTable[PRIM_NEW] = primNew;
-	primitiveTable[PRIM_NEW_COLON] = primNewColon;
+	FRAMELESS_PRIMITIVE(PRIM_BASIC_AT, primBasicAt);
+	FRAMELESS_PRIMITIVE(PRIM_BASIC_AT_PUT, primBasicAtPut);
+	FRAMELESS_PRIMITIVE(PRIM_BASIC_SIZE, primBasicSize);
+	FRAMELESS_PRIMITIVE(PRIM_BYTESTRING_BASIC_AT, primByteStringBasicAt);
+	FRAMELESS_PRIMITIVE(PRIM_BYTESTRING_BASIC_AT_PUT, primByteStringBasicAtPut);
+	FRAMELESS_PRIMITIVE(PRIM_NEW, primNew);
+	FRAMELESS_PRIMITIVE(PRIM_NEW_COLON, primNewColon);
 	primitiveTable[PRIM_VALUE] = primBlockValue;
 	primitiveTable[PRIM_VALUE_COLON] = primBlockValueColon;
 	primitiveTable[PRIM_VALUE_VALUE] = primBlockValueValue;
-	primitiveTable[PRIM_CHARACTER_AS_INTEGER] = primCharacterAsInteger;
-	primitiveTable[PRIM_CHARACTER_NEW_COLON] = primCharacterNewColon;
-	primitiveTable[PRIM_IDENTITY_HASH] = primIdentityHash;
-	primitiveTable[PRIM_IDENTICAL] = primIdentical;
-	primitiveTable[PRIM_CLASS] = primClass;
+	FRAMELESS_PRIMITIVE(PRIM_CHARACTER_AS_INTEGER, primCharacterAsInteger);
+	FRAMELESS_PRIMITIVE(PRIM_CHARACTER_NEW_COLON, primCharacterNewColon);
+	FRAMELESS_PRIMITIVE(PRIM_IDENTITY_HASH, primIdentityHash);
+	FRAMELESS_PRIMITIVE(PRIM_IDENTICAL, primIdentical);
+	FRAMELESS_PRIMITIVE(PRIM_CLASS, primClass);
 	primitiveTable[PRIM_SUSPEND] = primSuspend;
 	primitiveTable[PRIM_LOG] = primLog;
 	primitiveTable[PRIM_HALT] = primHalt;
 	primitiveTable[PRIM_MILLISECONDS] = primMilliseconds;
+	primitiveTable[PRIM_MICROSECONDS] = primMicroseconds;
 	primitiveTable[PRIM_FINISH] = primFinish;
 	primitiveTable[PRIM_INST_VAR_AT] = primInstVarAt;
 	primitiveTable[PRIM_INST_VAR_AT_PUT] = primInstVarAtPut;
-    primitiveTable[PRIM_FLOAT_AT] = primFloatAt;
-    primitiveTable[PRIM_FLOAT_AT_PUT] = primFloatAtPut;
+    FRAMELESS_PRIMITIVE(PRIM_FLOAT_AT, primFloatAt);
+    FRAMELESS_PRIMITIVE(PRIM_FLOAT_AT_PUT, primFloatAtPut);
 	primitiveTable[PRIM_UNINTERPRETED_BYTES_COPY] = primUninterpretedBytesCopy;
     primitiveTable[PRIM_PLATFORM] = primPlatform;
     primitiveTable[PRIM_SYSTEM_CURRENT_DATE_AND_TIME] = primSystemCurrentDateAndTime;
@@ -996,6 +1162,14 @@ void initializePrimitiveTable()
 	primitiveTable[PRIM_WALKBACK] = primWalkback;
 	primitiveTable[PRIM_SAVE_IMAGE] = primSaveImage;
 	primitiveTable[PRIM_GLOBAL_GC] = primGlobalGarbageCollect;
+	primitiveTable[PRIM_FLUSH_INLINE_CACHES] = primFlushInlineCaches;
+	primitiveTable[PRIM_INLINE_CACHE_STATISTICS] = primInlineCacheStatistics;
+	primitiveTable[PRIM_FLUSH_METHOD_CACHES_FOR] = primFlushMethodCachesFor;
+	primitiveTable[PRIM_UNQUICKENED_BYTECODES] = primUnquickenedBytecodes;
+	primitiveTable[PRIM_SEND_SITE_FEEDBACK] = primSendSiteFeedback;
+	primitiveTable[PRIM_EXECUTION_COUNTS] = primExecutionCounts;
+	primitiveTable[PRIM_BLOCK_COPIED_VALUES] = primBlockCopiedValues;
+	primitiveTable[PRIM_BLOCK_COPIED_VALUES_PUT] = primBlockCopiedValuesPut;
 	primitiveTable[PRIM_SET_CLASS] = primSetClass;
 
 	primitiveTable[PRIM_IS_EMSCRIPTEN] = primIsEmscripten;
@@ -1018,6 +1192,8 @@ void initializePrimitiveTable()
 	initializeSocketPrimitives();
 	initializeFilePrimitives();
 	initializeMemoryPrimitives();
+	initializeProfilerPrimitives();
+	initializeStatisticsPrimitives();
 }
 
 
@@ -1027,10 +1203,11 @@ void invokePrimitive(unsigned short primitiveNumber)
 	{
         LOGW ("Primitive not found - %"PRId64"\n", (uint64_t) primitiveNumber);
 		sprintf(errorString, "Primitive not found - %"PRIx64"\n", (uint64_t) primitiveNumber);
-		eventWaitingFlag = TRUE;
+		requestInterrupt(INTERRUPT_ERROR);
 		return;
 	}
 
+	COUNT_STATISTIC(vmStatistics.primitiveCalls[primitiveNumber]);
 	primitiveTable[primitiveNumber]();
 }
 
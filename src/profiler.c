@@ -0,0 +1,429 @@
+// profiler.c
+//
+// Beagle Smalltalk
+// Copyright (c) 2025 Simberon Incorporated
+// Released under the MIT License
+// https://opensource.org/license/MIT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+#include "object.h"
+
+// A sampling profiler for Smalltalk code.  A profiling timer (SIGPROF) requests
+// INTERRUPT_PROFILE and at the next safepoint the interpreter records the context
+// chain as one line of collapsed stack text, outermost frame first:
+//
+//     BeagleSystem class>>start;Foo>>bar;[] in Foo>>bar;Foo>>baz 12
+//
+// Identical stacks are counted in a hash table, so the result can be fed straight
+// to flamegraph.pl or speedscope, or summarized as a self/total time report.
+// Frameless primitives and quick methods don't have a frame, so their time is
+// charged to the method that called them.
+
+#define PRIM_PROFILE_START 568
+#define PRIM_PROFILE_STOP 569
+#define PRIM_PROFILE_STACKS 570
+#define PRIM_PROFILE_REPORT 571
+
+profileStackStruct profileStacks[PROFILE_TABLE_SIZE];
+uint64_t profileSamples = 0;
+uint64_t profileDroppedSamples = 0;
+int profiling = 0;
+char profileStackBuffer[PROFILE_MAX_DEPTH * PROFILE_FRAME_NAME_SIZE];
+
+uint64_t profileHash(char *string)
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	while (*string != '\0')
+		hash = (hash ^ (uint8_t) *string++) * 1099511628211ull;
+
+	return hash;
+}
+
+// Write "Class>>selector" for a method, or "[] in Class>>selector" for a block,
+// using the selector stored in the method rather than searching the method dictionary.
+void profileFrameName(oop methodOop, char *name)
+{
+	char className[256], selectorString[256];
+	int isBlock = 0;
+
+	while ((classOf(methodOop) == ST_COMPILED_BLOCK_CLASS) && (asCompiledMethod(methodOop)->selector != ST_NIL)) {
+		// A block keeps its outer method where a method keeps its selector
+		methodOop = asCompiledMethod(methodOop)->selector;
+		isBlock = 1;
+	}
+
+	if (classOf(methodOop) == ST_COMPILED_BLOCK_CLASS) {
+		strcpy (name, "[] in ?");
+		return;
+	}
+
+	classNameOf(asCompiledMethod(methodOop)->mclass, className);
+
+	oop selectorOop = asCompiledMethod(methodOop)->selector;
+	if (classOf(selectorOop) == ST_BYTE_SYMBOL_CLASS && basicByteSize(selectorOop) < sizeof(selectorString))
+		STStringToC(selectorOop, selectorString);
+	else
+		strcpy (selectorString, "?");
+
+	// Leave room for "[] in ", ">>" and the terminator; long names are cut short
+	snprintf (name, PROFILE_FRAME_NAME_SIZE, "%s%.*s>>%.*s", isBlock ? "[] in " : "",
+		PROFILE_CLASS_NAME_LENGTH, className, PROFILE_SELECTOR_LENGTH, selectorString);
+}
+
+void profileRecord(char *stack)
+{
+	uint64_t hash = profileHash(stack);
+	uint64_t index = hash & (PROFILE_TABLE_SIZE - 1);
+	uint64_t probes;
+
+	for (probes = 0; probes < PROFILE_TABLE_SIZE; probes++) {
+		profileStackStruct *entry = &profileStacks[index];
+
+		if (entry->stack == NULL) {
+			entry->stack = strdup(stack);
+			if (entry->stack == NULL)
+				break;
+			entry->hash = hash;
+			entry->count = 1;
+			return;
+		}
+
+		if ((entry->hash == hash) && (strcmp(entry->stack, stack) == 0)) {
+			entry->count++;
+			return;
+		}
+
+		index = (index + 1) & (PROFILE_TABLE_SIZE - 1);
+	}
+
+	profileDroppedSamples++;
+}
+
+// Called by the interpreter at a safepoint after the profiling timer has fired.
+void profileSample(void)
+{
+	char *stack = profileStackBuffer;
+	oop frames[PROFILE_MAX_DEPTH];
+	char name[PROFILE_FRAME_NAME_SIZE];
+	int depth = 0, truncated = 0, i;
+	size_t length = 0;
+	oop frame;
+
+	if (!profiling || (currentContext == ST_NIL))
+		return;
+
+	for (frame = currentContext; asFrame(frame)->method != ST_NIL; frame = asFrame(frame)->frame) {
+		if (depth == PROFILE_MAX_DEPTH) {
+			truncated = 1;
+			break;
+		}
+		frames[depth++] = asFrame(frame)->method;
+	}
+
+	if (depth == 0)
+		return;
+
+	stack[0] = '\0';
+	if (truncated)
+		length += snprintf (&stack[length], sizeof(profileStackBuffer) - length, "...;");
+
+	for (i = depth - 1; i >= 0; i--) {
+		profileFrameName(frames[i], name);
+		length += snprintf (&stack[length], sizeof(profileStackBuffer) - length, (i == 0) ? "%s" : "%s;", name);
+		if (length >= sizeof(profileStackBuffer))
+			break;
+	}
+
+	profileSamples++;
+	profileRecord(stack);
+}
+
+void profileReset(void)
+{
+	int i;
+
+	for (i = 0; i < PROFILE_TABLE_SIZE; i++) {
+		free (profileStacks[i].stack);
+		profileStacks[i].stack = NULL;
+		profileStacks[i].count = 0;
+	}
+
+	profileSamples = 0;
+	profileDroppedSamples = 0;
+}
+
+#if defined(WINDOWS) || defined(__EMSCRIPTEN__)
+int profileStart(__attribute__((unused)) uint64_t microseconds)
+{
+	return 0;
+}
+
+void profileStop(void)
+{
+}
+#else
+void profileSignalHandler(__attribute__((unused)) int signalNumber)
+{
+	requestInterrupt(INTERRUPT_PROFILE);
+}
+
+// Start sampling every so many microseconds of CPU time, throwing away any earlier profile.
+int profileStart(uint64_t microseconds)
+{
+	struct sigaction action;
+	struct itimerval timer;
+
+	if (microseconds == 0)
+		microseconds = PROFILE_DEFAULT_INTERVAL;
+
+	profileStop();
+	profileReset();
+
+	memset (&action, 0, sizeof(action));
+	action.sa_handler = profileSignalHandler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset (&action.sa_mask);
+	if (sigaction (SIGPROF, &action, NULL) != 0)
+		return 0;
+
+	timer.it_interval.tv_sec = microseconds / 1000000;
+	timer.it_interval.tv_usec = microseconds % 1000000;
+	timer.it_value = timer.it_interval;
+	if (setitimer (ITIMER_PROF, &timer, NULL) != 0)
+		return 0;
+
+	profiling = 1;
+	return 1;
+}
+
+void profileStop(void)
+{
+	struct itimerval timer;
+
+	memset (&timer, 0, sizeof(timer));
+	setitimer (ITIMER_PROF, &timer, NULL);
+	profiling = 0;
+	clearInterrupt(INTERRUPT_PROFILE);
+}
+#endif
+
+// Append to a growing malloc'd buffer.
+void profileAppend(char **buffer, size_t *length, size_t *capacity, char *format, ...)
+{
+	va_list args;
+	int needed;
+
+	if (*buffer == NULL)
+		return;
+
+	va_start (args, format);
+	needed = vsnprintf (NULL, 0, format, args);
+	va_end (args);
+
+	if (*length + needed + 1 > *capacity) {
+		size_t newCapacity = (*capacity + needed + 1) * 2;
+		char *newBuffer = realloc(*buffer, newCapacity);
+		if (newBuffer == NULL) {
+			free (*buffer);
+			*buffer = NULL;
+			return;
+		}
+		*buffer = newBuffer;
+		*capacity = newCapacity;
+	}
+
+	va_start (args, format);
+	vsnprintf (&(*buffer)[*length], *capacity - *length, format, args);
+	va_end (args);
+	*length += needed;
+}
+
+// Answer the profile as collapsed stack text, one "frame;frame;frame count" line per
+// distinct stack.  The caller frees the result.
+char *profileCollapsedStacks(void)
+{
+	size_t length = 0, capacity = 4096;
+	char *buffer = malloc(capacity);
+	int i;
+
+	if (buffer == NULL)
+		return NULL;
+	buffer[0] = '\0';
+
+	for (i = 0; i < PROFILE_TABLE_SIZE; i++)
+		if (profileStacks[i].stack != NULL)
+			profileAppend(&buffer, &length, &capacity, "%s %" PRIu64 "\n", profileStacks[i].stack, profileStacks[i].count);
+
+	return buffer;
+}
+
+profileMethodStruct *profileMethodNamed(profileMethodStruct *methods, uint64_t size, char *name, size_t nameLength)
+{
+	char key[PROFILE_FRAME_NAME_SIZE];
+	uint64_t index, probes;
+
+	if (nameLength >= sizeof(key))
+		nameLength = sizeof(key) - 1;
+	memcpy (key, name, nameLength);
+	key[nameLength] = '\0';
+
+	index = profileHash(key) % size;
+	for (probes = 0; probes < size; probes++) {
+		if (methods[index].name == NULL) {
+			methods[index].name = strdup(key);
+			return methods[index].name == NULL ? NULL : &methods[index];
+		}
+		if (strcmp(methods[index].name, key) == 0)
+			return &methods[index];
+		index = (index + 1) % size;
+	}
+
+	return NULL;
+}
+
+int profileCompareMethods(const void *a, const void *b)
+{
+	const profileMethodStruct *x = (const profileMethodStruct *) a;
+	const profileMethodStruct *y = (const profileMethodStruct *) b;
+
+	if (x->selfCount != y->selfCount)
+		return (x->selfCount < y->selfCount) ? 1 : -1;
+	if (x->totalCount != y->totalCount)
+		return (x->totalCount < y->totalCount) ? 1 : -1;
+	if (x->name == NULL || y->name == NULL)
+		return (x->name == NULL) - (y->name == NULL);
+	return strcmp(x->name, y->name);
+}
+
+// Answer the top methods by self time (samples where the method was running) along with
+// their total time (samples where it was anywhere on the stack, counting recursion once).
+// The caller frees the result.
+char *profileReport(uint64_t topN)
+{
+	uint64_t size = PROFILE_TABLE_SIZE * 4;
+	profileMethodStruct *methods = calloc(size, sizeof(profileMethodStruct));
+	size_t length = 0, capacity = 4096;
+	char *buffer = malloc(capacity);
+	uint64_t i, shown;
+
+	if ((methods == NULL) || (buffer == NULL)) {
+		free (methods);
+		free (buffer);
+		return NULL;
+	}
+	buffer[0] = '\0';
+
+	for (i = 0; i < PROFILE_TABLE_SIZE; i++) {
+		char *start, *end;
+		profileMethodStruct *method = NULL;
+
+		if (profileStacks[i].stack == NULL)
+			continue;
+
+		for (start = profileStacks[i].stack; ; start = end + 1) {
+			end = strchr(start, ';');
+			if (end == NULL)
+				end = start + strlen(start);
+
+			method = profileMethodNamed(methods, size, start, end - start);
+			if ((method != NULL) && (method->lastStack != i + 1)) {
+				method->totalCount += profileStacks[i].count;
+				method->lastStack = i + 1;
+			}
+
+			if (*end == '\0')
+				break;
+		}
+
+		if (method != NULL)
+			method->selfCount += profileStacks[i].count;
+	}
+
+	qsort (methods, size, sizeof(profileMethodStruct), profileCompareMethods);
+
+	profileAppend(&buffer, &length, &capacity, "%" PRIu64 " samples", profileSamples);
+	if (profileDroppedSamples > 0)
+		profileAppend(&buffer, &length, &capacity, " (%" PRIu64 " dropped)", profileDroppedSamples);
+	profileAppend(&buffer, &length, &capacity, "\n  self%%  total%%    self   total  method\n");
+
+	for (i = 0, shown = 0; (i < size) && (shown < topN) && (methods[i].name != NULL); i++, shown++)
+		profileAppend(&buffer, &length, &capacity, "%6.1f  %6.1f  %6" PRIu64 "  %6" PRIu64 "  %s\n",
+			profileSamples ? 100.0 * methods[i].selfCount / profileSamples : 0.0,
+			profileSamples ? 100.0 * methods[i].totalCount / profileSamples : 0.0,
+			methods[i].selfCount, methods[i].totalCount, methods[i].name);
+
+	for (i = 0; i < size; i++)
+		free (methods[i].name);
+	free (methods);
+
+	return buffer;
+}
+
+void primProfileStart()
+{
+	oop interval = getLocal(0);
+
+	if (!isSmallInteger(interval) || (stIntToC(interval) < 0) || !profileStart(stIntToC(interval))) {
+		push (cIntToST(1));
+		push (getReceiver());
+		return;
+	}
+
+	push (cIntToST(0));
+	push (getReceiver());
+}
+
+void primProfileStop()
+{
+	profileStop();
+
+	push (cIntToST(0));
+	push (cIntToST(profileSamples));
+}
+
+void pushProfileString(char *string)
+{
+	if (string == NULL) {
+		push (cIntToST(1));
+		push (getReceiver());
+		return;
+	}
+
+	oop result = CStringToST(string);
+	free (string);
+
+	push (cIntToST(0));
+	push (result);
+}
+
+void primProfileStacks()
+{
+	pushProfileString(profileCollapsedStacks());
+}
+
+void primProfileReport()
+{
+	oop topN = getLocal(0);
+
+	if (!isSmallInteger(topN) || (stIntToC(topN) < 0)) {
+		push (cIntToST(1));
+		push (getReceiver());
+		return;
+	}
+
+	pushProfileString(profileReport(stIntToC(topN)));
+}
+
+void initializeProfilerPrimitives()
+{
+	primitiveTable[PRIM_PROFILE_START] = primProfileStart;
+	primitiveTable[PRIM_PROFILE_STOP] = primProfileStop;
+	primitiveTable[PRIM_PROFILE_STACKS] = primProfileStacks;
+	primitiveTable[PRIM_PROFILE_REPORT] = primProfileReport;
+}
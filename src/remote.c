@@ -23,6 +23,7 @@
 
 char *nextToken;
 int listenfd = 0, connfd = 0;
+int headless = FALSE;
 unsigned long bytes = 0;
 oop debugOop;
 
@@ -109,7 +110,7 @@ void showOop(oop p)
 	else if (isContextPointer(p))
         simlog ("context pointer %" PRIx64, (uint64_t) p);
 
-	else if ((p >= asOop(&StackSpace->space[0])) && (p <= asOop(&StackSpace->space[StackSpace->spaceSize / sizeof(oop)]))) {
+	else if (stackPageContaining(p) != NULL) {
 		simlog ("stack pointer");
 		}
 
@@ -204,10 +205,10 @@ void showStackFrame(contextStruct *context)
 			simlog("Top of stack\n");
 			return;
 		}
-		context = asContext(context->frame);
+		context = asFrame(context->frame);
 	}
 
-	for (stackPtr = asOop(&asContext(context->frame)->stackBody[stIntToC(asContext(context->frame)->stackOffset)]);
+	for (stackPtr = asOop(&asFrame(context->frame)->stackBody[stIntToC(asFrame(context->frame)->stackOffset)]);
 		stackPtr < asOop(&context->stackBody[stIntToC(context->stackOffset)]);
 		stackPtr += sizeof(oop))
 	{
@@ -323,7 +324,7 @@ void dumpThisContext()
 	p++;
 	simlog ("%"PRIx64":  ~%"PRIx64" (pc) [%"PRIx64"]\n",
 		asOop(p), asOop(*p),
-		(uint64_t) (p - asOop(asCompiledMethod(asContext(currentContext)->method)->bytecodes)));
+		(uint64_t) (p - asOop(asCompiledMethod(asFrame(currentContext)->method)->bytecodes)));
 	p++;
 	simlog ("%"PRIx64":  ~%"PRIx64" (method)\n", asOop(p), asOop(*p));
 	p++;
@@ -428,7 +429,7 @@ void dumpBytecodeArguments(oop argumentArray, uint64_t numberOfBytes, uint64_t o
 			oop literal;
 			argPointer++;
 			uint64_t literalNumber = stIntToC(instVarAtInt(argumentArray, argPointer));
-			literal = getLiteral(asContext(currentContext)->method, literalNumber);
+			literal = getLiteral(asFrame(currentContext)->method, literalNumber);
 			showOop(literal);
 			}
 
@@ -436,7 +437,7 @@ void dumpBytecodeArguments(oop argumentArray, uint64_t numberOfBytes, uint64_t o
 			oop literal;
 			argPointer++;
 			uint64_t literalNumber = stIntToC(instVarAtInt(argumentArray, argPointer));
-			literal = getLiteral(asContext(currentContext)->method, literalNumber);
+			literal = getLiteral(asFrame(currentContext)->method, literalNumber);
 			showOop(asAssociation(literal)->key);
 			}
 
@@ -444,7 +445,7 @@ void dumpBytecodeArguments(oop argumentArray, uint64_t numberOfBytes, uint64_t o
 			argPointer++;
 			uint64_t localNumber = stIntToC(instVarAtInt(argumentArray, argPointer));
 			
-			oop localName = indexedVarAtInt(asCompiledMethod(asContext(currentContext)->method)->localVariableNames, localNumber + 1);
+			oop localName = indexedVarAtInt(asCompiledMethod(asFrame(currentContext)->method)->localVariableNames, localNumber + 1);
 			showOop(localName);
 			}
 
@@ -473,7 +474,7 @@ void dumpMethodSource(uint64_t offset)
 {
 	int result;
 
-	oop sourceOffsetsArray = asCompiledMethod(asContext(currentContext)->method)->sourceOffsets;
+	oop sourceOffsetsArray = asCompiledMethod(asFrame(currentContext)->method)->sourceOffsets;
 	uint64_t sourceFileNumber = stIntToC(indexedVarAtInt(sourceOffsetsArray, 1));
 	uint64_t sourceStart = stIntToC(indexedVarAtInt(sourceOffsetsArray, 2));
 	uint64_t sourceEnd = stIntToC(indexedVarAtInt(sourceOffsetsArray, 3));
@@ -555,9 +556,10 @@ void logBytecode()
 	char string[256];
 	int argPointer;
 
+	unquickenBytecodes(getBytecodes(asFrame(currentContext)->method));
 	uint8_t bytecode1 = peekBytecode();
 
-	uint64_t offset = stIntToC(asContext(currentContext)->pcOffset);
+	uint64_t offset = stIntToC(asFrame(currentContext)->pcOffset);
 
 	oop bytecodeTableOop = ST_BYTECODE_TABLE;
 
@@ -684,6 +686,17 @@ EMSCRIPTEN_KEEPALIVE void evaluateJsonCommands(char *buff)
 	stopFrame = oldStopFrame;
 }
 
+// The profile can be bigger than the log, so it goes straight into the send buffer.
+char *remoteProfileText(char *text)
+{
+	if (text == NULL)
+		snprintf (sendBuff, REMOTE_BUFFER_SIZE, "Not enough memory for the profile");
+	else
+		snprintf (sendBuff, REMOTE_BUFFER_SIZE, "%s", text);
+	free (text);
+	return sendBuff;
+}
+
 EMSCRIPTEN_KEEPALIVE char *processCommand(char *buff)
 {
 	char *token = buff;
@@ -707,7 +720,7 @@ EMSCRIPTEN_KEEPALIVE char *processCommand(char *buff)
 		spaces();
 
 	if (strcmp (token, "stack") == 0) {
-		showStackFrame(asContext(currentContext));
+		showStackFrame(asFrame(currentContext));
 		snprintf (sendBuff, REMOTE_BUFFER_SIZE, "%s", logString);
 		return sendBuff;
 	}
@@ -715,6 +728,33 @@ EMSCRIPTEN_KEEPALIVE char *processCommand(char *buff)
 	if (strcmp (token, "step") == 0)
 		step();
 
+	if (strcmp (token, "profileStart") == 0) {
+		char *interval = strtok_r(NULL, " ", &nextToken);
+		if (profileStart(interval == NULL ? 0 : strtoull(interval, NULL, 10)))
+			simlog ("Profiling");
+		else
+			simlog ("Can't start the profiler");
+	}
+
+	if (strcmp (token, "profileStop") == 0) {
+		profileStop();
+		simlog ("%" PRIu64 " samples", profileSamples);
+	}
+
+	if (strcmp (token, "profile") == 0)
+		return remoteProfileText(profileCollapsedStacks());
+
+	if (strcmp (token, "profileReport") == 0) {
+		char *topN = strtok_r(NULL, " ", &nextToken);
+		return remoteProfileText(profileReport(topN == NULL ? 20 : strtoull(topN, NULL, 10)));
+	}
+
+	if (strcmp (token, "statistics") == 0) {
+		char *topN = strtok_r(NULL, " ", &nextToken);
+		statisticsReport(sendBuff, REMOTE_BUFFER_SIZE, topN == NULL ? 20 : strtoull(topN, NULL, 10));
+		return sendBuff;
+	}
+
 	if (strcmp (token, "send") == 0)
 		sendByteCode();
 
@@ -804,8 +844,15 @@ void setupRemoteSocket(void)
 		LOGI("Web socket connected");
 }
 
+// There's no debugger to connect to in a headless run, so a halt or breakpoint stops it.
 void startupDebugger(void)
 {
+	if (headless) {
+		sprintf(errorString, "Halted in a headless run");
+		requestInterrupt(INTERRUPT_ERROR);
+		return;
+	}
+
 	setupRemoteSocket();
 	handleSocketCommands();
 }
@@ -0,0 +1,333 @@
+// statistics.c
+//
+// Beagle Smalltalk
+// Copyright (c) 2025 Simberon Incorporated
+// Released under the MIT License
+// https://opensource.org/license/MIT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "object.h"
+
+// Execution statistics.  When the VM is built with "make STATS=yes" (VM_STATISTICS)
+// basicInterpret counts every bytecode it dispatches, the sends that get as far as a
+// method lookup (by selector), the well known sends (by special selector number, whether
+// or not they were handled inline), primitive calls (by number), messages not understood
+// and block activations.  Native code from the JIT isn't counted.  Without VM_STATISTICS
+// none of the counting code is compiled and the primitives fail.
+//
+// Sends are counted by selector oop.  Selectors can move when the collector runs, so
+// before every scavenge, global collection and space reallocation the counts are folded
+// into a table keyed by the selector's name.
+
+#define PRIM_VM_STATISTICS 572
+#define PRIM_RESET_VM_STATISTICS 573
+
+#ifdef VM_STATISTICS
+vmStatisticsStruct vmStatistics;
+selectorCountStruct selectorCounts[STATISTICS_SELECTOR_TABLE_SIZE];
+selectorNameCountStruct selectorNameCounts[STATISTICS_SELECTOR_TABLE_SIZE];
+uint64_t droppedSelectorCounts = 0;
+
+uint64_t statisticsNameHash(char *string)
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	while (*string != '\0')
+		hash = (hash ^ (uint8_t) *string++) * 1099511628211ull;
+
+	return hash;
+}
+
+void statisticsCountSend(oop selector)
+{
+	uint64_t index = (selector >> IMMEDIATE_SHIFT) & (STATISTICS_SELECTOR_TABLE_SIZE - 1);
+	uint64_t probes;
+
+	for (probes = 0; probes < STATISTICS_SELECTOR_TABLE_SIZE; probes++) {
+		if (selectorCounts[index].selector == selector) {
+			selectorCounts[index].count++;
+			return;
+		}
+
+		if (selectorCounts[index].selector == asOop(NULL)) {
+			selectorCounts[index].selector = selector;
+			selectorCounts[index].count = 1;
+			return;
+		}
+
+		index = (index + 1) & (STATISTICS_SELECTOR_TABLE_SIZE - 1);
+	}
+
+	// The table is full of selectors that haven't been folded yet
+	statisticsFoldSelectors();
+	statisticsCountSend(selector);
+}
+
+void statisticsAddSelectorName(char *name, uint64_t count)
+{
+	uint64_t index = statisticsNameHash(name) & (STATISTICS_SELECTOR_TABLE_SIZE - 1);
+	uint64_t probes;
+
+	for (probes = 0; probes < STATISTICS_SELECTOR_TABLE_SIZE; probes++) {
+		if (selectorNameCounts[index].name == NULL) {
+			selectorNameCounts[index].name = strdup(name);
+			if (selectorNameCounts[index].name == NULL)
+				break;
+			selectorNameCounts[index].count = count;
+			return;
+		}
+
+		if (strcmp(selectorNameCounts[index].name, name) == 0) {
+			selectorNameCounts[index].count += count;
+			return;
+		}
+
+		index = (index + 1) & (STATISTICS_SELECTOR_TABLE_SIZE - 1);
+	}
+
+	droppedSelectorCounts += count;
+}
+
+// Move the counts keyed by selector oop into the table keyed by selector name.  This must
+// be done while the selector oops are still valid.
+void statisticsFoldSelectors(void)
+{
+	char selectorString[256];
+	uint64_t i;
+
+	for (i = 0; i < STATISTICS_SELECTOR_TABLE_SIZE; i++) {
+		oop selector = selectorCounts[i].selector;
+
+		if (selector == asOop(NULL))
+			continue;
+
+		if (!isImmediate(selector) && isBytes(selector) && (basicByteSize(selector) < sizeof(selectorString)))
+			STStringToC(selector, selectorString);
+		else
+			strcpy (selectorString, "?");
+
+		statisticsAddSelectorName(selectorString, selectorCounts[i].count);
+		selectorCounts[i].selector = asOop(NULL);
+		selectorCounts[i].count = 0;
+	}
+}
+
+void statisticsReset(void)
+{
+	uint64_t i;
+
+	for (i = 0; i < STATISTICS_SELECTOR_TABLE_SIZE; i++)
+		free (selectorNameCounts[i].name);
+
+	memset (&vmStatistics, 0, sizeof(vmStatistics));
+	memset (selectorCounts, 0, sizeof(selectorCounts));
+	memset (selectorNameCounts, 0, sizeof(selectorNameCounts));
+	droppedSelectorCounts = 0;
+}
+
+int statisticsCompareNameCounts(const void *a, const void *b)
+{
+	const selectorNameCountStruct *x = (const selectorNameCountStruct *) a;
+	const selectorNameCountStruct *y = (const selectorNameCountStruct *) b;
+
+	if (x->count != y->count)
+		return (x->count < y->count) ? 1 : -1;
+	if (x->name == NULL || y->name == NULL)
+		return (x->name == NULL) - (y->name == NULL);
+	return strcmp(x->name, y->name);
+}
+
+// Answer the selector name table sorted by count, most frequent first.  The names still
+// belong to selectorNameCounts.  The caller frees the result.
+selectorNameCountStruct *statisticsSortedSelectors(uint64_t *size)
+{
+	selectorNameCountStruct *sorted = malloc(sizeof(selectorNameCounts));
+	uint64_t i, used = 0;
+
+	statisticsFoldSelectors();
+	if (sorted == NULL) {
+		*size = 0;
+		return NULL;
+	}
+
+	for (i = 0; i < STATISTICS_SELECTOR_TABLE_SIZE; i++)
+		if (selectorNameCounts[i].name != NULL)
+			sorted[used++] = selectorNameCounts[i];
+
+	qsort (sorted, used, sizeof(selectorNameCountStruct), statisticsCompareNameCounts);
+	*size = used;
+	return sorted;
+}
+
+uint64_t statisticsNonZero(uint64_t *counts, uint64_t size)
+{
+	uint64_t i, nonZero = 0;
+
+	for (i = 0; i < size; i++)
+		if (counts[i] != 0)
+			nonZero++;
+
+	return nonZero;
+}
+
+// Answer an Array of:
+//	1 - an Array with the number of times each bytecode was dispatched, indexed by bytecode + 1
+//	2 - an Array of #(selector count) pairs for sends that needed a method lookup, most frequent first
+//	3 - an Array of #(selector count) pairs for well known sends
+//	4 - an Array of #(primitiveNumber count) pairs
+//	5 - the number of messages not understood
+//	6 - the number of block activations
+void primVMStatistics()
+{
+	selectorNameCountStruct *sorted;
+	uint64_t i, index, size;
+
+	DEFINE_LOCALS;
+	DEFINE_LOCAL(result);
+	DEFINE_LOCAL(array);
+	DEFINE_LOCAL(pair);
+
+	SET_LOCAL(result, newInstanceOfClass (ST_ARRAY_CLASS, 6, EdenSpace));
+
+	SET_LOCAL(array, newInstanceOfClass (ST_ARRAY_CLASS, 256, EdenSpace));
+	for (i = 0; i < 256; i++)
+		indexedVarAtIntPut (GET_LOCAL(array), i + 1, cIntToST(vmStatistics.bytecodes[i]));
+	indexedVarAtIntPut (GET_LOCAL(result), 1, GET_LOCAL(array));
+
+	sorted = statisticsSortedSelectors(&size);
+	SET_LOCAL(array, newInstanceOfClass (ST_ARRAY_CLASS, size, EdenSpace));
+	indexedVarAtIntPut (GET_LOCAL(result), 2, GET_LOCAL(array));
+	for (i = 0; i < size; i++) {
+		SET_LOCAL(pair, newInstanceOfClass (ST_ARRAY_CLASS, 2, EdenSpace));
+		indexedVarAtIntPut (GET_LOCAL(array), i + 1, GET_LOCAL(pair));
+		indexedVarAtIntPut (GET_LOCAL(pair), 2, cIntToST(sorted[i].count));
+		oop name = CStringToST(sorted[i].name);
+		indexedVarAtIntPut (GET_LOCAL(pair), 1, name);
+	}
+	free (sorted);
+
+	SET_LOCAL(array, newInstanceOfClass (ST_ARRAY_CLASS, statisticsNonZero(vmStatistics.specialSends, MAX_SPECIAL_SELECTORS), EdenSpace));
+	indexedVarAtIntPut (GET_LOCAL(result), 3, GET_LOCAL(array));
+	for (i = 0, index = 1; i < MAX_SPECIAL_SELECTORS; i++) {
+		if (vmStatistics.specialSends[i] == 0)
+			continue;
+		SET_LOCAL(pair, newInstanceOfClass (ST_ARRAY_CLASS, 2, EdenSpace));
+		indexedVarAtIntPut (GET_LOCAL(array), index++, GET_LOCAL(pair));
+		indexedVarAtIntPut (GET_LOCAL(pair), 1, specialSelectors(i) == asOop(NULL) ? cIntToST(i) : specialSelectors(i));
+		indexedVarAtIntPut (GET_LOCAL(pair), 2, cIntToST(vmStatistics.specialSends[i]));
+	}
+
+	SET_LOCAL(array, newInstanceOfClass (ST_ARRAY_CLASS, statisticsNonZero(vmStatistics.primitiveCalls, PRIMITIVE_TABLE_SIZE), EdenSpace));
+	indexedVarAtIntPut (GET_LOCAL(result), 4, GET_LOCAL(array));
+	for (i = 0, index = 1; i < PRIMITIVE_TABLE_SIZE; i++) {
+		if (vmStatistics.primitiveCalls[i] == 0)
+			continue;
+		SET_LOCAL(pair, newInstanceOfClass (ST_ARRAY_CLASS, 2, EdenSpace));
+		indexedVarAtIntPut (GET_LOCAL(array), index++, GET_LOCAL(pair));
+		indexedVarAtIntPut (GET_LOCAL(pair), 1, cIntToST(i));
+		indexedVarAtIntPut (GET_LOCAL(pair), 2, cIntToST(vmStatistics.primitiveCalls[i]));
+	}
+
+	indexedVarAtIntPut (GET_LOCAL(result), 5, cIntToST(vmStatistics.messagesNotUnderstood));
+	indexedVarAtIntPut (GET_LOCAL(result), 6, cIntToST(vmStatistics.blockActivations));
+
+	oop resultOop = GET_LOCAL(result);
+	FREE_LOCALS;
+
+	push (cIntToST(0));
+	push (resultOop);
+}
+
+void primResetVMStatistics()
+{
+	statisticsReset();
+
+	push (cIntToST(0));
+	push (getReceiver());
+}
+
+// Write the statistics as text for the remote debugger, showing the top entries of each table.
+void statisticsReport(char *buffer, size_t size, uint64_t top)
+{
+	selectorNameCountStruct *sorted;
+	uint64_t i, j, count;
+	uint64_t totalBytecodes = 0;
+	size_t length = 0;
+	char name[256];
+
+#define REPORT(...) do {if (length < size) length += snprintf(&buffer[length], size - length, __VA_ARGS__);} while (0)
+
+	for (i = 0; i < 256; i++)
+		totalBytecodes += vmStatistics.bytecodes[i];
+
+	REPORT ("%" PRIu64 " bytecodes, %" PRIu64 " messages not understood, %" PRIu64 " block activations\n",
+		totalBytecodes, vmStatistics.messagesNotUnderstood, vmStatistics.blockActivations);
+
+	// Repeatedly pick the largest remaining count rather than sorting a copy of each table
+	REPORT ("\nBytecodes:\n");
+	uint8_t shown[256] = {0};
+	for (j = 0; j < top; j++) {
+		uint64_t best = 256;
+		for (i = 0; i < 256; i++)
+			if (!shown[i] && vmStatistics.bytecodes[i] != 0 && (best == 256 || vmStatistics.bytecodes[i] > vmStatistics.bytecodes[best]))
+				best = i;
+		if (best == 256)
+			break;
+		shown[best] = 1;
+		REPORT ("  %02" PRIx64 "  %12" PRIu64 "\n", best, vmStatistics.bytecodes[best]);
+	}
+
+	REPORT ("\nSends:\n");
+	sorted = statisticsSortedSelectors(&count);
+	for (i = 0; (i < count) && (i < top); i++)
+		REPORT ("  %12" PRIu64 "  %s\n", sorted[i].count, sorted[i].name);
+	free (sorted);
+
+	REPORT ("\nWell known sends:\n");
+	for (i = 0; i < MAX_SPECIAL_SELECTORS; i++) {
+		if (vmStatistics.specialSends[i] == 0)
+			continue;
+		if ((specialSelectors(i) != asOop(NULL)) && isBytes(specialSelectors(i)) && (basicByteSize(specialSelectors(i)) < sizeof(name)))
+			STStringToC(specialSelectors(i), name);
+		else
+			snprintf (name, sizeof(name), "%02" PRIx64, i);
+		REPORT ("  %12" PRIu64 "  %s\n", vmStatistics.specialSends[i], name);
+	}
+
+	REPORT ("\nPrimitives:\n");
+	for (i = 0; i < PRIMITIVE_TABLE_SIZE; i++)
+		if (vmStatistics.primitiveCalls[i] != 0)
+			REPORT ("  %12" PRIu64 "  %" PRIu64 "\n", vmStatistics.primitiveCalls[i], i);
+
+#undef REPORT
+}
+#else
+void statisticsFoldSelectors(void)
+{
+}
+
+void statisticsReport(char *buffer, size_t size, __attribute__((unused)) uint64_t top)
+{
+	snprintf (buffer, size, "Statistics aren't compiled into this VM.  Build it with \"make STATS=yes\".");
+}
+
+void primVMStatistics()
+{
+	push (cIntToST(1));
+	push (getReceiver());
+}
+
+void primResetVMStatistics()
+{
+	push (cIntToST(1));
+	push (getReceiver());
+}
+#endif
+
+void initializeStatisticsPrimitives()
+{
+	primitiveTable[PRIM_VM_STATISTICS] = primVMStatistics;
+	primitiveTable[PRIM_RESET_VM_STATISTICS] = primResetVMStatistics;
+}
@@ -201,33 +201,33 @@ void raiseSTError(oop errorClass, char *message)
 oop contextCopy(oop contextOop)
 {
 
-	oop newFrame, oldFrame;
+	oop newFrame, oldFrame, calledFrame;
 
 	DEFINE_LOCALS;
 	DEFINE_LOCAL (parentContext);
-	DEFINE_LOCAL (frameOop);
 	DEFINE_LOCAL (topFrame);
 	SET_LOCAL (parentContext, ST_NIL);
 
+	// Frames don't move, so oldFrame and calledFrame stay valid across a scavenge
 	oldFrame = contextOop;
+	calledFrame = ST_NIL;
 	
-	while (asContext(oldFrame)->method != ST_NIL) {
-		int64_t stackIndex;
+	while (asFrame(oldFrame)->method != ST_NIL) {
+		int64_t stackIndex, stackSize;
 		
-		SET_LOCAL(frameOop, oldFrame);
-		newFrame = newInstanceOfClass(ST_CODE_CONTEXT_CLASS, indexedObjectSize(oldFrame), EdenSpace);
-		oldFrame = GET_LOCAL(frameOop);
+		stackSize = frameSlotsEnd(oldFrame, calledFrame) - &asFrame(oldFrame)->stackBody[0];
+		newFrame = newInstanceOfClass(ST_CODE_CONTEXT_CLASS, stackSize, EdenSpace);
 	
-		asContext(newFrame)->stackOffset = asContext(oldFrame)->stackOffset;
-		asContext(newFrame)->pcOffset = asContext(oldFrame)->pcOffset;
-		asContext(newFrame)->method = asContext(oldFrame)->method;
-		asContext(newFrame)->methodContext = asContext(oldFrame)->methodContext;
-		asContext(newFrame)->contextId = markAsSmallInteger(stripTags(asContext(oldFrame)->contextId));
+		asContext(newFrame)->stackOffset = asFrame(oldFrame)->stackOffset;
+		asContext(newFrame)->pcOffset = asFrame(oldFrame)->pcOffset;
+		asContext(newFrame)->method = asFrame(oldFrame)->method;
+		asContext(newFrame)->methodContext = asFrame(oldFrame)->methodContext;
+		asContext(newFrame)->contextId = markAsSmallInteger(stripTags(asFrame(oldFrame)->contextId));
 
 		asContext(newFrame)->frame = ST_NIL;
 	
-		for (stackIndex = 0; stackIndex < indexedObjectSize(oldFrame); stackIndex++) {
-			asContext(newFrame)->stackBody[stackIndex] = asContext(oldFrame)->stackBody[stackIndex];
+		for (stackIndex = 0; stackIndex < stackSize; stackIndex++) {
+			asContext(newFrame)->stackBody[stackIndex] = asFrame(oldFrame)->stackBody[stackIndex];
 		}
 
 		if (GET_LOCAL(parentContext) != ST_NIL) {
@@ -238,7 +238,8 @@ oop contextCopy(oop contextOop)
 		}
 	
 		SET_LOCAL (parentContext, newFrame);
-		oldFrame = asContext(oldFrame)->frame;
+		calledFrame = oldFrame;
+		oldFrame = asFrame(oldFrame)->frame;
 	}
 
 	newFrame = GET_LOCAL(topFrame);